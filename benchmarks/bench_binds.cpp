@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "benchmark.h"
+
+// Cost of user binds: empty program is run with given number of extra directory binds. Besides client-side latency,
+// time spent mounting and unmounting binds is reported from task timings
+static int bench_main(const std::vector<std::string> &args) {
+    int num_binds = stoi(args[0]);
+    int runs = stoi(args[1]);
+    if (num_binds < 0 || static_cast<size_t>(num_binds) > libsbox::BINDS_MAX) {
+        std::cerr << "Number of binds must be in [0, " << libsbox::BINDS_MAX << "]" << std::endl;
+        return 1;
+    }
+
+    char bind_dir_template[] = "/tmp/libsbox-bench-XXXXXX";
+    if (mkdtemp(bind_dir_template) == nullptr) {
+        std::cerr << "Failed to create temporary directory" << std::endl;
+        return 1;
+    }
+    fs::path bind_dir = bind_dir_template;
+    for (int i = 0; i < num_binds; ++i) {
+        fs::create_directory(bind_dir / std::to_string(i));
+    }
+
+    libsbox::Session session;
+    Testing::safe_connect(session, "binary");
+
+    std::vector<int64_t> roundtrip_samples;
+    std::vector<int64_t> bind_mounts_samples;
+    std::vector<int64_t> umount_samples;
+    for (int i = 0; i < runs; ++i) {
+        GenericTarget target("/bin/true");
+        for (int j = 0; j < num_binds; ++j) {
+            target.get_binds().emplace_back("bind" + std::to_string(j), bind_dir / std::to_string(j)).allow_write();
+        }
+        target.set_collect_timings(true);
+
+        int64_t start = now_ns();
+        run_or_die(&session, {&target});
+        roundtrip_samples.push_back(now_ns() - start);
+        target.assert_exited(0);
+        bind_mounts_samples.push_back(target.get_timings_ns().at("bind_mounts"));
+        umount_samples.push_back(target.get_timings_ns().at("umount"));
+    }
+    fs::remove_all(bind_dir);
+
+    Report report("binds");
+    report.add_param("num_binds", num_binds);
+    report.add_param("runs", runs);
+    report.begin_results();
+    report.add_latencies("roundtrip", roundtrip_samples);
+    report.add_latencies("bind_mounts", bind_mounts_samples);
+    report.add_latencies("umount", umount_samples);
+    report.print();
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("bench", bench_main);
+    Testing::start(argc, argv);
+}
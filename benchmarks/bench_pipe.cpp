@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "benchmark.h"
+
+#include <fstream>
+#include <sys/stat.h>
+
+// Round-trip latency of one byte between two sandboxed programs connected with pair of pipes, as in interactive
+// problems. Measured inside "ping" program and passed back through writable bind
+static int bench_main(const std::vector<std::string> &args) {
+    int rounds = stoi(args[0]);
+
+    char out_dir_template[] = "/tmp/libsbox-bench-XXXXXX";
+    if (mkdtemp(out_dir_template) == nullptr) {
+        std::cerr << "Failed to create temporary directory" << std::endl;
+        return 1;
+    }
+    fs::path out_dir = out_dir_template;
+    chmod(out_dir.c_str(), 0777);
+
+    libsbox::Pipe ping_to_pong;
+    libsbox::Pipe pong_to_ping;
+    GenericTarget ping = GenericTarget::from_current_executable("ping", std::to_string(rounds));
+    ping.get_binds().emplace_back("out", out_dir).allow_write();
+    ping.get_stdout().use_pipe(ping_to_pong);
+    ping.get_stdin().use_pipe(pong_to_ping);
+    ping.set_wall_time_limit_ms(60000);
+    GenericTarget pong = GenericTarget::from_current_executable("pong");
+    pong.get_stdin().use_pipe(ping_to_pong);
+    pong.get_stdout().use_pipe(pong_to_ping);
+    pong.set_wall_time_limit_ms(60000);
+
+    run_or_die(nullptr, {&ping, &pong});
+    ping.assert_exited(0);
+    pong.assert_exited(0);
+
+    std::vector<int64_t> samples(static_cast<size_t>(rounds));
+    std::ifstream samples_file(out_dir / "samples", std::ios::binary);
+    samples_file.read(reinterpret_cast<char *>(samples.data()),
+                      static_cast<std::streamsize>(samples.size() * sizeof(int64_t)));
+    if (!samples_file) {
+        std::cerr << "Failed to read samples" << std::endl;
+        return 1;
+    }
+    fs::remove_all(out_dir);
+
+    Report report("pipe");
+    report.add_param("rounds", rounds);
+    report.begin_results();
+    report.add_latencies("pipe_roundtrip", samples);
+    report.print();
+    return 0;
+}
+
+static int ping_main(const std::vector<std::string> &args) {
+    int rounds = stoi(args[0]);
+    std::vector<int64_t> samples;
+    char c = 'x';
+    for (int i = 0; i < rounds; ++i) {
+        int64_t start = now_ns();
+        if (write(STDOUT_FILENO, &c, 1) != 1) return 1;
+        if (read(STDIN_FILENO, &c, 1) != 1) return 1;
+        samples.push_back(now_ns() - start);
+    }
+    close(STDOUT_FILENO);
+
+    std::ofstream samples_file("out/samples", std::ios::binary);
+    samples_file.write(reinterpret_cast<const char *>(samples.data()),
+                       static_cast<std::streamsize>(samples.size() * sizeof(int64_t)));
+    return samples_file ? 0 : 1;
+}
+
+static int pong_main(const std::vector<std::string> &) {
+    char c;
+    while (read(STDIN_FILENO, &c, 1) == 1) {
+        if (write(STDOUT_FILENO, &c, 1) != 1) return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("bench", bench_main);
+    Testing::add_handler("ping", ping_main);
+    Testing::add_handler("pong", pong_main);
+    Testing::start(argc, argv);
+}
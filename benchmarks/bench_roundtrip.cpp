@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "benchmark.h"
+
+// Latency of running empty program, measured by client from request to result. In "oneshot" mode every run opens
+// new connection, otherwise all runs go through one session
+static int bench_main(const std::vector<std::string> &args) {
+    std::string mode = args[0];
+    int runs = stoi(args[1]);
+    int warmup = stoi(args[2]);
+
+    libsbox::Session session;
+    if (mode != "oneshot") {
+        Testing::safe_connect(session, mode);
+    }
+    libsbox::Session *session_ptr = (mode == "oneshot" ? nullptr : &session);
+
+    std::vector<int64_t> samples;
+    for (int i = 0; i < warmup + runs; ++i) {
+        GenericTarget target("/bin/true");
+        int64_t start = now_ns();
+        run_or_die(session_ptr, {&target});
+        int64_t finish = now_ns();
+        target.assert_exited(0);
+        if (i >= warmup) {
+            samples.push_back(finish - start);
+        }
+    }
+
+    Report report("roundtrip");
+    report.add_param("mode", mode);
+    report.add_param("runs", runs);
+    report.add_param("warmup", warmup);
+    report.begin_results();
+    report.add_latencies("roundtrip", samples);
+    report.print();
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("bench", bench_main);
+    Testing::start(argc, argv);
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "benchmark.h"
+
+// Cost of each stage of request processing (see stage.h), collected from task timings of empty program runs. Daemon's
+// own aggregated histograms are reported too, they also include requests of other clients
+static int bench_main(const std::vector<std::string> &args) {
+    std::string mode = args[0];
+    int runs = stoi(args[1]);
+
+    libsbox::Session session;
+    Testing::safe_connect(session, mode);
+
+    std::map<std::string, std::vector<int64_t>> samples;
+    for (int i = 0; i < runs; ++i) {
+        GenericTarget target("/bin/true");
+        target.set_collect_timings(true);
+        run_or_die(&session, {&target});
+        target.assert_exited(0);
+        for (const auto &timing : target.get_timings_ns()) {
+            samples[timing.first].push_back(timing.second);
+        }
+    }
+
+    std::vector<libsbox::StageLatency> stages;
+    auto error = libsbox::get_stats(stages);
+    if (error) {
+        std::cerr << "Failed to get stats: " << error.get() << std::endl;
+        return 1;
+    }
+
+    Report report("stages");
+    report.add_param("mode", mode);
+    report.add_param("runs", runs);
+    report.begin_results();
+    for (const auto &stage_samples : samples) {
+        report.add_latencies(stage_samples.first, stage_samples.second);
+    }
+    for (const auto &stage : stages) {
+        report.add_result("daemon_" + stage.stage + "_p50_ns", stage.p50_ns);
+        report.add_result("daemon_" + stage.stage + "_p99_ns", stage.p99_ns);
+        report.add_result("daemon_" + stage.stage + "_p999_ns", stage.p999_ns);
+    }
+    report.print();
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("bench", bench_main);
+    Testing::start(argc, argv);
+}
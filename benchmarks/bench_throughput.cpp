@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "benchmark.h"
+
+#include <atomic>
+#include <thread>
+
+// Number of empty programs completed per second, when given number of clients run them concurrently. Each client is
+// a thread with its own connection (or new connection for every run in "oneshot" mode)
+static int bench_main(const std::vector<std::string> &args) {
+    std::string mode = args[0];
+    int clients = stoi(args[1]);
+    int runs_per_client = stoi(args[2]);
+
+    std::vector<std::vector<int64_t>> samples(static_cast<size_t>(clients));
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < clients; ++i) {
+        threads.emplace_back([&, i]() {
+            libsbox::Session session;
+            if (mode != "oneshot") {
+                Testing::safe_connect(session, mode);
+            }
+            libsbox::Session *session_ptr = (mode == "oneshot" ? nullptr : &session);
+
+            ++ready;
+            while (!go) {
+                std::this_thread::yield();
+            }
+            for (int j = 0; j < runs_per_client; ++j) {
+                GenericTarget target("/bin/true");
+                int64_t start = now_ns();
+                run_or_die(session_ptr, {&target});
+                samples[static_cast<size_t>(i)].push_back(now_ns() - start);
+                target.assert_exited(0);
+            }
+        });
+    }
+
+    // Sessions are connected before timer starts, so only running is measured
+    while (ready != clients) {
+        std::this_thread::yield();
+    }
+    int64_t start = now_ns();
+    go = true;
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    int64_t elapsed = now_ns() - start;
+
+    std::vector<int64_t> all_samples;
+    for (const auto &client_samples : samples) {
+        all_samples.insert(all_samples.end(), client_samples.begin(), client_samples.end());
+    }
+
+    Report report("throughput");
+    report.add_param("mode", mode);
+    report.add_param("clients", clients);
+    report.add_param("runs_per_client", runs_per_client);
+    report.begin_results();
+    report.add_result("elapsed_ns", elapsed);
+    report.add_result("runs_per_second", static_cast<double>(all_samples.size()) * 1e9 / static_cast<double>(elapsed));
+    report.add_latencies("roundtrip", all_samples);
+    report.print();
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("bench", bench_main);
+    Testing::start(argc, argv);
+}
@@ -0,0 +1,23 @@
+class Benchmark:
+    def __init__(self, argv):
+        self.argv = argv
+
+
+benchmarks = []
+
+benchmarks.append(Benchmark(["./bench_roundtrip", "bench", "oneshot", "1000", "50"]))
+for mode in ("json", "binary", "shm"):
+    benchmarks.append(Benchmark(["./bench_roundtrip", "bench", mode, "1000", "50"]))
+
+for clients in (1, 2, 4, 8, 16):
+    benchmarks.append(Benchmark(["./bench_throughput", "bench", "oneshot", str(clients), "200"]))
+for clients in (1, 2, 4, 8, 16):
+    benchmarks.append(Benchmark(["./bench_throughput", "bench", "binary", str(clients), "200"]))
+
+benchmarks.append(Benchmark(["./bench_pipe", "bench", "100000"]))
+
+for num_binds in (0, 1, 5, 10):
+    benchmarks.append(Benchmark(["./bench_binds", "bench", str(num_binds), "500"]))
+
+for mode in ("binary", "shm"):
+    benchmarks.append(Benchmark(["./bench_stages", "bench", mode, "1000"]))
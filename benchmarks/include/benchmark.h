@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_BENCHMARK_H
+#define LIBSBOX_BENCHMARK_H
+
+#include "testing.h"
+
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include <algorithm>
+#include <ctime>
+
+// Every benchmark prints exactly one JSON object to stdout:
+// {"benchmark": name, "params": {...}, "results": {...}}. Latencies are in nanoseconds
+class Report {
+public:
+    explicit Report(const std::string &name) : writer_(buffer_) {
+        writer_.StartObject();
+        writer_.Key("benchmark");
+        writer_.String(name.c_str());
+        writer_.Key("params");
+        writer_.StartObject();
+    }
+
+    void add_param(const std::string &name, int64_t value) {
+        writer_.Key(name.c_str());
+        writer_.Int64(value);
+    }
+
+    void add_param(const std::string &name, const std::string &value) {
+        writer_.Key(name.c_str());
+        writer_.String(value.c_str());
+    }
+
+    // Must be called once after all params are added
+    void begin_results() {
+        writer_.EndObject();
+        writer_.Key("results");
+        writer_.StartObject();
+    }
+
+    void add_result(const std::string &name, int64_t value) {
+        writer_.Key(name.c_str());
+        writer_.Int64(value);
+    }
+
+    void add_result(const std::string &name, double value) {
+        writer_.Key(name.c_str());
+        writer_.Double(value);
+    }
+
+    // Adds count, min, p50, p90, p99, max and mean of samples as "<name>_<stat>" results
+    void add_latencies(const std::string &name, std::vector<int64_t> samples) {
+        add_result(name + "_count", static_cast<int64_t>(samples.size()));
+        if (samples.empty()) return;
+        std::sort(samples.begin(), samples.end());
+        int64_t sum = 0;
+        for (int64_t sample : samples) {
+            sum += sample;
+        }
+        add_result(name + "_min_ns", samples.front());
+        add_result(name + "_p50_ns", percentile(samples, 50));
+        add_result(name + "_p90_ns", percentile(samples, 90));
+        add_result(name + "_p99_ns", percentile(samples, 99));
+        add_result(name + "_max_ns", samples.back());
+        add_result(name + "_mean_ns", sum / static_cast<int64_t>(samples.size()));
+    }
+
+    void print() {
+        writer_.EndObject();
+        writer_.EndObject();
+        std::cout << buffer_.GetString() << std::endl;
+    }
+
+private:
+    rapidjson::StringBuffer buffer_;
+    rapidjson::Writer<rapidjson::StringBuffer> writer_;
+
+    static int64_t percentile(const std::vector<int64_t> &sorted, size_t percent) {
+        size_t index = (sorted.size() * percent + 99) / 100;
+        return sorted[index == 0 ? 0 : index - 1];
+    }
+};
+
+inline int64_t now_ns() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Runs tasks either with one-off connection (mode "oneshot") or through given session
+inline void run_or_die(libsbox::Session *session, const std::vector<libsbox::Task *> &tasks) {
+    auto error = (session == nullptr ? libsbox::run_together(tasks) : session->run_together(tasks));
+    if (error) {
+        std::cerr << "Failed to run tasks: " << error.get() << std::endl;
+        exit(1);
+    }
+}
+
+#endif //LIBSBOX_BENCHMARK_H
@@ -0,0 +1,123 @@
+import subprocess
+from benchmarks import benchmarks
+import argparse
+import json
+import time
+import os
+
+# Allowed relative increase of latency (or decrease of throughput) compared to baseline
+MAX_REGRESSION = 0.2
+# Changes smaller than this are noise regardless of relative value
+MIN_REGRESSION_NS = 50000
+
+
+class Color:
+    FAIL = '\033[31;1m'
+    OK = '\033[92m'
+    WARN = '\033[33;1m'
+    END = '\033[0m'
+
+    @staticmethod
+    def ok(s):
+        return Color.col(Color.OK, s)
+
+    @staticmethod
+    def warn(s):
+        return Color.col(Color.WARN, s)
+
+    @staticmethod
+    def fail(s):
+        return Color.col(Color.FAIL, s)
+
+    @staticmethod
+    def col(c, s):
+        return c + s + Color.END
+
+
+def result_key(result):
+    return result["benchmark"] + " " + json.dumps(result["params"], sort_keys=True)
+
+
+def run_benchmark(benchmark):
+    completed_process = subprocess.run(benchmark.argv, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    if completed_process.returncode != 0:
+        print("[ " + Color.fail("FAILED") + " ] " + ' '.join(benchmark.argv) + "\n" +
+              completed_process.stderr.decode())
+        return None
+    result = json.loads(completed_process.stdout.decode())
+    print("[ " + Color.ok("  DONE") + " ] " + ' '.join(benchmark.argv))
+    for name, value in result["results"].items():
+        if name.endswith("_p50_ns") or name == "runs_per_second":
+            print("    " + name + ": " + str(value))
+    return result
+
+
+# Returns list of descriptions of regressions. Only medians and throughput are compared, tail latencies are too noisy
+def compare(results, baseline):
+    baseline_by_key = {result_key(result): result for result in baseline}
+    regressions = []
+    for result in results:
+        old = baseline_by_key.get(result_key(result))
+        if old is None:
+            continue
+        for name, value in result["results"].items():
+            if name not in old["results"]:
+                continue
+            old_value = old["results"][name]
+            if name.endswith("_p50_ns"):
+                regressed = value > old_value * (1 + MAX_REGRESSION) and value - old_value > MIN_REGRESSION_NS
+            elif name == "runs_per_second":
+                regressed = value < old_value * (1 - MAX_REGRESSION)
+            else:
+                continue
+            if regressed:
+                regressions.append(result_key(result) + " " + name + ": " + str(old_value) + " -> " + str(value))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--use-bundled", action="store_true")
+    parser.add_argument("--output", default="benchmarks.json")
+    parser.add_argument("--baseline", default=os.environ.get("LIBSBOX_BENCHMARK_BASELINE"))
+    args = parser.parse_args()
+
+    if args.use_bundled:
+        if os.path.exists("/run/libsboxd.pid"):
+            os.system("libsboxd stop")
+        libsboxd_process = subprocess.Popen(["libsboxd"])
+        time.sleep(0.5)
+        assert libsboxd_process.poll() is None
+    else:
+        assert os.path.exists("/etc/libsboxd/socket")
+
+    results = []
+    failed = False
+    for benchmark in benchmarks:
+        result = run_benchmark(benchmark)
+        if result is None:
+            failed = True
+        else:
+            results.append(result)
+
+    if args.use_bundled:
+        os.remove("/run/libsboxd.pid")
+
+    with open(args.output, "w") as output:
+        json.dump(results, output, indent=2)
+    print("Results written to " + args.output)
+
+    if args.baseline is not None:
+        with open(args.baseline) as baseline_file:
+            regressions = compare(results, json.load(baseline_file))
+        for regression in regressions:
+            print("[ " + Color.fail("REGRESSED") + " ] " + regression)
+        if regressions:
+            failed = True
+
+    if failed:
+        exit(1)
+
+
+if __name__ == "__main__":
+    main()
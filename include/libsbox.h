@@ -9,6 +9,9 @@
 
 #include <string>
 #include <iostream>
+#include <functional>
+#include <future>
+#include <map>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -21,6 +24,8 @@ static const size_t ENVC_MAX = 128;
 static const size_t BINDS_MAX = 10;
 static const size_t ARGV_MAX = 4096;
 static const size_t ENV_MAX = 4096;
+// Maximum total capture limit of streams of one request
+static const int64_t CAPTURE_MAX = 32 * 1024 * 1024;
 
 using time_ms_t = int64_t;
 using memory_kb_t = int64_t;
@@ -79,12 +84,34 @@ public:
     void disable();
     void use_pipe(const Pipe &pipe);
     void use_file(const std::string &filename);
+    // Pass data to program as contents of stdin, without any files. Only for stdin
+    void use_data(const std::string &data);
+    // Capture output into memory and return it with results, output beyond limit_bytes is dropped. Program writes
+    // into pipe, which is drained while it runs, so writes never fail. Only for stdout and stderr
+    void capture(int64_t limit_bytes);
 
     const std::string &get_filename() const;
+    bool is_inline() const;
+    // -1 if stream is not captured
+    int64_t get_capture_limit() const;
+
+    // Input data or captured output. JSON encoding carries it as is, so binary output makes response invalid for
+    // strict JSON parsers
+    const std::string &get_data() const;
+    void set_data(const std::string &data);
+    // Whether captured output was longer than capture limit
+    bool is_truncated() const;
+    void set_truncated(bool truncated);
 protected:
     std::string filename_;
+    bool inline_ = false;
+    int64_t capture_limit_ = -1;
+    std::string data_;
+    bool truncated_ = false;
     Stream() = default;
 
+    void reset();
+
 private:
     template<class Writer>
     void serialize_request(Writer &writer) const;
@@ -99,8 +126,29 @@ public:
     void use_stdout();
 };
 
+// Resource usage of running task, sent periodically if telemetry is requested (see Task::set_telemetry_interval_ms())
+struct TelemetrySample {
+    // Wall time since start of run
+    time_ms_t wall_time_ms = 0;
+    time_ms_t time_usage_ms = 0;
+    // Current (not peak) memory usage
+    memory_kb_t memory_usage_kb = 0;
+    // Number of processes and threads alive in box
+    int64_t pids = 0;
+    // Bytes written to stdout, if it is a file or captured, otherwise -1
+    int64_t stdout_bytes = -1;
+
+    template<class Writer>
+    void serialize(Writer &writer) const;
+
+    template<class Value>
+    Error deserialize(const Value &value);
+};
+
 class Task {
 public:
+    using TelemetryCallback = std::function<void(const TelemetrySample &sample)>;
+
     time_ms_t get_time_limit_ms() const;
     void set_time_limit_ms(time_ms_t time_limit_ms);
     time_ms_t get_wall_time_limit_ms() const;
@@ -117,10 +165,30 @@ public:
     void set_need_ipc(bool need_ipc);
     bool get_use_standard_binds() const;
     void set_use_standard_binds(bool use_standard_binds);
+    bool get_collect_timings() const;
+    void set_collect_timings(bool collect_timings);
+    // Count hardware events of program (see get_instructions() and below)
+    bool get_collect_counters() const;
+    void set_collect_counters(bool collect_counters);
+    // Limit on user-space instructions retired, which doesn't depend on CPU frequency or load of the machine. Works
+    // only on hardware with performance counters, otherwise it is not enforced and get_instructions() returns -1
+    int64_t get_instruction_limit() const;
+    void set_instruction_limit(int64_t instruction_limit);
+    // Send sample of resource usage every telemetry_interval_ms while task runs, -1 disables telemetry. Samples are
+    // taken together with limit checks and are dropped rather than delayed if daemon is busy, so they may come less
+    // often than requested. Clients of legacy protocol (single JSON request per connection) never receive them
+    time_ms_t get_telemetry_interval_ms() const;
+    void set_telemetry_interval_ms(time_ms_t telemetry_interval_ms);
+    // Called from Session::process_events() for every sample received before task completes
+    const TelemetryCallback &get_telemetry_callback() const;
+    void set_telemetry_callback(TelemetryCallback callback);
 
     Stream &get_stdin();
+    const Stream &get_stdin() const;
     Stream &get_stdout();
+    const Stream &get_stdout() const;
     StderrStream &get_stderr();
+    const StderrStream &get_stderr() const;
 
     const std::vector<std::string> &get_argv() const;
     void set_argv(const std::vector<std::string> &argv);
@@ -155,6 +223,26 @@ public:
     void set_oom_killed(bool oom_killed);
     bool is_memory_limit_hit() const;
     void set_memory_limit_hit(bool memory_limit_hit);
+    // Wall time since start of run and peak memory usage at moment when box ran out of memory and was killed, -1 if
+    // this didn't happen
+    time_ms_t get_oom_time_ms() const;
+    void set_oom_time_ms(time_ms_t oom_time_ms);
+    memory_kb_t get_oom_memory_usage_kb() const;
+    void set_oom_memory_usage_kb(memory_kb_t oom_memory_usage_kb);
+    bool is_instruction_limit_exceeded() const;
+    void set_instruction_limit_exceeded(bool instruction_limit_exceeded);
+    // Counters of program and all its threads, filled if collect_counters is set. -1 if counter is not supported
+    int64_t get_instructions() const;
+    void set_instructions(int64_t instructions);
+    int64_t get_cycles() const;
+    void set_cycles(int64_t cycles);
+    int64_t get_cache_misses() const;
+    void set_cache_misses(int64_t cache_misses);
+    int64_t get_context_switches() const;
+    void set_context_switches(int64_t context_switches);
+    // Time spent in each stage of processing (stage name -> nanoseconds), filled if collect_timings is set
+    const std::map<std::string, int64_t> &get_timings_ns() const;
+    void set_timing_ns(const std::string &stage, int64_t ns);
 
     template<class Writer>
     void serialize_request(Writer &writer) const;
@@ -177,6 +265,11 @@ private:
     int32_t max_threads_ = 1;
     bool need_ipc_ = false;
     bool use_standard_binds_ = true;
+    bool collect_timings_ = false;
+    bool collect_counters_ = false;
+    int64_t instruction_limit_ = -1;
+    time_ms_t telemetry_interval_ms_ = -1;
+    TelemetryCallback telemetry_callback_;
 
     Stream stdin_;
     Stream stdout_;
@@ -200,10 +293,122 @@ private:
     int term_signal_ = -1;
     bool oom_killed_ = false;
     bool memory_limit_hit_ = false;
+    time_ms_t oom_time_ms_ = -1;
+    memory_kb_t oom_memory_usage_kb_ = -1;
+    bool instruction_limit_exceeded_ = false;
+    int64_t instructions_ = -1;
+    int64_t cycles_ = -1;
+    int64_t cache_misses_ = -1;
+    int64_t context_switches_ = -1;
+    std::map<std::string, int64_t> timings_ns_;
 };
 
+// Long-lived connection to libsboxd. Requests are sent as frames tagged with request id, so connection setup is paid
+// only once for any number of requests. Requests may be submitted asynchronously: submit() only queues request, and
+// completion is delivered from process_events(), which should be called whenever get_fd() is ready (readable, or
+// writable if wants_write()). Session is not thread-safe
+class Session {
+public:
+    using Callback = std::function<void(const Error &error)>;
+
+    // How requests and results are transferred. JSON is compatibility path, BINARY uses compact encoding of frames,
+    // SHARED_MEMORY passes requests and results through ring in memory shared with daemon (socket is only used for
+    // wakeups, requests which don't fit into ring slot are sent in BINARY)
+    enum class Mode {
+        JSON,
+        BINARY,
+        SHARED_MEMORY
+    };
+
+    Session() = default;
+    ~Session();
+
+    Session(const Session &) = delete;
+    Session &operator=(const Session &) = delete;
+
+    // Mode is downgraded if daemon doesn't support it, get_mode() returns mode actually used
+    Error connect(const std::string &socket_path = "/etc/libsboxd/socket", Mode mode = Mode::BINARY);
+    void disconnect();
+    bool is_connected() const;
+    Mode get_mode() const;
+
+    // Priority of requests submitted after this call. Daemon queues requests when all boxes are busy and runs those
+    // with higher priority first (e.g. live contest before rejudge), requests with equal priority are run in order
+    int32_t get_priority() const;
+    void set_priority(int32_t priority);
+
+    // Run tasks and wait for results. Other pending requests are also processed while waiting
+    Error run_together(const std::vector<Task *> &tasks);
+
+    // Queue request. Tasks must stay alive until callback is called, results are written into them. Callback is called
+    // exactly once, also if connection fails or session is disconnected. Callback may submit and wait for requests of
+    // the same session
+    Error submit(const std::vector<Task *> &tasks, Callback callback);
+    std::future<Error> submit(const std::vector<Task *> &tasks);
+
+    // Socket file descriptor to be polled from client's own event loop
+    fd_t get_fd() const;
+    // True if some queued data is not sent yet, so get_fd() should be polled for writing too
+    bool wants_write() const;
+    // Number of submitted requests, which are not completed yet
+    size_t get_pending_count() const;
+
+    // Send queued data and dispatch all completed requests without blocking
+    Error process_events();
+    // Block until next request completes (or no requests are pending)
+    Error wait_one();
+private:
+    struct PendingRequest {
+        std::vector<Task *> tasks;
+        Callback callback;
+    };
+
+    fd_t socket_fd_ = -1;
+    uint64_t next_request_id_ = 1;
+    Mode mode_ = Mode::JSON;
+    int32_t priority_ = 0;
+    // Shared memory ring (shm_ring::Region) and slots, which are not used by any request
+    void *ring_ = nullptr;
+    std::vector<uint32_t> free_slots_;
+    std::map<uint64_t, PendingRequest> pending_;
+    std::string out_buffer_;
+    size_t out_offset_ = 0;
+    std::string in_buffer_;
+    uint64_t completed_ = 0;
+
+    Error fail(const Error &error);
+    Error flush();
+    Error receive();
+    // Pass sample received in FRAME_TELEMETRY to callback of its task
+    Error handle_sample(uint64_t request_id, const std::string &payload);
+    bool submit_to_ring(uint64_t request_id, const std::vector<Task *> &tasks);
+    Error complete_from_ring();
+};
+
+// Run tasks using one-off session
 Error run_together(const std::vector<Task *> &tasks, const std::string &socket_path = "/etc/libsboxd/socket");
 
+// Latency of one processing stage, aggregated over all requests since daemon start
+struct StageLatency {
+    std::string stage;
+    uint64_t count;
+    int64_t p50_ns;
+    int64_t p99_ns;
+    int64_t p999_ns;
+    int64_t max_ns;
+};
+
+// Container pool counters of all workers since daemon start. Miss means container was started on request path
+struct PoolStats {
+    uint64_t hits;
+    uint64_t misses;
+};
+
+// Query per-stage latency statistics of daemon
+Error get_stats(std::vector<StageLatency> &stages, const std::string &socket_path = "/etc/libsboxd/socket");
+Error get_stats(std::vector<StageLatency> &stages, PoolStats &pool,
+                const std::string &socket_path = "/etc/libsboxd/socket");
+
 } // namespace libsbox
 
 #endif //LIBSBOX_LIBSBOX_H
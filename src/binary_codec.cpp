@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "binary_codec.h"
+
+#include <cstring>
+
+void BinaryWriter::write_uint32(uint32_t value) {
+    put(&value, sizeof(value));
+}
+
+void BinaryWriter::write_int32(int32_t value) {
+    put(&value, sizeof(value));
+}
+
+void BinaryWriter::write_int64(int64_t value) {
+    put(&value, sizeof(value));
+}
+
+void BinaryWriter::write_bool(bool value) {
+    char byte = value ? 1 : 0;
+    put(&byte, 1);
+}
+
+void BinaryWriter::write_string(const std::string &value) {
+    write_uint32(static_cast<uint32_t>(value.size()));
+    put(value.data(), value.size());
+}
+
+const std::string &BinaryWriter::get() const {
+    return buffer_;
+}
+
+void BinaryWriter::put(const void *data, size_t size) {
+    buffer_.append(static_cast<const char *>(data), size);
+}
+
+BinaryReader::BinaryReader(const char *data, size_t size) : data_(data), size_(size) {}
+
+uint32_t BinaryReader::read_uint32() const {
+    uint32_t value = 0;
+    take(&value, sizeof(value));
+    return value;
+}
+
+int32_t BinaryReader::read_int32() const {
+    int32_t value = 0;
+    take(&value, sizeof(value));
+    return value;
+}
+
+int64_t BinaryReader::read_int64() const {
+    int64_t value = 0;
+    take(&value, sizeof(value));
+    return value;
+}
+
+bool BinaryReader::read_bool() const {
+    char byte = 0;
+    take(&byte, 1);
+    if (byte != 0 && byte != 1) {
+        failed_ = true;
+    }
+    return byte == 1;
+}
+
+std::string BinaryReader::read_string() const {
+    uint32_t size = read_uint32();
+    if (failed_ || size > size_ - offset_) {
+        failed_ = true;
+        return std::string();
+    }
+    std::string value(data_ + offset_, size);
+    offset_ += size;
+    return value;
+}
+
+bool BinaryReader::failed() const {
+    return failed_;
+}
+
+bool BinaryReader::at_end() const {
+    return offset_ == size_;
+}
+
+void BinaryReader::take(void *to, size_t size) const {
+    if (failed_ || size > size_ - offset_) {
+        failed_ = true;
+        return;
+    }
+    memcpy(to, data_ + offset_, size);
+    offset_ += size;
+}
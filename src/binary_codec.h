@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_BINARY_CODEC_H
+#define LIBSBOX_BINARY_CODEC_H
+
+#include <string>
+#include <stdint.h>
+
+// Compact encoding of requests and responses, used by sessions which negotiated protocol::FLAG_BINARY_V1. Integers are
+// fixed-width in native byte order (connection is always local), strings are uint32 length followed by bytes
+class BinaryWriter {
+public:
+    void write_uint32(uint32_t value);
+    void write_int32(int32_t value);
+    void write_int64(int64_t value);
+    void write_bool(bool value);
+    void write_string(const std::string &value);
+
+    const std::string &get() const;
+private:
+    std::string buffer_;
+
+    void put(const void *data, size_t size);
+};
+
+// Reader is passed through serialization templates by const reference (like rapidjson::Value), so its cursor is
+// mutable. Reading past end of data returns zeroes and marks reader as failed
+class BinaryReader {
+public:
+    BinaryReader(const char *data, size_t size);
+
+    uint32_t read_uint32() const;
+    int32_t read_int32() const;
+    int64_t read_int64() const;
+    bool read_bool() const;
+    std::string read_string() const;
+
+    bool failed() const;
+    // True if all data is consumed
+    bool at_end() const;
+private:
+    const char *data_;
+    size_t size_;
+    mutable size_t offset_ = 0;
+    mutable bool failed_ = false;
+
+    void take(void *to, size_t size) const;
+};
+
+#endif //LIBSBOX_BINARY_CODEC_H
@@ -7,7 +7,9 @@
 #include "utils.h"
 
 #include <sys/mount.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 Bind::Bind(fs::path inside, fs::path outside, int flags)
     : inside_(std::move(inside)), outside_(std::move(outside)), flags_(flags) {}
@@ -15,6 +17,9 @@ Bind::Bind(fs::path inside, fs::path outside, int flags)
 Bind::Bind(const BindData *bind_data)
     : inside_(bind_data->inside_.c_str()), outside_(bind_data->outside_.c_str()), flags_(bind_data->flags_) {}
 
+std::map<std::pair<std::string, int>, Bind::Template> Bind::templates_;
+bool Bind::templates_supported_ = true;
+
 std::vector<Bind> Bind::standard_binds = {
     {"/lib", "/lib", 0},
     {"/lib64", "/lib64", Rules::OPT},
@@ -35,8 +40,7 @@ void Bind::set_paths(const fs::path &root_dir, const fs::path &work_dir) {
     }
 }
 
-void Bind::mount(const fs::path &root_dir, const fs::path &work_dir) {
-    set_paths(root_dir, work_dir);
+unsigned long Bind::get_mount_flags() const {
     unsigned long mount_flags = (MS_BIND | MS_REC);
     if (!(flags_ & Rules::RW)) {
         mount_flags |= MS_RDONLY;
@@ -50,46 +54,110 @@ void Bind::mount(const fs::path &root_dir, const fs::path &work_dir) {
     if (!(flags_ & Rules::SUID)) {
         mount_flags |= MS_NOSUID;
     }
+    return mount_flags;
+}
+
+bool Bind::attach_template(const struct stat &from_stat) {
+    if (!templates_supported_) return false;
+
+    auto key = std::make_pair(from_.string(), flags_ & ~Rules::OPT);
+    auto it = templates_.find(key);
+    if (it != templates_.end() && (it->second.dev != from_stat.st_dev || it->second.ino != from_stat.st_ino)) {
+        close(it->second.fd);
+        templates_.erase(it);
+        it = templates_.end();
+    }
+
+    if (it == templates_.end()) {
+        if (templates_.size() >= MAX_TEMPLATES) return false;
+        fd_t fd = static_cast<fd_t>(syscall(SYS_open_tree, AT_FDCWD, from_.c_str(),
+                                            OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_RECURSIVE));
+        if (fd < 0) {
+            if (errno == ENOSYS) {
+                templates_supported_ = false;
+                return false;
+            }
+            die(format("Cannot clone tree %s: %m", from_.c_str()));
+        }
+
+        unsigned long mount_flags = get_mount_flags();
+        struct mount_attr attr = {};
+        attr.attr_set |= ((mount_flags & MS_RDONLY) ? MOUNT_ATTR_RDONLY : 0);
+        attr.attr_set |= ((mount_flags & MS_NODEV) ? MOUNT_ATTR_NODEV : 0);
+        attr.attr_set |= ((mount_flags & MS_NOEXEC) ? MOUNT_ATTR_NOEXEC : 0);
+        attr.attr_set |= ((mount_flags & MS_NOSUID) ? MOUNT_ATTR_NOSUID : 0);
+        if (syscall(SYS_mount_setattr, fd, "", AT_EMPTY_PATH | AT_RECURSIVE, &attr, sizeof(attr)) != 0) {
+            if (errno == ENOSYS) {
+                close(fd);
+                templates_supported_ = false;
+                return false;
+            }
+            die(format("Cannot set attributes of tree %s: %m", from_.c_str()));
+        }
+        it = templates_.emplace(key, Template{fd, from_stat.st_dev, from_stat.st_ino}).first;
+    }
+
+    fd_t tree_fd = static_cast<fd_t>(syscall(SYS_open_tree, it->second.fd, "",
+                                             OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_EMPTY_PATH | AT_RECURSIVE));
+    if (tree_fd < 0) {
+        if (errno != EINVAL) {
+            die(format("Cannot clone template of %s: %m", from_.c_str()));
+        }
+        // Most kernels can't clone detached trees. Attaching template itself would cost as much as plain bind mount,
+        // so templates are not used at all
+        close_templates();
+        templates_supported_ = false;
+        return false;
+    }
 
+    if (syscall(SYS_move_mount, tree_fd, "", AT_FDCWD, to_.c_str(), MOVE_MOUNT_F_EMPTY_PATH) != 0) {
+        die(format("Cannot mount %s: %m", to_.c_str()));
+    }
+    if (close(tree_fd) != 0) {
+        die(format("Cannot close tree descriptor: %m"));
+    }
+    return true;
+}
+
+void Bind::mount(const fs::path &root_dir, const fs::path &work_dir) {
+    set_paths(root_dir, work_dir);
     bool optional = (flags_ & Rules::OPT);
 
-    std::error_code error;
-    if (!fs::exists(from_, error)) {
+    struct stat from_stat = {};
+    if (stat(from_.c_str(), &from_stat) != 0) {
+        if (errno != ENOENT) {
+            die(format("Cannot stat %s: %m", from_.c_str()));
+        }
         if (optional) return;
         die(format("%s not exists", from_.c_str()));
     }
 
-    if (fs::is_directory(from_, error)) {
+    std::error_code error;
+    if (S_ISDIR(from_stat.st_mode)) {
         fs::create_directories(to_, error);
         if (error) {
             die(format("Cannot create dir %s for mount point: %s", to_.c_str(), error.message().c_str()));
         }
-        if (::mount(from_.c_str(), to_.c_str(), "none", mount_flags, "") < 0) {
-            die(format("Cannot mount %s: %m", to_.c_str()));
-        }
-        mounted_ = true;
-    } else if (fs::is_regular_file(from_, error)) {
+    } else if (S_ISREG(from_stat.st_mode)) {
         fs::create_directories(to_.parent_path(), error);
         if (error) {
             die(format("Cannot create dir %s: %s", from_.parent_path().c_str(), error.message().c_str()));
         }
-        int fd = open(to_.c_str(), O_CREAT | O_WRONLY | O_TRUNC);
+        int fd = open(to_.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
         if (fd < 0) {
             die(format("Cannot create file %s for mount point: %m", to_.c_str()));
         }
         if (close(fd) < 0) {
             die(format("Cannot close file desctiptor: %m"));
         }
-        if (::mount(from_.c_str(), to_.c_str(), "none", mount_flags, "") < 0) {
-            die(format("Cannot mount %s: %m", to_.c_str()));
-        }
-        mounted_ = true;
     } else {
         die(format("%s is not directory nor regular file", to_.c_str()));
     }
-    if (error) {
-        die(format("Cannot stat %s: %s", from_.c_str(), error.message().c_str()));
+
+    if (!attach_template(from_stat) && ::mount(from_.c_str(), to_.c_str(), "none", get_mount_flags(), "") < 0) {
+        die(format("Cannot mount %s: %m", to_.c_str()));
     }
+    mounted_ = true;
 }
 
 void Bind::umount_if_mounted() {
@@ -100,6 +168,15 @@ void Bind::umount_if_mounted() {
     mounted_ = false;
 }
 
+void Bind::close_templates() {
+    for (auto &entry : templates_) {
+        if (close(entry.second.fd) != 0) {
+            die(format("Cannot close template of %s: %m", entry.first.first.c_str()));
+        }
+    }
+    templates_.clear();
+}
+
 void Bind::apply_standard_rules(const fs::path &root_dir, const fs::path &work_dir) {
     for (auto &bind : standard_binds) {
         bind.mount(root_dir, work_dir);
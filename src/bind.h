@@ -6,9 +6,12 @@
 #define LIBSBOX_BIND_H_
 
 #include "task_data.h"
+#include "libsbox_internal.h"
 
 #include <filesystem>
+#include <map>
 #include <vector>
+#include <sys/stat.h>
 
 namespace fs = std::filesystem;
 
@@ -29,7 +32,12 @@ public:
     void umount_if_mounted();
 
 static void apply_standard_rules(const fs::path &root_dir, const fs::path &work_dir);
+    // Close templates of container. Container shares descriptor table with worker, so it must be done before exit
+    static void close_templates();
 private:
+    // Templates are open descriptors, binds beyond this number are mounted without them
+    static const size_t MAX_TEMPLATES = 16;
+
     fs::path inside_;
     fs::path outside_;
     int flags_;
@@ -38,9 +46,25 @@ private:
     fs::path from_;
     fs::path to_;
 
+    // Detached copy of outside tree with mount attributes already set. Outside path is remembered by device and inode,
+    // so template is rebuilt if path is replaced
+    struct Template {
+        fd_t fd;
+        dev_t dev;
+        ino_t ino;
+    };
+
     void set_paths(const fs::path &root_dir, const fs::path &work_dir);
+    unsigned long get_mount_flags() const;
+    // Attach clone of cached template to mount point. Returns false if template can't be used, then plain bind mount
+    // is done
+    bool attach_template(const struct stat &from_stat);
 
     static std::vector<Bind> standard_binds;
+    // Templates of container keyed by outside path and rules
+    static std::map<std::pair<std::string, int>, Template> templates_;
+    // Cleared if kernel lacks new mount API or can't clone detached trees
+    static bool templates_supported_;
 };
 
 #endif //LIBSBOX_BIND_H_
@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "cgroup.h"
+#include "cgroup_v1.h"
+#include "cgroup_v2.h"
+#include "config.h"
+
+void Cgroup::init() {
+    if (Config::get().get_cgroup_version() == 2) {
+        CgroupV2::init();
+    } else {
+        CgroupV1::init();
+    }
+}
+
+Cgroup *Cgroup::create(const std::string &id) {
+    if (Config::get().get_cgroup_version() == 2) {
+        return new CgroupV2(id);
+    }
+    return new CgroupV1(id);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_CGROUP_H
+#define LIBSBOX_CGROUP_H
+
+#include "libsbox_internal.h"
+
+#include <memory>
+#include <string>
+
+// Resource usage of cgroup, collected when box run finishes
+struct CgroupUsage {
+    int64_t time_usage_ns;
+    int64_t time_usage_sys_ns;
+    int64_t time_usage_user_ns;
+    memory_kb_t memory_usage_kb;
+    bool oom_killed;
+    bool memory_limit_hit;
+};
+
+// Cgroup used for limiting and accounting resources of box. It is created once per container and reset between runs.
+// Implemented on top of cgroup v1 controllers and on top of cgroup v2 unified hierarchy, backend is selected by
+// "cgroup_version" config option
+class Cgroup {
+public:
+    virtual ~Cgroup() = default;
+
+    // Prepare libsbox hierarchy, must be called once on daemon start
+    static void init();
+
+    // Create cgroup for box with given id using configured backend
+    static Cgroup *create(const std::string &id);
+
+    // Cleanup on critical error
+    virtual void _die() = 0;
+
+    // Zero or baseline counters and drop memory limit, so next run of box starts clean. Returns false if backend can't
+    // do it and cgroup must be created anew
+    virtual bool reset() = 0;
+    virtual void set_memory_limit(memory_kb_t memory_limit_kb) = 0;
+    // Restrict cgroup to given cpulist and memory nodes list (or nodes of parent if it is empty). Available only if
+    // "cpuset" policy is configured
+    virtual void set_cpuset(const std::string &cpus, const std::string &mems) = 0;
+
+    // Open files needed for entering cgroup, so enter() can be done after chroot()
+    virtual void delay_enter() = 0;
+    virtual bool is_enter_fd(fd_t fd) = 0;
+    virtual void enter() = 0;
+
+    // Get fd of cgroup directory for clone3(CLONE_INTO_CGROUP), or -1 if backend doesn't support it
+    virtual fd_t get_dir_fd() = 0;
+
+    // Kill all processes in cgroup and wait until none of them is alive, zombies may be left. Returns false if backend
+    // can't do it
+    virtual bool kill_all() = 0;
+    // Wait until no process is left in cgroup, e.g. before removing cgroup of killed container
+    virtual void wait_empty() = 0;
+
+    // CPU time used so far. Called on every check of time limit, so stat files are kept open between calls
+    virtual int64_t get_time_usage_ns() = 0;
+    // Descriptor, which becomes readable on memory events of cgroup, -1 if backend doesn't provide it
+    virtual fd_t get_memory_event_fd() = 0;
+    // Consume pending memory events. Returns true if cgroup has run out of memory since last reset
+    virtual bool check_oom() = 0;
+    // Read all accounted values at once
+    virtual CgroupUsage get_usage() = 0;
+    // Memory used right now (not peak) and number of processes and threads alive, for samples of running box
+    virtual memory_kb_t get_memory_current_kb() = 0;
+    virtual int64_t get_pid_count() = 0;
+};
+
+#endif //LIBSBOX_CGROUP_H
@@ -9,6 +9,13 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+
+namespace {
+// Removal of busy cgroup is retried for a second
+const int MAX_REMOVE_ATTEMPTS = 1000;
+const long REMOVE_RETRY_DELAY_NS = 1000000;
+} // namespace
 
 CgroupController::CgroupController(const std::string &name, const std::string &id) {
     path_ = Config::get().get_cgroup_root() / name / "libsbox" / id;
@@ -21,10 +28,16 @@ CgroupController::CgroupController(const std::string &name, const std::string &i
 
 CgroupController::~CgroupController() {
     if (enter_fd_ != -1) close_enter_fd();
-    std::error_code error;
-    fs::remove(path_, error);
-    if (error) {
-        die(format("Cannot remove dir '%s': %s", path_.c_str(), error.message().c_str()));
+    if (dir_fd_ != -1 && close(dir_fd_) != 0) {
+        die(format("Cannot close dir '%s': %m", path_.c_str()));
+    }
+    // Cgroup may be reported busy for a moment after its last process has left
+    for (int attempt = 1; rmdir(path_.c_str()) != 0 && errno != ENOENT; ++attempt) {
+        if (errno != EBUSY || attempt == MAX_REMOVE_ATTEMPTS) {
+            die(format("Cannot remove dir '%s': %m", path_.c_str()));
+        }
+        struct timespec delay = {0, REMOVE_RETRY_DELAY_NS};
+        nanosleep(&delay, nullptr);
     }
 }
 
@@ -41,6 +54,15 @@ std::string CgroupController::read(const std::string &filename) {
     return read_file(path_ / filename);
 }
 
+fs::path CgroupController::get_path(const std::string &filename) const {
+    return path_ / filename;
+}
+
+bool CgroupController::exists(const std::string &filename) {
+    std::error_code error;
+    return fs::exists(path_ / filename, error);
+}
+
 void CgroupController::enter() {
     if (enter_fd_ == -1) {
         die("Cgroup enter was not delayed");
@@ -48,7 +70,7 @@ void CgroupController::enter() {
     std::string to_write = std::to_string(getpid());
     int cnt = ::write(enter_fd_, to_write.c_str(), to_write.size());
     if (cnt < 0 || static_cast<size_t>(cnt) != to_write.size()) {
-        die(format("Cannot write to cgroups tasks file: %m"));
+        die(format("Cannot write to cgroup.procs file: %m"));
     }
     close_enter_fd();
 }
@@ -70,7 +92,7 @@ void CgroupController::delay_enter() {
     if (enter_fd_ != -1) {
         return;
     }
-    fs::path path = path_ / "tasks";
+    fs::path path = path_ / "cgroup.procs";
     enter_fd_ = open(path.c_str(), O_WRONLY | O_CLOEXEC);
     if (enter_fd_ < 0) {
         die(format("Cannot open file '%s' for writing: %m", path.c_str()));
@@ -81,9 +103,19 @@ fd_t CgroupController::get_enter_fd() {
     return enter_fd_;
 }
 
+fd_t CgroupController::get_dir_fd() {
+    if (dir_fd_ == -1) {
+        dir_fd_ = open(path_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd_ < 0) {
+            die(format("Cannot open dir '%s': %m", path_.c_str()));
+        }
+    }
+    return dir_fd_;
+}
+
 void CgroupController::close_enter_fd() {
     if (close(enter_fd_) != 0) {
-        die(format("Cannot close cgroups tasks file: %m"));
+        die(format("Cannot close cgroup.procs file: %m"));
     }
     enter_fd_ = -1;
 }
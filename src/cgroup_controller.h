@@ -21,12 +21,16 @@ public:
     void _die();
     void write(const std::string &filename, const std::string &data);
     std::string read(const std::string &filename);
+    fs::path get_path(const std::string &filename) const;
+    bool exists(const std::string &filename);
     void delay_enter();
     fd_t get_enter_fd();
     void enter();
+    fd_t get_dir_fd();
 private:
     fs::path path_;
     fd_t enter_fd_ = -1;
+    fd_t dir_fd_ = -1;
     void close_enter_fd();
 };
 
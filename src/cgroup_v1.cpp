@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "cgroup_v1.h"
+#include "config.h"
+#include "context_manager.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+CgroupV1::CgroupV1(const std::string &id)
+    : cpuacct_controller_("cpuacct", id),
+      memory_controller_("memory", id),
+      cpuacct_usage_(cpuacct_controller_.get_path("cpuacct.usage")),
+      cpuacct_usage_sys_(cpuacct_controller_.get_path("cpuacct.usage_sys")),
+      cpuacct_usage_user_(cpuacct_controller_.get_path("cpuacct.usage_user")),
+      memory_max_usage_(memory_controller_.get_path("memory.max_usage_in_bytes")),
+      memory_usage_(memory_controller_.get_path("memory.usage_in_bytes")),
+      memory_oom_control_(memory_controller_.get_path("memory.oom_control")),
+      memory_failcnt_(memory_controller_.get_path("memory.failcnt")),
+      memory_tasks_(memory_controller_.get_path("tasks")) {
+    memory_controller_.write("memory.swappiness", "0");
+    if (Config::get().get_cpuset_policy() != CpusetPolicy::NONE) {
+        cpuset_controller_ = std::make_unique<CgroupController>("cpuset", id);
+    }
+}
+
+CgroupV1::~CgroupV1() {
+    if (oom_event_fd_ != -1 && close(oom_event_fd_) != 0) {
+        die(format("Cannot close OOM eventfd: %m"));
+    }
+    if (oom_control_fd_ != -1 && close(oom_control_fd_) != 0) {
+        die(format("Cannot close memory.oom_control: %m"));
+    }
+}
+
+void CgroupV1::init() {
+    CgroupController::init("memory");
+    CgroupController::init("cpuacct");
+    if (Config::get().get_cpuset_policy() != CpusetPolicy::NONE) {
+        CgroupController::init("cpuset");
+        // In cgroup v1 new cpuset is empty and no process can enter it until both cpus and mems are set
+        fs::path root = Config::get().get_cgroup_root() / "cpuset";
+        write_file(root / "libsbox" / "cpuset.cpus", read_file(root / "cpuset.cpus"));
+        write_file(root / "libsbox" / "cpuset.mems", read_file(root / "cpuset.mems"));
+    }
+}
+
+void CgroupV1::_die() {
+    cpuacct_controller_._die();
+    memory_controller_._die();
+    if (cpuset_controller_ != nullptr) cpuset_controller_->_die();
+}
+
+bool CgroupV1::reset() {
+    // Writing zero to cpuacct.usage resets also usage_sys and usage_user
+    cpuacct_controller_.write("cpuacct.usage", "0");
+    memory_controller_.write("memory.max_usage_in_bytes", "0");
+    memory_controller_.write("memory.failcnt", "0");
+    static const char *const oom_keys[] = {"oom_kill"};
+    memory_oom_control_.read_keys(oom_keys, &oom_kill_baseline_, 1);
+    memory_controller_.write("memory.limit_in_bytes", "-1");
+    if (oom_event_fd_ != -1) {
+        check_oom();
+    }
+    oom_ = false;
+    return true;
+}
+
+void CgroupV1::set_memory_limit(memory_kb_t memory_limit_kb) {
+    if (memory_limit_kb != -1) {
+        memory_controller_.write("memory.limit_in_bytes", std::to_string(memory_limit_kb) + "K");
+    }
+}
+
+void CgroupV1::set_cpuset(const std::string &cpus, const std::string &mems) {
+    if (cpuset_controller_ == nullptr) {
+        die("Cpuset controller is not enabled");
+    }
+    cpuset_controller_->write("cpuset.cpus", cpus);
+    if (mems.empty()) {
+        fs::path parent = Config::get().get_cgroup_root() / "cpuset" / "libsbox";
+        cpuset_controller_->write("cpuset.mems", read_file(parent / "cpuset.mems"));
+    } else {
+        cpuset_controller_->write("cpuset.mems", mems);
+    }
+}
+
+void CgroupV1::delay_enter() {
+    memory_controller_.delay_enter();
+    cpuacct_controller_.delay_enter();
+    if (cpuset_controller_ != nullptr) cpuset_controller_->delay_enter();
+}
+
+bool CgroupV1::is_enter_fd(fd_t fd) {
+    return fd == memory_controller_.get_enter_fd() || fd == cpuacct_controller_.get_enter_fd() ||
+           (cpuset_controller_ != nullptr && fd == cpuset_controller_->get_enter_fd());
+}
+
+void CgroupV1::enter() {
+    memory_controller_.enter();
+    cpuacct_controller_.enter();
+    if (cpuset_controller_ != nullptr) cpuset_controller_->enter();
+}
+
+fd_t CgroupV1::get_dir_fd() {
+    // CLONE_INTO_CGROUP works only with cgroup v2
+    return -1;
+}
+
+namespace {
+const long WAIT_EMPTY_POLL_NS = 1000000;
+} // namespace
+
+bool CgroupV1::kill_all() {
+    return false;
+}
+
+void CgroupV1::wait_empty() {
+    // cgroup v1 doesn't notify about last process leaving, so list of tasks is polled
+    while (memory_tasks_.count_lines() != 0) {
+        struct timespec delay = {0, WAIT_EMPTY_POLL_NS};
+        nanosleep(&delay, nullptr);
+    }
+}
+
+int64_t CgroupV1::get_time_usage_ns() {
+    return cpuacct_usage_.read_value();
+}
+
+fd_t CgroupV1::get_memory_event_fd() {
+    if (oom_event_fd_ == -1) {
+        oom_event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (oom_event_fd_ < 0) {
+            die(format("Cannot create eventfd: %m"));
+        }
+        fs::path oom_control_path = memory_controller_.get_path("memory.oom_control");
+        oom_control_fd_ = open(oom_control_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (oom_control_fd_ < 0) {
+            die(format("Cannot open '%s': %m", oom_control_path.c_str()));
+        }
+        memory_controller_.write("cgroup.event_control", format("%d %d", oom_event_fd_, oom_control_fd_));
+    }
+    return oom_event_fd_;
+}
+
+bool CgroupV1::check_oom() {
+    uint64_t count;
+    if (read(oom_event_fd_, &count, sizeof(count)) < 0) {
+        if (errno != EAGAIN) {
+            die(format("Cannot read from OOM eventfd: %m"));
+        }
+        count = 0;
+    }
+    oom_ = (oom_ || count != 0);
+    return oom_;
+}
+
+CgroupUsage CgroupV1::get_usage() {
+    static const char *const oom_keys[] = {"oom_kill"};
+    int64_t oom_kill;
+    memory_oom_control_.read_keys(oom_keys, &oom_kill, 1);
+
+    CgroupUsage usage = {};
+    usage.time_usage_ns = cpuacct_usage_.read_value();
+    usage.time_usage_sys_ns = cpuacct_usage_sys_.read_value();
+    usage.time_usage_user_ns = cpuacct_usage_user_.read_value();
+    usage.memory_usage_kb = static_cast<memory_kb_t>(
+        std::max(memory_max_usage_.read_value(), memory_usage_.read_value()) / 1024);
+    usage.oom_killed = (oom_kill != oom_kill_baseline_);
+    usage.memory_limit_hit = (memory_failcnt_.read_value() != 0);
+    return usage;
+}
+
+memory_kb_t CgroupV1::get_memory_current_kb() {
+    return static_cast<memory_kb_t>(memory_usage_.read_value() / 1024);
+}
+
+int64_t CgroupV1::get_pid_count() {
+    return memory_tasks_.count_lines();
+}
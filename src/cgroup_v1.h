@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_CGROUP_V1_H
+#define LIBSBOX_CGROUP_V1_H
+
+#include "cgroup.h"
+#include "cgroup_controller.h"
+#include "stat_file.h"
+
+// Cgroup backed by cgroup v1 "cpuacct" and "memory" controllers, and "cpuset" one when boxes are pinned to CPUs
+class CgroupV1 final : public Cgroup {
+public:
+    explicit CgroupV1(const std::string &id);
+    ~CgroupV1() override;
+
+    static void init();
+
+    void _die() override;
+    bool reset() override;
+    void set_memory_limit(memory_kb_t memory_limit_kb) override;
+    void set_cpuset(const std::string &cpus, const std::string &mems) override;
+    void delay_enter() override;
+    bool is_enter_fd(fd_t fd) override;
+    void enter() override;
+    fd_t get_dir_fd() override;
+    bool kill_all() override;
+    void wait_empty() override;
+
+    int64_t get_time_usage_ns() override;
+    fd_t get_memory_event_fd() override;
+    bool check_oom() override;
+    CgroupUsage get_usage() override;
+    memory_kb_t get_memory_current_kb() override;
+    int64_t get_pid_count() override;
+private:
+    CgroupController cpuacct_controller_;
+    CgroupController memory_controller_;
+    // Present only if cpuset policy is configured
+    std::unique_ptr<CgroupController> cpuset_controller_;
+    StatFile cpuacct_usage_;
+    StatFile cpuacct_usage_sys_;
+    StatFile cpuacct_usage_user_;
+    StatFile memory_max_usage_;
+    StatFile memory_usage_;
+    StatFile memory_oom_control_;
+    StatFile memory_failcnt_;
+    StatFile memory_tasks_;
+    // oom_kill counter can't be reset, value at last reset is subtracted instead
+    int64_t oom_kill_baseline_ = 0;
+    // eventfd registered in cgroup.event_control for OOM notifications of memory.oom_control
+    fd_t oom_event_fd_ = -1;
+    fd_t oom_control_fd_ = -1;
+    bool oom_ = false;
+};
+
+#endif //LIBSBOX_CGROUP_V1_H
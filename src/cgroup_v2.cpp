@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "cgroup_v2.h"
+#include "config.h"
+#include "context_manager.h"
+#include "utils.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool CgroupV2::peak_resettable_ = false;
+
+CgroupV2::CgroupV2(const std::string &id)
+    : controller_("", id),
+      cpu_stat_(controller_.get_path("cpu.stat")),
+      memory_peak_(controller_.get_path("memory.peak"), peak_resettable_),
+      memory_events_(controller_.get_path("memory.events")),
+      memory_current_(controller_.get_path("memory.current")),
+      cgroup_threads_(controller_.get_path("cgroup.threads")) {
+    if (controller_.exists("memory.swap.max")) {
+        controller_.write("memory.swap.max", "0");
+    }
+}
+
+CgroupV2::~CgroupV2() {
+    if (memory_events_watch_fd_ != -1 && close(memory_events_watch_fd_) != 0) {
+        die(format("Cannot close inotify: %m"));
+    }
+}
+
+void CgroupV2::init() {
+    CgroupController::init("");
+    // Controllers must be enabled on every level down to box cgroups. Processes are never placed into libsbox cgroup
+    // itself, so it is allowed to distribute controllers to children
+    std::string controllers = "+memory";
+    if (Config::get().get_cpuset_policy() != CpusetPolicy::NONE) {
+        controllers += " +cpuset";
+    }
+    write_file(Config::get().get_cgroup_root() / "cgroup.subtree_control", controllers);
+    write_file(Config::get().get_cgroup_root() / "libsbox" / "cgroup.subtree_control", controllers);
+
+    // memory.peak is present since linux 5.19 and writable since linux 6.12. Without reset box cgroup is created anew
+    // for every run
+    fs::path peak_path = Config::get().get_cgroup_root() / "libsbox" / "memory.peak";
+    struct stat peak_stat = {};
+    if (stat(peak_path.c_str(), &peak_stat) != 0) {
+        die(format("Cannot stat '%s', cgroup v2 backend requires linux 5.19 or higher: %m", peak_path.c_str()));
+    }
+    peak_resettable_ = (peak_stat.st_mode & S_IWUSR) != 0;
+}
+
+void CgroupV2::_die() {
+    controller_._die();
+}
+
+namespace {
+const char *const CPU_KEYS[] = {"usage_usec", "system_usec", "user_usec"};
+// "oom" counts allocations failed at limit, "oom_kill" counts processes killed by OOM killer
+const char *const MEMORY_EVENTS_KEYS[] = {"oom_kill", "max", "oom"};
+} // namespace
+
+bool CgroupV2::reset() {
+    // Writing to memory.peak resets peak seen through the same descriptor
+    if (!peak_resettable_ || !memory_peak_.write("0")) {
+        return false;
+    }
+    cpu_stat_.read_keys(CPU_KEYS, cpu_baseline_, 3);
+    if (memory_events_watch_fd_ != -1) {
+        check_oom();
+    }
+    memory_events_.read_keys(MEMORY_EVENTS_KEYS, memory_events_baseline_, 3);
+    controller_.write("memory.max", "max");
+    return true;
+}
+
+void CgroupV2::set_memory_limit(memory_kb_t memory_limit_kb) {
+    if (memory_limit_kb != -1) {
+        controller_.write("memory.max", std::to_string(memory_limit_kb * 1024));
+    }
+}
+
+void CgroupV2::set_cpuset(const std::string &cpus, const std::string &mems) {
+    controller_.write("cpuset.cpus", cpus);
+    if (!mems.empty()) {
+        controller_.write("cpuset.mems", mems);
+    }
+}
+
+void CgroupV2::delay_enter() {
+    controller_.delay_enter();
+}
+
+bool CgroupV2::is_enter_fd(fd_t fd) {
+    return fd == controller_.get_enter_fd();
+}
+
+void CgroupV2::enter() {
+    controller_.enter();
+}
+
+fd_t CgroupV2::get_dir_fd() {
+    return controller_.get_dir_fd();
+}
+
+bool CgroupV2::kill_all() {
+    if (!controller_.exists("cgroup.kill")) {
+        return false;
+    }
+    controller_.write("cgroup.kill", "1");
+    wait_empty();
+    return true;
+}
+
+void CgroupV2::wait_empty() {
+    // Processes leave cgroup when they exit, before they are reaped. Change of "populated" is reported by poll() to
+    // descriptor, which has read the old value
+    fs::path path = controller_.get_path("cgroup.events");
+    fd_t fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        die(format("Cannot open '%s': %m", path.c_str()));
+    }
+    while (true) {
+        char buffer[256];
+        ssize_t size = pread(fd, buffer, sizeof(buffer) - 1, 0);
+        if (size < 0) {
+            die(format("Cannot read '%s': %m", path.c_str()));
+        }
+        buffer[size] = '\0';
+        const char *populated = strstr(buffer, "populated ");
+        if (populated == nullptr) {
+            die(format("Can't find populated field in %s", path.c_str()));
+        }
+        if (populated[strlen("populated ")] == '0') {
+            break;
+        }
+        struct pollfd poll_fd = {fd, POLLPRI, 0};
+        if (poll(&poll_fd, 1, -1) < 0 && errno != EINTR) {
+            die(format("Cannot poll '%s': %m", path.c_str()));
+        }
+    }
+    if (close(fd) != 0) {
+        die(format("Cannot close '%s': %m", path.c_str()));
+    }
+}
+
+int64_t CgroupV2::get_time_usage_ns() {
+    int64_t usage_usec;
+    cpu_stat_.read_keys(CPU_KEYS, &usage_usec, 1);
+    return (usage_usec - cpu_baseline_[0]) * 1000;
+}
+
+fd_t CgroupV2::get_memory_event_fd() {
+    if (memory_events_watch_fd_ == -1) {
+        memory_events_watch_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (memory_events_watch_fd_ < 0) {
+            die(format("Cannot create inotify: %m"));
+        }
+        fs::path path = controller_.get_path("memory.events");
+        if (inotify_add_watch(memory_events_watch_fd_, path.c_str(), IN_MODIFY) < 0) {
+            die(format("Cannot watch '%s': %m", path.c_str()));
+        }
+    }
+    return memory_events_watch_fd_;
+}
+
+bool CgroupV2::check_oom() {
+    // Notifications carry no data, only the fact that some counter changed
+    alignas(struct inotify_event) char buffer[4096];
+    while (read(memory_events_watch_fd_, buffer, sizeof(buffer)) > 0) {}
+    if (errno != EAGAIN) {
+        die(format("Cannot read from inotify: %m"));
+    }
+
+    int64_t values[3];
+    memory_events_.read_keys(MEMORY_EVENTS_KEYS, values, 3);
+    return values[0] != memory_events_baseline_[0] || values[2] != memory_events_baseline_[2];
+}
+
+CgroupUsage CgroupV2::get_usage() {
+    int64_t cpu_values[3];
+    cpu_stat_.read_keys(CPU_KEYS, cpu_values, 3);
+    int64_t memory_values[3];
+    memory_events_.read_keys(MEMORY_EVENTS_KEYS, memory_values, 3);
+
+    CgroupUsage usage = {};
+    usage.time_usage_ns = (cpu_values[0] - cpu_baseline_[0]) * 1000;
+    usage.time_usage_sys_ns = (cpu_values[1] - cpu_baseline_[1]) * 1000;
+    usage.time_usage_user_ns = (cpu_values[2] - cpu_baseline_[2]) * 1000;
+    usage.memory_usage_kb = static_cast<memory_kb_t>(memory_peak_.read_value() / 1024);
+    usage.oom_killed = (memory_values[0] != memory_events_baseline_[0]);
+    usage.memory_limit_hit = (memory_values[1] != memory_events_baseline_[1]);
+    return usage;
+}
+
+memory_kb_t CgroupV2::get_memory_current_kb() {
+    return static_cast<memory_kb_t>(memory_current_.read_value() / 1024);
+}
+
+int64_t CgroupV2::get_pid_count() {
+    // pids controller may be not enabled, so threads are counted directly
+    return cgroup_threads_.count_lines();
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_CGROUP_V2_H
+#define LIBSBOX_CGROUP_V2_H
+
+#include "cgroup.h"
+#include "cgroup_controller.h"
+#include "stat_file.h"
+
+// Cgroup backed by single directory in cgroup v2 unified hierarchy
+class CgroupV2 final : public Cgroup {
+public:
+    explicit CgroupV2(const std::string &id);
+    ~CgroupV2() override;
+
+    static void init();
+
+    void _die() override;
+    bool reset() override;
+    void set_memory_limit(memory_kb_t memory_limit_kb) override;
+    void set_cpuset(const std::string &cpus, const std::string &mems) override;
+    void delay_enter() override;
+    bool is_enter_fd(fd_t fd) override;
+    void enter() override;
+    fd_t get_dir_fd() override;
+    bool kill_all() override;
+    void wait_empty() override;
+
+    int64_t get_time_usage_ns() override;
+    fd_t get_memory_event_fd() override;
+    bool check_oom() override;
+    CgroupUsage get_usage() override;
+    memory_kb_t get_memory_current_kb() override;
+    int64_t get_pid_count() override;
+private:
+    // Whether memory.peak can be reset, so that box cgroup is reused between runs
+    static bool peak_resettable_;
+
+    CgroupController controller_;
+    StatFile cpu_stat_;
+    StatFile memory_peak_;
+    StatFile memory_events_;
+    StatFile memory_current_;
+    StatFile cgroup_threads_;
+    // cpu.stat and memory.events counters can't be reset, values at last reset are subtracted instead
+    int64_t cpu_baseline_[3] = {0, 0, 0};
+    int64_t memory_events_baseline_[3] = {0, 0, 0};
+    // inotify watching modifications of memory.events
+    fd_t memory_events_watch_fd_ = -1;
+};
+
+#endif //LIBSBOX_CGROUP_V2_H
@@ -9,6 +9,7 @@
 #include <rapidjson/istreamwrapper.h>
 #include <rapidjson/document.h>
 #include <rapidjson/error/en.h>
+#include <algorithm>
 #include <fstream>
 
 bool Config::loaded_ = false;
@@ -27,6 +28,7 @@ const Config &Config::get() {
 #define CHECK_TYPE(obj, type) do { if (!obj.Is##type()) ERR(); } while (0)
 #define GET(to, obj, type) do { CHECK_TYPE(obj, type); to = obj.Get##type(); } while (0)
 #define GET_MEMBER(to, obj, key, type) do { CHECK_MEMBER(obj, key); GET(to, obj[key], type); } while (0)
+#define GET_OPTIONAL_MEMBER(to, obj, key, type) do { if (obj.HasMember(key)) GET(to, obj[key], type); } while (0)
 
 void Config::load() {
     std::ifstream in(path_);
@@ -49,9 +51,47 @@ void Config::load() {
     GET_MEMBER(num_boxes_, document, "num_boxes", Uint);
     GET_MEMBER(socket_path_, document, "socket_path", String);
     GET_MEMBER(first_uid_, document, "first_uid", Uint);
+    GET_OPTIONAL_MEMBER(uid_count_, document, "uid_count", Uint);
+    if (uid_count_ == 0 || first_uid_ + uid_count_ < first_uid_) {
+        die(format("Incorrect uid range: %u ids starting from %u", uid_count_, first_uid_));
+    }
     GET_MEMBER(box_dir_, document, "box_dir", String);
+    GET_OPTIONAL_MEMBER(root_image_, document, "root_image", String);
+    if (!root_image_.empty() && !root_image_.is_absolute()) {
+        die(format("Root image %s is not absolute path", root_image_.c_str()));
+    }
     GET_MEMBER(cgroup_root_, document, "cgroup_root", String);
-    GET_MEMBER(timer_interval_ms_, document, "timer_interval_ms", Int64);
+    GET_OPTIONAL_MEMBER(cgroup_version_, document, "cgroup_version", Uint);
+    if (cgroup_version_ == 0) {
+        // Unified hierarchy has cgroup.controllers file in its root
+        std::error_code error;
+        cgroup_version_ = (fs::exists(cgroup_root_ / "cgroup.controllers", error) ? 2 : 1);
+    }
+    if (cgroup_version_ != 1 && cgroup_version_ != 2) {
+        die(format("Unsupported cgroup version %u", cgroup_version_));
+    }
+    GET_OPTIONAL_MEMBER(pool_prewarm_, document, "pool_prewarm", Uint);
+    GET_OPTIONAL_MEMBER(pool_max_idle_, document, "pool_max_idle", Uint);
+    // Every idle container holds uid
+    if (static_cast<uint64_t>(num_boxes_) * std::max(pool_prewarm_, pool_max_idle_) > uid_count_) {
+        die(format("uid_count %u is too small for %u boxes with %u idle containers each", uid_count_, num_boxes_,
+                   std::max(pool_prewarm_, pool_max_idle_)));
+    }
+    GET_OPTIONAL_MEMBER(queue_depth_, document, "queue_depth", Uint);
+    GET_OPTIONAL_MEMBER(listen_backlog_, document, "listen_backlog", Uint);
+    GET_OPTIONAL_MEMBER(barrier_timeout_ms_, document, "barrier_timeout_ms", Int64);
+    std::string cpuset_policy = "none";
+    GET_OPTIONAL_MEMBER(cpuset_policy, document, "cpuset", String);
+    if (cpuset_policy == "none") {
+        cpuset_policy_ = CpusetPolicy::NONE;
+    } else if (cpuset_policy == "cpu") {
+        cpuset_policy_ = CpusetPolicy::CPU;
+    } else if (cpuset_policy == "core") {
+        cpuset_policy_ = CpusetPolicy::CORE;
+    } else {
+        die(format("Unknown cpuset policy '%s'", cpuset_policy.c_str()));
+    }
+    GET_OPTIONAL_MEMBER(housekeeping_cpus_, document, "housekeeping_cpus", String);
 }
 
 #undef ERR
@@ -59,6 +99,7 @@ void Config::load() {
 #undef CHECK_TYPE
 #undef GET
 #undef GET_MEMBER
+#undef GET_OPTIONAL_MEMBER
 
 uint32_t Config::get_num_boxes() const {
     return num_boxes_;
@@ -72,16 +113,52 @@ uid_t Config::get_first_uid() const {
     return first_uid_;
 }
 
+uid_t Config::get_uid_count() const {
+    return uid_count_;
+}
+
 const fs::path &Config::get_box_dir() const {
     return box_dir_;
 }
 
+const fs::path &Config::get_root_image() const {
+    return root_image_;
+}
+
 const fs::path &Config::get_cgroup_root() const {
     return cgroup_root_;
 }
 
-uint32_t Config::get_timer_interval_ms() const {
-    return timer_interval_ms_;
+uint32_t Config::get_cgroup_version() const {
+    return cgroup_version_;
+}
+
+uint32_t Config::get_pool_prewarm() const {
+    return pool_prewarm_;
+}
+
+uint32_t Config::get_pool_max_idle() const {
+    return pool_max_idle_;
+}
+
+uint32_t Config::get_queue_depth() const {
+    return queue_depth_;
+}
+
+uint32_t Config::get_listen_backlog() const {
+    return listen_backlog_;
+}
+
+int64_t Config::get_barrier_timeout_ms() const {
+    return barrier_timeout_ms_;
+}
+
+CpusetPolicy Config::get_cpuset_policy() const {
+    return cpuset_policy_;
+}
+
+const std::string &Config::get_housekeeping_cpus() const {
+    return housekeeping_cpus_;
 }
 
 void Config::set_path(const fs::path &path) {
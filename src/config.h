@@ -6,9 +6,20 @@
 #define LIBSBOX_CONFIG_H
 
 #include <filesystem>
+#include <string>
 
 namespace fs = std::filesystem;
 
+// How boxes are placed on CPUs, see cpuset.h
+enum class CpusetPolicy {
+    // Boxes float across all CPUs
+    NONE,
+    // Every box gets dedicated logical CPU
+    CPU,
+    // Every box gets dedicated physical core with all its SMT siblings
+    CORE
+};
+
 class Config {
 public:
     static const Config &get();
@@ -17,9 +28,22 @@ public:
     uint32_t get_num_boxes() const;
     const fs::path &get_socket_path() const;
     uid_t get_first_uid() const;
+    // Number of user ids starting from first_uid, which may be given to containers
+    uid_t get_uid_count() const;
     const fs::path &get_box_dir() const;
+    // Read-only lower layer of box roots, empty if roots are built from tmpfs and standard binds
+    const fs::path &get_root_image() const;
     const fs::path &get_cgroup_root() const;
-    uint32_t get_timer_interval_ms() const;
+    uint32_t get_cgroup_version() const;
+    uint32_t get_pool_prewarm() const;
+    uint32_t get_pool_max_idle() const;
+    uint32_t get_queue_depth() const;
+    uint32_t get_listen_backlog() const;
+    // How long processes wait for each other to start run, -1 means forever
+    int64_t get_barrier_timeout_ms() const;
+    CpusetPolicy get_cpuset_policy() const;
+    // CPUs of daemon and workers, boxes never run on them
+    const std::string &get_housekeeping_cpus() const;
 private:
     static Config config_;
 
@@ -30,9 +54,18 @@ private:
     uint32_t num_boxes_;
     fs::path socket_path_;
     uid_t first_uid_;
+    uid_t uid_count_ = 256;
     fs::path box_dir_;
+    fs::path root_image_;
     fs::path cgroup_root_;
-    uint32_t timer_interval_ms_;
+    uint32_t cgroup_version_ = 0;
+    uint32_t pool_prewarm_ = 1;
+    uint32_t pool_max_idle_ = 8;
+    uint32_t queue_depth_ = 1024;
+    uint32_t listen_backlog_ = 128;
+    int64_t barrier_timeout_ms_ = 10000;
+    CpusetPolicy cpuset_policy_ = CpusetPolicy::NONE;
+    std::string housekeeping_cpus_ = "0";
 };
 
 #endif //LIBSBOX_CONFIG_H
@@ -9,28 +9,45 @@
 #include "utils.h"
 #include "signals.h"
 #include "logger.h"
+#include "event_monitor.h"
+#include "stats.h"
+#include "protocol.h"
+#include "binary_codec.h"
 
 #include <unistd.h>
 #include <signal.h>
 #include <sys/prctl.h>
 #include <sys/mount.h>
 #include <sys/wait.h>
-#include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
 #include <grp.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/msg.h>
+#include <sys/sem.h>
+#include <sched.h>
+#include <tuple>
+#include <algorithm>
 
 Container *Container::container_ = nullptr;
 
-Container::Container(uid_t id, bool permanent) : id_(id), permanent_(permanent) {}
+bool ContainerProfile::operator<(const ContainerProfile &other) const {
+    return std::tie(need_ipc, use_standard_binds) < std::tie(other.need_ipc, other.use_standard_binds);
+}
+
+Container::Container(uid_t id, const ContainerProfile &profile) : id_(id), profile_(profile) {}
 
 void Container::_die(const std::string &error) {
     if (slave_pid_ == 0) {
         task_data_->error = true;
     } else {
-        if (cpuacct_controller_ != nullptr) cpuacct_controller_->_die();
-        if (memory_controller_ != nullptr) memory_controller_->_die();
+        if (cgroup_ != nullptr) cgroup_->_die();
     }
     log(error);
 
@@ -49,24 +66,34 @@ pid_t Container::get_pid() {
     return pid_;
 }
 
+const ContainerProfile &Container::get_profile() const {
+    return profile_;
+}
+
 SharedBarrier *Container::get_barrier() {
     return &barrier_;
 }
 
-void Container::set_task(libsbox::Task *task) {
+void Container::set_task(libsbox::Task *task, uint64_t job_id, uint32_t task_index, uint32_t run_start_participant) {
+    task_data_->job_id = job_id;
+    task_data_->task_index = task_index;
+    task_data_->run_start_participant = run_start_participant;
     task_data_->time_limit_ms = task->get_time_limit_ms();
     task_data_->wall_time_limit_ms = task->get_wall_time_limit_ms();
     task_data_->memory_limit_kb = task->get_memory_limit_kb();
     task_data_->fsize_limit_kb = task->get_fsize_limit_kb();
     task_data_->max_files = task->get_max_files();
     task_data_->max_threads = task->get_max_threads();
-    task_data_->need_ipc = task->get_need_ipc();
-    task_data_->use_standard_binds = task->get_use_standard_binds();
+    task_data_->collect_counters = task->get_collect_counters();
+    task_data_->instruction_limit = task->get_instruction_limit();
+    task_data_->telemetry_interval_ms = task->get_telemetry_interval_ms();
 
     task_data_->stdin_desc.fd = -1;
     task_data_->stdin_desc.filename = "";
     std::string stdin_filename = task->get_stdin().get_filename();
-    if (stdin_filename.empty()) {
+    if (task->get_stdin().is_inline()) {
+        task_data_->stdin_desc.fd = Worker::get().create_input_buffer(task->get_stdin().get_data());
+    } else if (stdin_filename.empty()) {
         task_data_->stdin_desc.filename = "/dev/null";
     } else {
         if (stdin_filename[0] == '@') {
@@ -85,8 +112,11 @@ void Container::set_task(libsbox::Task *task) {
 
     task_data_->stdout_desc.fd = -1;
     task_data_->stdout_desc.filename = "";
+    task_data_->stdout_desc.captured = false;
     std::string stdout_filename = task->get_stdout().get_filename();
-    if (stdout_filename.empty()) {
+    if (task->get_stdout().get_capture_limit() != -1) {
+        set_capture(task_data_->stdout_desc, task->get_stdout().get_capture_limit());
+    } else if (stdout_filename.empty()) {
         task_data_->stdout_desc.filename = "/dev/null";
     } else {
         if (stdout_filename[0] == '@') {
@@ -105,8 +135,11 @@ void Container::set_task(libsbox::Task *task) {
 
     task_data_->stderr_desc.fd = -1;
     task_data_->stderr_desc.filename = "";
+    task_data_->stderr_desc.captured = false;
     std::string stderr_filename = task->get_stderr().get_filename();
-    if (stderr_filename.empty()) {
+    if (task->get_stderr().get_capture_limit() != -1) {
+        set_capture(task_data_->stderr_desc, task->get_stderr().get_capture_limit());
+    } else if (stderr_filename.empty()) {
         task_data_->stderr_desc.filename = "/dev/null";
     } else {
         if (stderr_filename[0] == '@') {
@@ -186,10 +219,31 @@ void Container::set_task(libsbox::Task *task) {
     task_data_->term_signal = -1;
     task_data_->oom_killed = false;
     task_data_->memory_limit_hit = false;
+    task_data_->oom_time_ms = -1;
+    task_data_->oom_memory_usage_kb = -1;
+    task_data_->instruction_limit_exceeded = false;
+    task_data_->instructions = -1;
+    task_data_->cycles = -1;
+    task_data_->cache_misses = -1;
+    task_data_->context_switches = -1;
+
+    for (auto &ns : task_data_->stage_ns) {
+        ns = -1;
+    }
 
     task_data_->error = true;
 }
 
+void Container::set_capture(IOStream &desc, int64_t limit) {
+    auto pipe = Worker::get().create_capture_pipe();
+    desc.fd = pipe.second;
+    desc.capture_fd = pipe.first;
+    desc.capture_buffer_fd = Worker::get().create_capture_buffer();
+    desc.capture_limit = limit;
+    desc.captured_bytes = 0;
+    desc.captured = true;
+}
+
 void Container::put_results(libsbox::Task *task) {
     task->set_time_usage_ms(task_data_->time_usage_ms);
     task->set_time_usage_sys_ms(task_data_->time_usage_sys_ms);
@@ -204,6 +258,76 @@ void Container::put_results(libsbox::Task *task) {
     task->set_term_signal(task_data_->term_signal);
     task->set_oom_killed(task_data_->oom_killed);
     task->set_memory_limit_hit(task_data_->memory_limit_hit);
+    task->set_oom_time_ms(task_data_->oom_time_ms);
+    task->set_oom_memory_usage_kb(task_data_->oom_memory_usage_kb);
+    task->set_instruction_limit_exceeded(task_data_->instruction_limit_exceeded);
+    task->set_instructions(task_data_->instructions);
+    task->set_cycles(task_data_->cycles);
+    task->set_cache_misses(task_data_->cache_misses);
+    task->set_context_switches(task_data_->context_switches);
+    if (task_data_->stdout_desc.captured) {
+        read_capture(task_data_->stdout_desc, task->get_stdout());
+    }
+    if (task_data_->stderr_desc.captured) {
+        read_capture(task_data_->stderr_desc, task->get_stderr());
+    }
+    if (task->get_collect_timings()) {
+        for (uint32_t i = 0; i < STAGE_REPORTED_COUNT; ++i) {
+            if (task_data_->stage_ns[i] >= 0) {
+                task->set_timing_ns(STAGE_NAMES[i], task_data_->stage_ns[i]);
+            }
+        }
+    }
+}
+
+void Container::read_capture(const IOStream &desc, libsbox::Stream &stream) {
+    std::string data(static_cast<size_t>(std::min(desc.captured_bytes, desc.capture_limit)), '\0');
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t cnt = pread(desc.capture_buffer_fd, &data[done], data.size() - done, static_cast<off_t>(done));
+        if (cnt < 0) {
+            die(format("Cannot read from memfd: %m"));
+        }
+        if (cnt == 0) break;
+        done += static_cast<size_t>(cnt);
+    }
+    data.resize(done);
+    stream.set_data(data);
+    stream.set_truncated(desc.captured_bytes > desc.capture_limit);
+}
+
+namespace {
+char capture_chunk[65536];
+}
+
+void Container::drain_capture(IOStream &desc, bool until_empty) {
+    do {
+        ssize_t cnt = read(desc.capture_fd, capture_chunk, sizeof(capture_chunk));
+        if ((cnt < 0 && errno == EAGAIN) || cnt == 0) {
+            return;
+        }
+        if (cnt < 0) {
+            die(format("Cannot read captured output: %m"));
+        }
+        // Output beyond limit is dropped, but still counted
+        int64_t kept = std::clamp(desc.capture_limit - desc.captured_bytes, static_cast<int64_t>(0),
+                                  static_cast<int64_t>(cnt));
+        ssize_t written = 0;
+        while (written < kept) {
+            ssize_t res = pwrite(desc.capture_buffer_fd, capture_chunk + written, static_cast<size_t>(kept - written),
+                                 static_cast<off_t>(desc.captured_bytes + written));
+            if (res < 0) {
+                die(format("Cannot write captured output to memfd: %m"));
+            }
+            written += res;
+        }
+        desc.captured_bytes += cnt;
+    } while (until_empty);
+}
+
+void Container::stop() {
+    task_data_->stop = true;
+    barrier_.wait(0);
 }
 
 int Container::clone_callback(void *ptr) {
@@ -238,55 +362,91 @@ void Container::serve() {
 
     while (true) {
         // Wait for task
-        barrier_.wait();
+        barrier_.wait(1);
+        if (task_data_->stop) break;
 
         std::vector<Bind> binds;
 
+        int64_t start_ns = get_monotonic_ns();
         for (size_t i = 0; i < task_data_->binds.size(); ++i) {
             binds.emplace_back(&task_data_->binds[i]);
             binds[i].mount(root_, work_dir_);
         }
+        record_stage(STAGE_BIND_MOUNTS, start_ns);
 
-        cpuacct_controller_ = new CgroupController("cpuacct", std::to_string(id_));
-        memory_controller_ = new CgroupController("memory", std::to_string(id_));
-        memory_controller_->write("memory.swappiness", "0");
-        if (task_data_->memory_limit_kb != -1) {
-            memory_controller_->write("memory.limit_in_bytes", std::to_string(task_data_->memory_limit_kb) + "K");
-        }
+        start_ns = get_monotonic_ns();
+        cgroup_->set_memory_limit(task_data_->memory_limit_kb);
+        record_stage(STAGE_CGROUP_CREATE, start_ns);
 
-        slave_pid_ = fork();
-        if (slave_pid_ < 0) {
-            die(format("fork() failed: %m"));
-        }
+        start_ns = get_monotonic_ns();
+        spawn_slave();
         if (slave_pid_ == 0) {
             slave();
         }
+        // Slave waits for run start before exec(), so counters see the whole program
+        if (task_data_->collect_counters || task_data_->instruction_limit != -1) {
+            counters_.open(slave_pid_);
+        }
+        record_stage(STAGE_SPAWN, start_ns);
 
-        // Run started
-        Worker::get().get_run_start_barrier()->wait();
-
-        wait_for_slave();
+        // Run started, unless worker has given up waiting for other boxes
+        if (wait_run_start(task_data_->run_start_participant)) {
+            start_ns = get_monotonic_ns();
+            wait_for_slave();
+            record_stage(STAGE_WAIT, start_ns);
+        } else {
+            abort_slave();
+        }
 
+        start_ns = get_monotonic_ns();
         for (auto &bind : binds) {
             bind.umount_if_mounted();
         }
-
-        delete cpuacct_controller_;
-        cpuacct_controller_ = nullptr;
-        delete memory_controller_;
-        memory_controller_ = nullptr;
+        record_stage(STAGE_UMOUNT, start_ns);
 
         // Results ready
-        barrier_.wait();
-
-        if (!permanent_) break;
+        barrier_.wait(1);
 
+        start_ns = get_monotonic_ns();
         cleanup_root();
+        if (profile_.need_ipc) {
+            cleanup_ipcs();
+        }
+        record_stage(STAGE_CLEANUP_ROOT, start_ns);
+
+        // Files of box are charged to its cgroup until they are freed, so cgroup is reset only after cleanup
+        start_ns = get_monotonic_ns();
+        reset_cgroup();
+        record_stage(STAGE_CGROUP_DESTROY, start_ns);
     }
 
+    Bind::close_templates();
+    delete cgroup_;
+    cgroup_ = nullptr;
     _exit(0);
 }
 
+void Container::create_cgroup() {
+    cgroup_ = Cgroup::create(std::to_string(id_));
+    const cpuset::BoxSet &box_set = Worker::get().get_box_set();
+    if (!box_set.cpus.empty()) {
+        cgroup_->set_cpuset(box_set.cpus, box_set.node == -1 ? "" : std::to_string(box_set.node));
+    }
+}
+
+namespace {
+// Kernel objects left by exited processes are tolerated, anything larger is memory of the previous run
+const memory_kb_t MAX_STALE_MEMORY_KB = 1024;
+} // namespace
+
+void Container::reset_cgroup() {
+    // Memory still charged after cleanup (e.g. tmpfs files in trash, which is removed in background) would count
+    // towards usage and limit of the next run. Removed cgroup passes its charges to parent
+    if (cgroup_->get_memory_current_kb() <= MAX_STALE_MEMORY_KB && cgroup_->reset()) return;
+    delete cgroup_;
+    create_cgroup();
+}
+
 void Container::prepare() {
     root_ = Config::get().get_box_dir();
 
@@ -295,13 +455,20 @@ void Container::prepare() {
     }
 
     reset_signals();
-    enable_timer_interrupts();
     set_sigchld_action(sigchld_action_wrapper);
 
     prepare_root();
-    if (permanent_) {
+    if (!profile_.need_ipc) {
         disable_ipcs();
     }
+    create_cgroup();
+
+    const cpuset::BoxSet &box_set = Worker::get().get_box_set();
+    if (box_set.cpus.empty()) {
+        cpu_count_ = sysconf(_SC_NPROCESSORS_ONLN);
+    } else {
+        cpu_count_ = static_cast<int64_t>(cpuset::parse_list(box_set.cpus).size());
+    }
 }
 
 void Container::prepare_root() {
@@ -315,13 +482,60 @@ void Container::prepare_root() {
         die(format("Cannot create root directory (%s): %s", root_.c_str(), error.message().c_str()));
     }
 
-    if (mount("none", root_.c_str(), "tmpfs", 0, "mode=755,size=1g") != 0) {
+    // Root image already contains everything standard binds give, so it is used only for containers with them
+    overlay_root_ = (profile_.use_standard_binds && !Config::get().get_root_image().empty());
+    if (overlay_root_) {
+        layers_dir_ = root_.string() + ".layers";
+        fs::create_directories(layers_dir_, error);
+        if (error) {
+            die(format("Cannot create layers directory (%s): %s", layers_dir_.c_str(), error.message().c_str()));
+        }
+    }
+
+    mount_root();
+    if (profile_.use_standard_binds && !overlay_root_) {
+        Bind::apply_standard_rules(root_, work_dir_);
+    }
+}
+
+void Container::mount_root() {
+    // Files of box are allocated on the node its slave runs on
+    std::string options = "mode=755,size=1g";
+    if (Worker::get().get_box_set().node != -1) {
+        options += format(",mpol=bind:%d", Worker::get().get_box_set().node);
+    }
+    // With root image tmpfs holds only upper layer of overlay, which collects everything written in box
+    const fs::path &tmpfs_dir = (overlay_root_ ? layers_dir_ : root_);
+    if (mount("none", tmpfs_dir.c_str(), "tmpfs", 0, options.c_str()) != 0) {
         die(format("Cannot mount root tmpfs: %m"));
     }
-    if (mount("none", root_.c_str(), "tmpfs", MS_REMOUNT, "mode=755,size=1g") != 0) {
+    if (mount("none", tmpfs_dir.c_str(), "tmpfs", MS_REMOUNT, options.c_str()) != 0) {
         die(format("Cannot remount root tmpfs: %m"));
     }
 
+    std::error_code error;
+    if (overlay_root_) {
+        fs::path upper_dir = layers_dir_ / "upper";
+        fs::path overlay_work_dir = layers_dir_ / "work";
+        fs::create_directory(upper_dir, error);
+        if (error) {
+            die(format("Cannot create upper dir: %s", error.message().c_str()));
+        }
+        fs::create_directory(overlay_work_dir, error);
+        if (error) {
+            die(format("Cannot create overlay work dir: %s", error.message().c_str()));
+        }
+        if (chmod(upper_dir.c_str(), 0755) != 0) {
+            die(format("Cannot chmod() upper dir: %m"));
+        }
+        std::string overlay_options = format("lowerdir=%s,upperdir=%s,workdir=%s",
+                                             Config::get().get_root_image().c_str(), upper_dir.c_str(),
+                                             overlay_work_dir.c_str());
+        if (mount("overlay", root_.c_str(), "overlay", MS_NOSUID, overlay_options.c_str()) != 0) {
+            die(format("Cannot mount overlay root: %m"));
+        }
+    }
+
     fs::path proc_dir = root_ / "proc";
     fs::create_directories(proc_dir, error);
     if (error) {
@@ -334,45 +548,105 @@ void Container::prepare_root() {
         die(format("Cannot remount proc filesystem: %m"));
     }
 
+    if (!overlay_root_) {
+        trash_dir_ = root_ / ".trash";
+        fs::create_directory(trash_dir_, error);
+        if (error) {
+            die(format("Cannot create trash dir: %s", error.message().c_str()));
+        }
+        if (chmod(trash_dir_.c_str(), 0700) != 0) {
+            die(format("Cannot chmod() trash dir: %m"));
+        }
+    }
+
+    create_box_dirs();
+}
+
+void Container::create_box_dirs() {
+    std::error_code error;
     work_dir_ = root_ / "work";
     fs::create_directories(work_dir_, error);
     if (error) {
         die(format("Cannot create '/work' dir: %s", error.message().c_str()));
     }
 
-    fs::create_directories(root_ / "tmp");
+    fs::create_directories(root_ / "tmp", error);
     if (error) {
         die(format("Cannot create '/tmp' dir: %s", error.message().c_str()));
     }
     if (chmod((root_ / "tmp").c_str(), 0777) != 0) {
         die(format("Cannot chmod() '/tmp': %m"));
     }
-
-    if (task_data_->use_standard_binds) {
-        Bind::apply_standard_rules(root_, work_dir_);
-    }
 }
 
 void Container::cleanup_root() {
-    std::error_code error;
-    for (const auto &path : fs::directory_iterator(work_dir_)) {
-        fs::remove_all(path, error);
-        if (error) {
-            die(format("Cannot remove %s: %s", path.path().c_str(), error.message().c_str()));
+    if (overlay_root_) {
+        // Dropping upper layer discards all changes at once, proc is detached together with overlay
+        if (umount2(root_.c_str(), MNT_DETACH) != 0) {
+            die(format("Cannot umount overlay root: %m"));
+        }
+        if (umount2(layers_dir_.c_str(), MNT_DETACH) != 0) {
+            die(format("Cannot umount upper layer: %m"));
         }
+        mount_root();
+        return;
     }
 
-    for (const auto &path : fs::directory_iterator(root_ / "tmp")) {
-        fs::remove_all(path, error);
-        if (error) {
-            die(format("Cannot remove %s: %s", path.path().c_str(), error.message().c_str()));
+    // Old /work and /tmp are moved to trash and removed in background, so box is ready right away
+    fs::path trash_entry = trash_dir_ / std::to_string(next_trash_id_++);
+    if (mkdir(trash_entry.c_str(), 0700) != 0) {
+        die(format("Cannot create %s: %m", trash_entry.c_str()));
+    }
+    if (rename(work_dir_.c_str(), (trash_entry / "work").c_str()) != 0) {
+        die(format("Cannot move '/work' to trash: %m"));
+    }
+    if (rename((root_ / "tmp").c_str(), (trash_entry / "tmp").c_str()) != 0) {
+        die(format("Cannot move '/tmp' to trash: %m"));
+    }
+    create_box_dirs();
+    start_reaper();
+}
+
+void Container::start_reaper() {
+    if (reaper_pid_ != -1) {
+        pid_t pid = waitpid(reaper_pid_, nullptr, WNOHANG);
+        if (pid < 0) {
+            die(format("Cannot wait for reaper: %m"));
         }
+        // Running reaper removes new entries too
+        if (pid == 0) return;
+        reaper_pid_ = -1;
     }
 
-    for (const auto &path : fs::directory_iterator(work_dir_)) {
-        fs::remove_all(path, error);
+    reaper_pid_ = fork();
+    if (reaper_pid_ < 0) {
+        die(format("Cannot fork reaper: %m"));
+    }
+    if (reaper_pid_ == 0) {
+        reap_trash();
+    }
+}
+
+void Container::reap_trash() {
+    // Reaper only uses CPU time nobody else needs, so it never slows slave down
+    struct sched_param param = {};
+    if (prctl(PR_SET_PDEATHSIG, SIGKILL) != 0 || sched_setscheduler(0, SCHED_IDLE, &param) != 0) {
+        _exit(1);
+    }
+
+    // Reaper is not a container, so it never dies through context manager
+    while (true) {
+        std::error_code error;
+        bool empty = true;
+        for (fs::directory_iterator it(trash_dir_, error), end; !error && it != end; it.increment(error)) {
+            empty = false;
+            fs::remove_all(it->path(), error);
+        }
         if (error) {
-            die(format("Cannot remove %s: %s", path.path().c_str(), error.message().c_str()));
+            _exit(1);
+        }
+        if (empty) {
+            _exit(0);
         }
     }
 }
@@ -383,32 +657,132 @@ void Container::disable_ipcs() {
     write_file("/proc/sys/kernel/sem", "0 0 0 0");
 }
 
+namespace {
+union semun {
+    int val;
+    struct semid_ds *buf;
+    unsigned short *array;
+    struct seminfo *__buf;
+};
+} // namespace
+
+// Remove System V IPC objects left by previous run, so they can't be seen by the next one
+void Container::cleanup_ipcs() {
+    struct shm_info shm_info = {};
+    int max_index = shmctl(0, SHM_INFO, reinterpret_cast<struct shmid_ds *>(&shm_info));
+    if (max_index < 0) {
+        die(format("Cannot get shared memory segments info: %m"));
+    }
+    for (int i = 0; i <= max_index; ++i) {
+        struct shmid_ds shmid_ds = {};
+        int id = shmctl(i, SHM_STAT, &shmid_ds);
+        if (id >= 0 && shmctl(id, IPC_RMID, nullptr) != 0) {
+            die(format("Cannot remove shared memory segment %d: %m", id));
+        }
+    }
+
+    struct msginfo msginfo = {};
+    max_index = msgctl(0, MSG_INFO, reinterpret_cast<struct msqid_ds *>(&msginfo));
+    if (max_index < 0) {
+        die(format("Cannot get message queues info: %m"));
+    }
+    for (int i = 0; i <= max_index; ++i) {
+        struct msqid_ds msqid_ds = {};
+        int id = msgctl(i, MSG_STAT, &msqid_ds);
+        if (id >= 0 && msgctl(id, IPC_RMID, nullptr) != 0) {
+            die(format("Cannot remove message queue %d: %m", id));
+        }
+    }
+
+    struct seminfo seminfo = {};
+    union semun arg = {};
+    arg.__buf = &seminfo;
+    max_index = semctl(0, 0, SEM_INFO, arg);
+    if (max_index < 0) {
+        die(format("Cannot get semaphore sets info: %m"));
+    }
+    for (int i = 0; i <= max_index; ++i) {
+        struct semid_ds semid_ds = {};
+        arg.buf = &semid_ds;
+        int id = semctl(i, 0, SEM_STAT, arg);
+        if (id >= 0 && semctl(id, 0, IPC_RMID) != 0) {
+            die(format("Cannot remove semaphore set %d: %m", id));
+        }
+    }
+}
+
+namespace {
+enum MonitorEvent : uint64_t {
+    SLAVE_EVENT = 1,
+    MEMORY_EVENT = 2,
+    STDOUT_CAPTURE_EVENT = 3,
+    STDERR_CAPTURE_EVENT = 4
+};
+
+// Timer is never armed for less than this, so monitor doesn't spin when limit is almost reached
+const int64_t MIN_CHECK_INTERVAL_NS = 100000;
+// Instruction limit is checked at least this often, so sudden speedup of program is noticed in time
+const int64_t MAX_INSTRUCTION_CHECK_INTERVAL_NS = 10000000;
+const int64_t NS_IN_MS = 1000000;
+} // namespace
+
 void Container::wait_for_slave() {
-    start_timer(Config::get().get_timer_interval_ms());
     reset_wall_clock();
 
-    while (true) {
-        int status;
-        pid_t pid = waitpid(slave_pid_, &status, 0);
-        if (pid != slave_pid_) {
-            if (!timer_interrupt) {
-                die(format("waitpid() failed: %m"));
-            }
-
-            timer_interrupt = false;
+    EventMonitor monitor;
+    monitor.add(slave_fd_, EPOLLIN, SLAVE_EVENT);
+    fd_t memory_event_fd = cgroup_->get_memory_event_fd();
+    if (memory_event_fd != -1) {
+        monitor.add(memory_event_fd, EPOLLIN, MEMORY_EVENT);
+    }
+    // Pipes of captured output are small, so program would block until they are drained
+    if (task_data_->stdout_desc.captured) {
+        monitor.add(task_data_->stdout_desc.capture_fd, EPOLLIN, STDOUT_CAPTURE_EVENT);
+    }
+    if (task_data_->stderr_desc.captured) {
+        monitor.add(task_data_->stderr_desc.capture_fd, EPOLLIN, STDERR_CAPTURE_EVENT);
+    }
 
-            if (task_data_->time_limit_ms != -1 && get_time_usage_ms() > task_data_->time_limit_ms) {
-                kill_all();
-                break;
-            }
+    last_check_ns_ = 0;
+    last_instructions_ = 0;
+    next_sample_ns_ = task_data_->telemetry_interval_ms * NS_IN_MS;
+    while (true) {
+        if (is_time_limit_exceeded() || is_wall_time_limit_exceeded() || is_instruction_limit_exceeded()) {
+            kill_all();
+            break;
+        }
+        if (task_data_->telemetry_interval_ms != -1 && get_wall_clock_ns() >= next_sample_ns_) {
+            send_sample();
+        }
 
-            if (task_data_->wall_time_limit_ms != -1 && get_wall_clock_ms() > task_data_->wall_time_limit_ms) {
-                kill_all();
-                break;
+        monitor.set_timer(get_next_check_ns());
+        uint64_t event = monitor.wait();
+        if (event == EventMonitor::TIMER_EVENT) {
+            continue;
+        }
+        if (event == STDOUT_CAPTURE_EVENT || event == STDERR_CAPTURE_EVENT) {
+            drain_capture(event == STDOUT_CAPTURE_EVENT ? task_data_->stdout_desc : task_data_->stderr_desc, false);
+            continue;
+        }
+        if (event == MEMORY_EVENT) {
+            if (!cgroup_->check_oom()) {
+                continue;
             }
+            // Program can't get memory it needs, so box is killed right away instead of thrashing against limit
+            task_data_->oom_time_ms = get_wall_clock_ms();
+            task_data_->oom_memory_usage_kb = cgroup_->get_usage().memory_usage_kb;
+            kill_all();
+            break;
+        }
 
+        int status;
+        pid_t pid = waitpid(slave_pid_, &status, WNOHANG);
+        if (pid == 0) {
             continue;
         }
+        if (pid != slave_pid_) {
+            die(format("waitpid() failed: %m"));
+        }
 
         kill_all();
 
@@ -424,15 +798,38 @@ void Container::wait_for_slave() {
         break;
     }
 
-    stop_timer();
+    // Box is killed, so nobody writes to pipes of captured output anymore
+    if (task_data_->stdout_desc.captured) {
+        drain_capture(task_data_->stdout_desc, true);
+    }
+    if (task_data_->stderr_desc.captured) {
+        drain_capture(task_data_->stderr_desc, true);
+    }
 
-    task_data_->time_usage_ms = get_time_usage_ms();
-    task_data_->time_usage_sys_ms = get_time_usage_sys_ms();
-    task_data_->time_usage_user_ms = get_time_usage_user_ms();
+    if (close(slave_fd_) != 0) {
+        die(format("Cannot close pidfd: %m"));
+    }
+    slave_fd_ = -1;
+
+    CgroupUsage usage = cgroup_->get_usage();
+    task_data_->time_usage_ms = usage.time_usage_ns / NS_IN_MS;
+    task_data_->time_usage_sys_ms = usage.time_usage_sys_ns / NS_IN_MS;
+    task_data_->time_usage_user_ms = usage.time_usage_user_ns / NS_IN_MS;
     task_data_->wall_time_usage_ms = get_wall_clock_ms();
-    task_data_->memory_usage_kb = get_memory_usage_kb();
-    task_data_->oom_killed = is_oom_killed();
-    task_data_->memory_limit_hit = is_memory_limit_hit();
+    task_data_->memory_usage_kb = usage.memory_usage_kb;
+    task_data_->oom_killed = (usage.oom_killed || task_data_->oom_time_ms != -1);
+    task_data_->memory_limit_hit = usage.memory_limit_hit;
+    int64_t instructions = counters_.read(PerfCounters::INSTRUCTIONS);
+    if (task_data_->instruction_limit != -1 && instructions != -1) {
+        task_data_->instruction_limit_exceeded = (instructions > task_data_->instruction_limit);
+    }
+    if (task_data_->collect_counters) {
+        task_data_->instructions = instructions;
+        task_data_->cycles = counters_.read(PerfCounters::CYCLES);
+        task_data_->cache_misses = counters_.read(PerfCounters::CACHE_MISSES);
+        task_data_->context_switches = counters_.read(PerfCounters::CONTEXT_SWITCHES);
+    }
+    counters_.close();
     if (task_data_->time_limit_ms != -1) {
         task_data_->time_limit_exceeded = (task_data_->time_usage_ms > task_data_->time_limit_ms);
     }
@@ -445,73 +842,261 @@ void Container::wait_for_slave() {
     }
 }
 
+bool Container::is_time_limit_exceeded() {
+    return task_data_->time_limit_ms != -1 && get_time_usage_ms() > task_data_->time_limit_ms;
+}
+
+bool Container::is_wall_time_limit_exceeded() {
+    return task_data_->wall_time_limit_ms != -1 && get_wall_clock_ms() > task_data_->wall_time_limit_ms;
+}
+
+bool Container::is_instruction_limit_exceeded() {
+    if (task_data_->instruction_limit == -1) {
+        return false;
+    }
+    int64_t instructions = counters_.read(PerfCounters::INSTRUCTIONS);
+    return instructions != -1 && instructions > task_data_->instruction_limit;
+}
+
+// Instruction counter can't notify us when limit is reached, so it is polled. Next check is planned from speed
+// measured since previous check, which is precise for steady programs and cheap for idle ones
+int64_t Container::get_next_instruction_check_ns() {
+    int64_t instructions = counters_.read(PerfCounters::INSTRUCTIONS);
+    if (task_data_->instruction_limit == -1 || instructions == -1) {
+        return 0;
+    }
+    int64_t now_ns = get_wall_clock_ns();
+    int64_t next_check_ns = MAX_INSTRUCTION_CHECK_INTERVAL_NS;
+    if (instructions > last_instructions_ && now_ns > last_check_ns_) {
+        double ns_per_instruction = static_cast<double>(now_ns - last_check_ns_) /
+                                    static_cast<double>(instructions - last_instructions_);
+        double remaining_ns = static_cast<double>(task_data_->instruction_limit - instructions) * ns_per_instruction;
+        next_check_ns = std::min(next_check_ns, static_cast<int64_t>(remaining_ns));
+    }
+    last_check_ns_ = now_ns;
+    last_instructions_ = instructions;
+    return next_check_ns;
+}
+
+// Returns time after which some limit may become exceeded, or 0 if there are no limits to watch. Box can't consume
+// more CPU time than wall time multiplied by number of its threads, so we don't need to check CPU time limit earlier
+int64_t Container::get_next_check_ns() {
+    int64_t next_check_ns = 0;
+    if (task_data_->wall_time_limit_ms != -1) {
+        next_check_ns = (task_data_->wall_time_limit_ms + 1) * NS_IN_MS - get_wall_clock_ns();
+    }
+    if (task_data_->time_limit_ms != -1) {
+        // CPU time can't grow faster than wall clock times number of CPUs program runs on
+        int64_t parallelism = cpu_count_;
+        if (task_data_->max_threads != -1) {
+            parallelism = std::min(parallelism, static_cast<int64_t>(task_data_->max_threads));
+        }
+        parallelism = std::max(parallelism, static_cast<int64_t>(1));
+        int64_t cpu_check_ns = ((task_data_->time_limit_ms + 1) * NS_IN_MS - get_time_usage_ns()) / parallelism;
+        next_check_ns = (next_check_ns == 0 ? cpu_check_ns : std::min(next_check_ns, cpu_check_ns));
+    }
+    int64_t instruction_check_ns = get_next_instruction_check_ns();
+    if (instruction_check_ns != 0) {
+        next_check_ns = (next_check_ns == 0 ? instruction_check_ns : std::min(next_check_ns, instruction_check_ns));
+    }
+    int64_t sample_ns = get_next_sample_ns();
+    if (sample_ns != 0) {
+        next_check_ns = (next_check_ns == 0 ? sample_ns : std::min(next_check_ns, sample_ns));
+    }
+    if (task_data_->wall_time_limit_ms == -1 && task_data_->time_limit_ms == -1 && instruction_check_ns == 0 &&
+        sample_ns == 0) {
+        return 0;
+    }
+    return std::max(next_check_ns, MIN_CHECK_INTERVAL_NS);
+}
+
+int64_t Container::get_next_sample_ns() {
+    if (task_data_->telemetry_interval_ms == -1) {
+        return 0;
+    }
+    return std::max(next_sample_ns_ - get_wall_clock_ns(), MIN_CHECK_INTERVAL_NS);
+}
+
+// Samples are taken on the same timer as limit checks. Monitor must never wait for daemon, so sample is dropped if
+// channel is full
+void Container::send_sample() {
+    libsbox::TelemetrySample sample;
+    int64_t now_ns = get_wall_clock_ns();
+    sample.wall_time_ms = now_ns / NS_IN_MS;
+    sample.time_usage_ms = get_time_usage_ms();
+    sample.memory_usage_kb = cgroup_->get_memory_current_kb();
+    sample.pids = cgroup_->get_pid_count();
+    sample.stdout_bytes = get_stdout_bytes();
+    // Missed samples are skipped rather than sent in burst
+    int64_t interval_ns = std::max(task_data_->telemetry_interval_ms * NS_IN_MS, MIN_CHECK_INTERVAL_NS);
+    next_sample_ns_ += ((now_ns - next_sample_ns_) / interval_ns + 1) * interval_ns;
+
+    BinaryWriter writer;
+    writer.write_uint32(task_data_->task_index);
+    sample.serialize(writer);
+    std::string frame;
+    protocol::append_frame(frame, task_data_->job_id, protocol::FRAME_TELEMETRY, writer.get());
+    if (send(Worker::get().get_channel_fd(), frame.data(), frame.size(), MSG_DONTWAIT | MSG_NOSIGNAL) < 0 &&
+        errno != EAGAIN) {
+        die(format("Cannot send telemetry sample: %m"));
+    }
+}
+
+int64_t Container::get_stdout_bytes() {
+    // Captured output is counted as it is drained
+    if (task_data_->stdout_desc.captured) {
+        return task_data_->stdout_desc.captured_bytes;
+    }
+    // Filename is empty if stdout is pipe
+    if (task_data_->stdout_desc.filename.empty()) {
+        return -1;
+    }
+    // Slave opens stdout in work directory after chroot() into root
+    fs::path path = task_data_->stdout_desc.filename.c_str();
+    path = (path.is_absolute() ? root_ / path.relative_path() : work_dir_ / path);
+    struct stat stat_buf = {};
+    if (stat(path.c_str(), &stat_buf) != 0 || !S_ISREG(stat_buf.st_mode)) {
+        return -1;
+    }
+    return static_cast<int64_t>(stat_buf.st_size);
+}
+
+namespace {
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+#ifndef SYS_clone3
+#define SYS_clone3 435
+#endif
+
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+
+// struct clone_args from linux/sched.h, which conflicts with glibc's sched.h
+struct CloneArgs {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+    uint64_t set_tid;
+    uint64_t set_tid_size;
+    uint64_t cgroup;
+};
+
+int pidfd_send_signal(fd_t pidfd, int sig) {
+    return static_cast<int>(syscall(SYS_pidfd_send_signal, pidfd, sig, nullptr, 0));
+}
+} // namespace
+
+// Spawn slave using clone3(). On cgroup v2 slave is born inside its cgroup, so there is no need to write its pid to
+// cgroup.procs and all its CPU time is accounted. Falls back to fork() on kernels without clone3() or
+// CLONE_INTO_CGROUP
+void Container::spawn_slave() {
+    fd_t cgroup_fd = cgroup_->get_dir_fd();
+
+    CloneArgs args = {};
+    args.flags = CLONE_PIDFD;
+    if (cgroup_fd != -1) {
+        args.flags |= CLONE_INTO_CGROUP;
+        args.cgroup = static_cast<uint64_t>(cgroup_fd);
+    }
+    args.pidfd = reinterpret_cast<uint64_t>(&slave_fd_);
+    args.exit_signal = SIGCHLD;
+
+    slave_in_cgroup_ = (cgroup_fd != -1);
+    // glibc doesn't update its thread data in child of raw clone3(), see slave()
+    slave_pid_ = static_cast<pid_t>(syscall(SYS_clone3, &args, sizeof(args)));
+    if (slave_pid_ < 0 && (errno == ENOSYS || errno == E2BIG || errno == EINVAL)) {
+        slave_in_cgroup_ = false;
+        slave_pid_ = fork();
+        if (slave_pid_ > 0) {
+            slave_fd_ = open_pidfd(slave_pid_);
+        }
+    }
+    if (slave_pid_ < 0) {
+        die(format("Cannot spawn slave: %m"));
+    }
+}
+
+void Container::abort_slave() {
+    // Slave exits by itself when run is aborted, but it may not have reached run start yet
+    task_data_->error = false;
+    kill_all();
+    int status;
+    if (waitpid(slave_pid_, &status, 0) < 0 && errno != ECHILD) {
+        die(format("waitpid() failed: %m"));
+    }
+    if (close(slave_fd_) != 0) {
+        die(format("Cannot close pidfd: %m"));
+    }
+    slave_fd_ = -1;
+    counters_.close();
+}
+
 void Container::kill_all() {
-    stop_timer();
-    if (kill(-1, SIGKILL) != 0 && errno != ESRCH) {
+    // Trash reaper is not part of box. If cgroup has killed whole box, reaper keeps running and only zombies are
+    // reaped, zombies left are reaped next time. Otherwise reaper is killed too, so that waiting below ends
+    bool box_killed = false;
+    if (cgroup_->kill_all()) {
+        // Slave may not have entered cgroup yet
+        if (!slave_in_cgroup_ && pidfd_send_signal(slave_fd_, SIGKILL) != 0 && errno != ESRCH) {
+            die(format("Failed to kill slave: %m"));
+        }
+        box_killed = slave_in_cgroup_;
+        if (!box_killed && reaper_pid_ != -1 && kill(reaper_pid_, SIGKILL) != 0 && errno != ESRCH) {
+            die(format("Failed to kill reaper: %m"));
+        }
+    } else if (kill(-1, SIGKILL) != 0 && errno != ESRCH) {
         die(format("Failed to kill all processes in box: %m"));
     }
-    set_standard_handler_restart(SIGALRM, true);
     while (true) {
         int status;
-        pid_t pid = wait(&status);
+        pid_t pid = waitpid(-1, &status, box_killed ? WNOHANG : 0);
+        if (pid == 0) {
+            break;
+        }
         if (pid < 0) {
             if (errno == ECHILD) {
                 break;
             }
             die(format("kill_all() wait() failed: %m"));
         }
+        if (pid == reaper_pid_) {
+            reaper_pid_ = -1;
+        }
     }
-    set_standard_handler_restart(SIGALRM, false);
 }
 
 void Container::reset_wall_clock() {
-    gettimeofday(&run_start_, nullptr);
-}
-
-time_ms_t Container::get_wall_clock_ms() {
-    struct timeval now = {}, seg = {};
-    gettimeofday(&now, nullptr);
-    timersub(&now, &run_start_, &seg);
-    return seg.tv_sec * 1000 + seg.tv_usec / 1000;
-}
-
-time_ms_t Container::get_time_usage_ms() {
-    std::string data = cpuacct_controller_->read("cpuacct.usage");
-    return stoll(data) / 1000000;
-}
-
-time_ms_t Container::get_time_usage_sys_ms() {
-    std::string data = cpuacct_controller_->read("cpuacct.usage_sys");
-    return stoll(data) / 1000000;
+    clock_gettime(CLOCK_MONOTONIC, &run_start_);
 }
 
-time_ms_t Container::get_time_usage_user_ms() {
-    std::string data = cpuacct_controller_->read("cpuacct.usage_user");
-    return stoll(data) / 1000000;
+int64_t Container::get_wall_clock_ns() {
+    struct timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - run_start_.tv_sec) * 1000000000 + (now.tv_nsec - run_start_.tv_nsec);
 }
 
-memory_kb_t Container::get_memory_usage_kb() {
-    long long max_usage = stoll(memory_controller_->read("memory.max_usage_in_bytes"));
-    long long cur_usage = stoll(memory_controller_->read("memory.usage_in_bytes"));
-    return static_cast<memory_kb_t>(std::max(max_usage, cur_usage) / 1024);
+time_ms_t Container::get_wall_clock_ms() {
+    return get_wall_clock_ns() / NS_IN_MS;
 }
 
-bool Container::is_oom_killed() {
-    std::string data = memory_controller_->read("memory.oom_control");
-    std::stringstream sstream(memory_controller_->read("memory.oom_control"));
-    std::string name, val;
-    while (sstream >> name >> val) {
-        if (name == "oom_kill") {
-            return (val != "0");
-        }
-    }
-    die("Can't find oom_kill field in memory.oom_control");
-    _exit(-1); // we should not get here
+int64_t Container::get_time_usage_ns() {
+    return cgroup_->get_time_usage_ns();
 }
 
-bool Container::is_memory_limit_hit() {
-    std::string data = memory_controller_->read("memory.failcnt");
-    return stoll(data);
+time_ms_t Container::get_time_usage_ms() {
+    return get_time_usage_ns() / NS_IN_MS;
 }
 
 void Container::open_files() {
@@ -575,8 +1160,7 @@ void Container::close_all_fds() {
         if (*end) continue;
 
         if (fd == STDIN_FILENO || fd == STDOUT_FILENO || fd == STDERR_FILENO || fd == dir_fd
-            || fd == Logger::get().get_fd() || fd == memory_controller_->get_enter_fd()
-            || fd == cpuacct_controller_->get_enter_fd())
+            || fd == Logger::get().get_fd() || (!slave_in_cgroup_ && cgroup_->is_enter_fd(fd)))
             continue;
         if (close(fd) != 0) {
             die(format("Cannot close fd %d: %m", fd));
@@ -633,14 +1217,21 @@ void Container::setup_credentials() {
 #include <iostream>
 
 void Container::slave() {
+    // Slave may be spawned with raw clone3(), so glibc still has TID of container cached until exec. raise(), abort()
+    // and assert() send signal to that TID, so only plain syscalls may be used here: errors go through die(), which
+    // ends with _exit(), and signal to itself must be sent with kill(getpid(), ...)
     ContextManager::set(this, "slave");
     reset_sigchld();
 
-    Worker::get().get_run_start_barrier()->wait();
+    if (!wait_run_start(task_data_->run_start_participant + 1)) {
+        _exit(0);
+    }
+    int64_t start_ns = get_monotonic_ns();
     task_data_->error = false;
 
-    memory_controller_->delay_enter();
-    cpuacct_controller_->delay_enter();
+    if (!slave_in_cgroup_) {
+        cgroup_->delay_enter();
+    }
 
     if (chdir(work_dir_.c_str()) != 0) {
         die(format("chdir() failed: %m"));
@@ -656,8 +1247,14 @@ void Container::slave() {
     setup_rlimits();
     setup_credentials();
 
-    memory_controller_->enter();
-    cpuacct_controller_->enter();
+    if (!slave_in_cgroup_) {
+        cgroup_->enter();
+    }
+    // Before linux 6.3 clone3(CLONE_INTO_CGROUP) doesn't apply cpuset of cgroup to affinity of child, so slave would
+    // keep housekeeping cpus inherited from daemon
+    if (!Worker::get().get_box_set().cpus.empty()) {
+        cpuset::confine(Worker::get().get_box_set().cpus);
+    }
 
     bool has_path = false;
     for (size_t i = 0; i < task_data_->env.count(); ++i) {
@@ -673,11 +1270,22 @@ void Container::slave() {
         }
     }
 
+    record_stage(STAGE_EXEC, start_ns);
     execvpe(task_data_->argv[0], task_data_->argv.get(), task_data_->env.get());
     die(format("Failed to execute command '%s': %m", task_data_->argv[0]));
     _exit(-1); // we should not get here
 }
 
+bool Container::wait_run_start(uint32_t participant) {
+    return Worker::get().get_run_start_barrier()->wait(participant);
+}
+
+void Container::record_stage(Stage stage, int64_t start_ns) {
+    int64_t ns = get_monotonic_ns() - start_ns;
+    Stats::record(stage, ns);
+    task_data_->stage_ns[stage] = ns;
+}
+
 void Container::sigchld_action_wrapper(int, siginfo_t *siginfo, void *) {
     container_->sigchld_action(siginfo);
 }
@@ -9,7 +9,8 @@
 #include "shared_barrier.h"
 #include "shared_memory_object.h"
 #include "task_data.h"
-#include "cgroup_controller.h"
+#include "cgroup.h"
+#include "perf_counters.h"
 #include "libsbox_internal.h"
 
 #include <filesystem>
@@ -18,19 +19,31 @@
 
 namespace fs = std::filesystem;
 
+// Namespace and bind setup of container. Containers are reused only for tasks with the same profile
+struct ContainerProfile {
+    bool need_ipc = false;
+    bool use_standard_binds = true;
+
+    bool operator<(const ContainerProfile &other) const;
+};
+
 class Container final : public ContextManager {
 public:
-    Container(uid_t id, bool permanent);
+    Container(uid_t id, const ContainerProfile &profile);
     ~Container() = default;
 
     static Container &get();
 
     pid_t start();
-    void set_task(libsbox::Task *task);
+    // Task is task_index-th task of job. Participant is index of container in run start barrier of worker
+    void set_task(libsbox::Task *task, uint64_t job_id, uint32_t task_index, uint32_t run_start_participant);
     void put_results(libsbox::Task *task);
+    void stop();
 
     uid_t get_id();
     pid_t get_pid();
+    const ContainerProfile &get_profile() const;
+    // Barrier of worker (participant 0) and container (participant 1)
     SharedBarrier *get_barrier();
 
     [[noreturn]]
@@ -41,33 +54,83 @@ private:
 
     uid_t id_;
     pid_t pid_{};
-    bool permanent_;
+    ContainerProfile profile_;
     SharedMemoryObject<TaskData> task_data_{};
     SharedBarrier barrier_{2};
     fs::path root_;
     fs::path work_dir_;
+    // Root is overlay of root image and tmpfs mounted in layers_dir_
+    bool overlay_root_ = false;
+    fs::path layers_dir_;
+    // Old contents of plain root wait for reaper here
+    fs::path trash_dir_;
+    uint64_t next_trash_id_ = 0;
+    pid_t reaper_pid_ = -1;
 
-    CgroupController *cpuacct_controller_ = nullptr;
-    CgroupController *memory_controller_ = nullptr;
+    // Cgroup of box lives as long as container and is reset after every run
+    Cgroup *cgroup_ = nullptr;
     pid_t slave_pid_ = -1;
-    struct timeval run_start_ = {};
+    fd_t slave_fd_ = -1;
+    bool slave_in_cgroup_ = false;
+    // CPUs program can run on, i.e. ones of box or all online ones if box is not pinned
+    int64_t cpu_count_ = 1;
+    struct timespec run_start_ = {};
+    PerfCounters counters_;
+    // Wall clock and instruction count at previous check of instruction limit
+    int64_t last_check_ns_ = 0;
+    int64_t last_instructions_ = 0;
+    // Wall clock when next telemetry sample is due
+    int64_t next_sample_ns_ = 0;
 
     static int clone_callback(void *ptr);
     void serve();
+    void spawn_slave();
     void prepare();
     void prepare_root();
+    void create_cgroup();
+    // Prepare cgroup for next run, reusing it if previous run has left nothing in it
+    void reset_cgroup();
+    // Mount fresh root (or upper layer of overlay root) with /proc, /work and /tmp
+    void mount_root();
     void disable_ipcs();
+    void cleanup_ipcs();
     void cleanup_root();
+    void create_box_dirs();
+    // Start reaper process, which empties trash, unless it is still running
+    void start_reaper();
+    [[noreturn]]
+    void reap_trash();
     void wait_for_slave();
+    bool is_time_limit_exceeded();
+    bool is_wall_time_limit_exceeded();
+    bool is_instruction_limit_exceeded();
+    int64_t get_next_check_ns();
+    // Returns 0 if instruction limit is not watched
+    int64_t get_next_instruction_check_ns();
+    // Returns 0 if telemetry is not requested
+    int64_t get_next_sample_ns();
+    void send_sample();
+    // Size of stdout file or amount of captured stdout, -1 if stdout is neither
+    int64_t get_stdout_bytes();
     void kill_all();
+    // Kill slave of aborted run, which hasn't started program
+    void abort_slave();
     void reset_wall_clock();
+    int64_t get_wall_clock_ns();
     time_ms_t get_wall_clock_ms();
+    int64_t get_time_usage_ns();
     time_ms_t get_time_usage_ms();
-    time_ms_t get_time_usage_sys_ms();
-    time_ms_t get_time_usage_user_ms();
-    memory_kb_t get_memory_usage_kb();
-    bool is_oom_killed();
-    bool is_memory_limit_hit();
+    // Record stage which started at start_ns and ends now, in stats and in task data
+    void record_stage(Stage stage, int64_t start_ns);
+    // Wait for run start as given participant. Returns false if worker has aborted run, because some box didn't come
+    // in time
+    bool wait_run_start(uint32_t participant);
+    // Give program pipe for output, which is captured up to limit bytes
+    static void set_capture(IOStream &desc, int64_t limit);
+    // Move output from pipe into memfd, single read unless until_empty is set
+    static void drain_capture(IOStream &desc, bool until_empty);
+    // Copy output captured in memfd into stream, output beyond capture limit is dropped
+    static void read_capture(const IOStream &desc, libsbox::Stream &stream);
 
     [[noreturn]]
     void slave();
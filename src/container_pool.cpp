@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "container_pool.h"
+#include "cgroup.h"
+#include "context_manager.h"
+#include "stats.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <csignal>
+#include <sys/wait.h>
+
+ContainerPool::ContainerPool(SharedIdGetter *id_getter, uint32_t prewarm, uint32_t max_idle)
+    : id_getter_(id_getter), prewarm_(prewarm), max_idle_(std::max(prewarm, max_idle)) {
+    idle_[ContainerProfile()];
+}
+
+Container *ContainerPool::acquire(const ContainerProfile &profile) {
+    auto &idle = idle_[profile];
+    if (idle.empty()) {
+        Stats::record_pool(false);
+        return spawn(profile);
+    }
+
+    Stats::record_pool(true);
+    Container *container = idle.back();
+    idle.pop_back();
+    idle_count_--;
+    return container;
+}
+
+void ContainerPool::release(Container *container) {
+    idle_[container->get_profile()].push_back(container);
+    idle_count_++;
+}
+
+bool ContainerPool::refill_step() {
+    if (idle_count_ > max_idle_) {
+        // Profile with most idle containers gives one up
+        auto largest = std::max_element(idle_.begin(), idle_.end(), [](const auto &a, const auto &b) {
+            return a.second.size() < b.second.size();
+        });
+        retire(largest->second.back());
+        largest->second.pop_back();
+        idle_count_--;
+        return true;
+    }
+    if (idle_count_ == max_idle_) {
+        return false;
+    }
+
+    // Profile with fewest idle containers gets one, so all profiles are warmed evenly when they don't fit together
+    auto smallest = std::min_element(idle_.begin(), idle_.end(), [](const auto &a, const auto &b) {
+        return a.second.size() < b.second.size();
+    });
+    if (smallest->second.size() >= prewarm_) {
+        return false;
+    }
+    smallest->second.push_back(spawn(smallest->first));
+    idle_count_++;
+    return true;
+}
+
+Container *ContainerPool::spawn(const ContainerProfile &profile) {
+    auto *container = new Container(id_getter_->get(), profile);
+    containers_.emplace_back(container);
+    if (container->start() < 0) {
+        die(format("Cannot start() container: %m"));
+    }
+    return container;
+}
+
+void ContainerPool::retire(Container *container) {
+    container->stop();
+    int status;
+    if (waitpid(container->get_pid(), &status, 0) < 0) {
+        die(format("Cannot wait() for retired container: %m"));
+    }
+    // We don't need to check status here, it was checked in sigaction
+    id_getter_->put(container->get_id());
+
+    auto it = std::find_if(containers_.begin(), containers_.end(), [container](const auto &ptr) {
+        return ptr.get() == container;
+    });
+    containers_.erase(it);
+}
+
+void ContainerPool::discard(Container *container) {
+    if (kill(container->get_pid(), SIGKILL) != 0) {
+        die(format("Cannot kill container: %m"));
+    }
+    int status;
+    if (waitpid(container->get_pid(), &status, 0) < 0) {
+        die(format("Cannot wait() for killed container: %m"));
+    }
+    // Container had no chance to remove cgroup of box, so counters and limits of killed run would reach next box with
+    // the same uid. Descriptors it has opened in shared table are lost, but that happens only to stuck container.
+    // Processes of box die together with container, but leave cgroup only when they have exited
+    Cgroup *cgroup = Cgroup::create(std::to_string(container->get_id()));
+    cgroup->wait_empty();
+    delete cgroup;
+    id_getter_->put(container->get_id());
+
+    auto it = std::find_if(containers_.begin(), containers_.end(), [container](const auto &ptr) {
+        return ptr.get() == container;
+    });
+    containers_.erase(it);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_CONTAINER_POOL_H
+#define LIBSBOX_CONTAINER_POOL_H
+
+#include "container.h"
+#include "shared_id_getter.h"
+
+#include <map>
+#include <memory>
+#include <vector>
+
+// Per-worker pool of pre-initialized containers. Idle containers are grouped by profile, so tasks of any kind can be
+// started in already prepared container. Every container holds uid, so idle containers are limited per worker, not per
+// profile
+class ContainerPool {
+public:
+    // Pool keeps prewarm idle containers of every profile used so far (default profile counts as used from the start),
+    // but at most max_idle idle containers in total
+    ContainerPool(SharedIdGetter *id_getter, uint32_t prewarm, uint32_t max_idle);
+    ~ContainerPool() = default;
+
+    // Get idle container with given profile, new container is started on miss
+    Container *acquire(const ContainerProfile &profile);
+
+    // Return container, which finished its task, to pool
+    void release(Container *container);
+
+    // Stop one excess idle container or start one missing. Returns false if there is nothing to do. Started containers
+    // prepare themselves asynchronously, so worker calls it between jobs until next job arrives
+    bool refill_step();
+
+    // Kill container, which has stopped responding, instead of returning it to pool
+    void discard(Container *container);
+private:
+    SharedIdGetter *id_getter_;
+    uint32_t prewarm_;
+    uint32_t max_idle_;
+    size_t idle_count_ = 0;
+
+    std::vector<std::unique_ptr<Container>> containers_;
+    // Profiles are added on first use
+    std::map<ContainerProfile, std::vector<Container *>> idle_;
+
+    Container *spawn(const ContainerProfile &profile);
+    void retire(Container *container);
+};
+
+#endif //LIBSBOX_CONTAINER_POOL_H
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "cpuset.h"
+#include "context_manager.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cctype>
+#include <sched.h>
+#include <map>
+#include <set>
+#include <sstream>
+
+namespace cpuset {
+std::vector<int> parse_list(const std::string &list) {
+    std::vector<int> cpus;
+    std::stringstream sstream(list);
+    std::string range;
+    while (std::getline(sstream, range, ',')) {
+        // Files in sysfs end with newline
+        range.erase(std::remove_if(range.begin(), range.end(), ::isspace), range.end());
+        if (range.empty()) {
+            continue;
+        }
+        int first, last;
+        char dash;
+        std::stringstream range_stream(range);
+        if (!(range_stream >> first) || first < 0) {
+            die(format("Incorrect cpu list '%s'", list.c_str()));
+        }
+        last = first;
+        if (range_stream >> dash && (dash != '-' || !(range_stream >> last) || last < first)) {
+            die(format("Incorrect cpu list '%s'", list.c_str()));
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+std::string format_list(const std::vector<int> &cpus) {
+    std::string result;
+    for (int cpu : cpus) {
+        if (!result.empty()) {
+            result += ",";
+        }
+        result += std::to_string(cpu);
+    }
+    return result;
+}
+
+namespace {
+// Node of every online cpu, empty if kernel has no NUMA support
+std::map<int, int> get_cpu_nodes() {
+    std::map<int, int> nodes;
+    std::error_code error;
+    if (!fs::exists("/sys/devices/system/node/online", error)) {
+        return nodes;
+    }
+    for (int node : parse_list(read_file("/sys/devices/system/node/online"))) {
+        for (int cpu : parse_list(read_file(format("/sys/devices/system/node/node%d/cpulist", node)))) {
+            nodes[cpu] = node;
+        }
+    }
+    return nodes;
+}
+} // namespace
+
+std::vector<BoxSet> get_box_sets(CpusetPolicy policy, const std::string &housekeeping) {
+    std::vector<BoxSet> sets;
+    if (policy == CpusetPolicy::NONE) {
+        return sets;
+    }
+
+    std::vector<int> housekeeping_cpus = parse_list(housekeeping);
+    if (housekeeping_cpus.empty()) {
+        die("Housekeeping cpu set must not be empty");
+    }
+    std::set<int> reserved(housekeeping_cpus.begin(), housekeeping_cpus.end());
+    std::map<int, int> cpu_nodes = get_cpu_nodes();
+    // Sets of every node in order of their cpus
+    std::map<int, std::vector<BoxSet>> node_sets;
+    std::set<int> taken;
+    // Logical cpus with index of cpu among siblings of its core
+    std::vector<std::pair<size_t, int>> ranked_cpus;
+    for (int cpu : parse_list(read_file("/sys/devices/system/cpu/online"))) {
+        if (reserved.count(cpu) != 0 || taken.count(cpu) != 0) {
+            continue;
+        }
+        int node = (cpu_nodes.count(cpu) != 0 ? cpu_nodes[cpu] : -1);
+        // SMT siblings always belong to the same node
+        std::vector<int> siblings = parse_list(read_file(
+            format("/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu)
+        ));
+        if (policy == CpusetPolicy::CPU) {
+            auto rank = static_cast<size_t>(std::find(siblings.begin(), siblings.end(), cpu) - siblings.begin());
+            ranked_cpus.emplace_back(rank, cpu);
+            continue;
+        }
+
+        bool shared = false;
+        for (int sibling : siblings) {
+            shared |= (reserved.count(sibling) != 0);
+            taken.insert(sibling);
+        }
+        // Box must not share core with daemon
+        if (!shared) {
+            node_sets[node].push_back({format_list(siblings), node});
+        }
+    }
+    // First siblings of all cores go before second ones
+    std::stable_sort(ranked_cpus.begin(), ranked_cpus.end(), [](const auto &a, const auto &b) {
+        return a.first < b.first;
+    });
+    for (const auto &[rank, cpu] : ranked_cpus) {
+        int node = (cpu_nodes.count(cpu) != 0 ? cpu_nodes[cpu] : -1);
+        node_sets[node].push_back({std::to_string(cpu), node});
+    }
+
+    // Take sets from nodes in turn
+    for (size_t i = 0; ; ++i) {
+        bool added = false;
+        for (const auto &[node, node_set] : node_sets) {
+            if (i < node_set.size()) {
+                sets.push_back(node_set[i]);
+                added = true;
+            }
+        }
+        if (!added) {
+            break;
+        }
+    }
+    return sets;
+}
+
+void confine(const std::string &cpus) {
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (int cpu : parse_list(cpus)) {
+        if (cpu >= CPU_SETSIZE) {
+            die(format("CPU %d is out of supported range", cpu));
+        }
+        CPU_SET(static_cast<size_t>(cpu), &mask);
+    }
+    if (sched_setaffinity(0, sizeof(mask), &mask) != 0) {
+        die(format("Cannot set cpu affinity to %s: %m", cpus.c_str()));
+    }
+}
+} // namespace cpuset
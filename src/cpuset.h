@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_CPUSET_H
+#define LIBSBOX_CPUSET_H
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+// CPU and memory placement of boxes. Sets are written in kernel cpulist format (e.g. "2-3,8")
+namespace cpuset {
+struct BoxSet {
+    std::string cpus;
+    // NUMA node, which all cpus belong to, box memory is allocated on it. -1 if kernel has no NUMA support
+    int node = -1;
+};
+
+// Parse cpulist, dies if it is malformed
+std::vector<int> parse_list(const std::string &list);
+std::string format_list(const std::vector<int> &cpus);
+
+// Split online CPUs, which are not housekeeping ones, into disjoint sets for boxes according to policy: one logical
+// CPU per box (CPU) or one physical core with all its SMT siblings per box (CORE). With CPU policy sets on distinct
+// cores come first, so boxes share core only if there are more boxes than cores. With CORE policy cores having any
+// housekeeping CPU are not given to boxes. Sets alternate between NUMA nodes, so first boxes are balanced across
+// nodes. Returns empty vector for NONE. Set is given to worker, so all containers of its job (tasks connected with
+// pipes) share it
+std::vector<BoxSet> get_box_sets(CpusetPolicy policy, const std::string &housekeeping);
+
+// Confine calling process (and its future children) to given set
+void confine(const std::string &cpus);
+} // namespace cpuset
+
+#endif //LIBSBOX_CPUSET_H
@@ -3,10 +3,14 @@
  */
 
 #include "daemon.h"
+#include "dispatcher.h"
 #include "config.h"
 #include "utils.h"
 #include "signals.h"
 #include "logger.h"
+#include "cgroup.h"
+#include "cpuset.h"
+#include "stats.h"
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -48,35 +52,45 @@ void Daemon::run() {
 
     // Spawn workers
     num_boxes_ = Config::get().get_num_boxes();
+    std::vector<cpuset::BoxSet> box_sets = cpuset::get_box_sets(
+        Config::get().get_cpuset_policy(),
+        Config::get().get_housekeeping_cpus()
+    );
+    if (Config::get().get_cpuset_policy() != CpusetPolicy::NONE) {
+        if (box_sets.size() < num_boxes_) {
+            die(format("Only %zu cpu sets are available for %u boxes", box_sets.size(), num_boxes_));
+        }
+        // Workers and containers inherit affinity, only slaves are moved to box cpus by their cgroups
+        cpuset::confine(Config::get().get_housekeeping_cpus());
+    }
     workers_.reserve(num_boxes_);
     for (uint32_t i = 0; i < num_boxes_; ++i) {
-        Worker *worker = new Worker(server_socket_fd_, id_getter_.get());
+        Worker *worker = new Worker(id_getter_.get(), box_sets.empty() ? cpuset::BoxSet() : box_sets[i]);
         if (worker->start() < 0) {
             die(format("Failed to spawn worker: %m"));
         }
         workers_.emplace_back(worker);
     }
 
+    // Workers are spawned before dispatcher, so they don't inherit its descriptors
+    Dispatcher dispatcher(server_socket_fd_, workers_);
+
     log("Started, waiting for connections");
 
-    while (true) {
-        // Wait for signal or for any worker to exit
+    if (!dispatcher.run(terminated_)) {
+        // We must die here, because worker shall not exit itself without command from daemon
         int status;
-        pid_t pid = wait(&status);
-        if (pid < 0) {
-            if (!terminated_) {
-                die(format("Failed to wait for any worker to exit: %m"));
-            }
-            break;
-        } else {
-            // We must die here, because worker shall not exit itself without command from daemon
-            die_with_worker_status(status);
+        if (wait(&status) < 0) {
+            die(format("Failed to wait for exited worker: %m"));
         }
+        die_with_worker_status(status);
     }
 
     if (unlink(socket_path_.c_str()) != 0) {
         die(format("Failed to unlink() socket: %m"));
     }
+    // Requests which are already running are completed and answered
+    dispatcher.stop();
     if (close(server_socket_fd_) != 0) {
         die(format("Failed to close() socket: %m"));
     }
@@ -159,8 +173,10 @@ void Daemon::prepare() {
         die(format("Failed to open '/dev/null' for stderr: %m"));
     }
 
-    CgroupController::init("memory");
-    CgroupController::init("cpuacct");
+    Cgroup::init();
+
+    // Stats are shared by all workers and their containers, so they must be allocated before workers are spawned
+    Stats::init();
 
     socket_path_ = Config::get().get_socket_path();
 
@@ -168,7 +184,7 @@ void Daemon::prepare() {
     unlink(socket_path_.c_str());
 
     // Create UNIX socket, on which libsboxd will serve
-    server_socket_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    server_socket_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if (server_socket_fd_ < 0) {
         die(format("Failed to create UNIX socket: %m"));
     }
@@ -181,12 +197,13 @@ void Daemon::prepare() {
         die(format("Failed to bind UNIX socket to @%s: %m", socket_path_.c_str()));
     }
 
-    if (listen(server_socket_fd_, 0) != 0) {
+    // Requests are queued by dispatcher, backlog only has to absorb connections arriving between accept() calls
+    if (listen(server_socket_fd_, static_cast<int>(Config::get().get_listen_backlog())) != 0) {
         die(format("Failed to start listening on socket: %m"));
     }
 
     // All containers must have distinct user ids, so we will use this shared getter to obtain ids
-    id_getter_ = std::make_unique<SharedIdGetter>(Config::get().get_first_uid(), 256);
+    id_getter_ = std::make_unique<SharedIdGetter>(Config::get().get_first_uid(), Config::get().get_uid_count());
 }
 
 void Daemon::die_with_worker_status(int status) {
@@ -0,0 +1,827 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "dispatcher.h"
+#include "config.h"
+#include "protocol.h"
+#include "binary_codec.h"
+#include "stats.h"
+#include "logger.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstring>
+#include <functional>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <rapidjson/document.h>
+#include <rapidjson/error/en.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include "generated/request_schema.h"
+
+namespace {
+// Event tags: listening socket, then worker channels, then connection ids
+const uint64_t LISTEN_TAG = 1;
+const uint64_t FIRST_WORKER_TAG = 2;
+const uint64_t FIRST_CONNECTION_TAG = 1ull << 32;
+
+// Tell client that its slot is completed
+void complete_slot(std::string &out_buffer, shm_ring::Region *ring, uint64_t request_id, uint32_t slot) {
+    // Client owns at most SLOT_COUNT slots, so complete ring may overflow only if client is broken, and then it won't
+    // get its results anyway
+    if (!ring->complete.push(slot)) {
+        log("Ring complete queue is full");
+        return;
+    }
+    protocol::append_frame(out_buffer, request_id, protocol::FRAME_RING_COMPLETE, "");
+}
+
+// Groups of tasks, which share pipes (directly or through other tasks), in order of their first tasks
+std::vector<std::vector<size_t>> group_by_pipes(const std::vector<libsbox::Task *> &tasks) {
+    // Disjoint set union of tasks, every pipe name is bound to first task using it
+    std::vector<size_t> parent(tasks.size());
+    std::function<size_t(size_t)> find = [&parent, &find](size_t i) {
+        return parent[i] == i ? i : (parent[i] = find(parent[i]));
+    };
+    std::map<std::string, size_t> pipe_owners;
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        parent[i] = i;
+        for (const std::string *filename : {&tasks[i]->get_stdin().get_filename(),
+                                            &tasks[i]->get_stdout().get_filename(),
+                                            &tasks[i]->get_stderr().get_filename()}) {
+            // "@_stdout" redirects stderr to stdout of the same task and is not a pipe
+            if (filename->empty() || (*filename)[0] != '@' || *filename == "@_stdout") {
+                continue;
+            }
+            auto owner = pipe_owners.emplace(*filename, i).first->second;
+            parent[find(i)] = find(owner);
+        }
+    }
+
+    std::vector<std::vector<size_t>> groups;
+    std::map<size_t, size_t> group_of_root;
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        auto it = group_of_root.emplace(find(i), groups.size()).first;
+        if (it->second == groups.size()) {
+            groups.emplace_back();
+        }
+        groups[it->second].push_back(i);
+    }
+    return groups;
+}
+
+// Only stdin may be passed inline and only stdout and stderr may be captured. Captured output of whole request must
+// fit into response frame
+Error check_streams(const std::vector<libsbox::Task *> &tasks) {
+    int64_t capture_total = 0;
+    for (auto task : tasks) {
+        if (task->get_stdin().get_capture_limit() != -1 || task->get_stdout().is_inline() ||
+            task->get_stderr().is_inline()) {
+            return Error("Only stdin may be passed inline and only stdout and stderr may be captured");
+        }
+        for (int64_t limit : {task->get_stdout().get_capture_limit(), task->get_stderr().get_capture_limit()}) {
+            if (limit < -1) {
+                return Error("Capture limit must be non-negative");
+            }
+            capture_total += std::max(limit, int64_t{0});
+        }
+    }
+    if (capture_total > libsbox::CAPTURE_MAX) {
+        return Error(format("Total capture limit of request is larger than maximum (%ld > %ld)", capture_total,
+                            libsbox::CAPTURE_MAX));
+    }
+    return Error();
+}
+} // namespace
+
+std::vector<libsbox::Task *> Dispatcher::Request::get_tasks() const {
+    std::vector<libsbox::Task *> result;
+    for (const auto &task : tasks) {
+        result.push_back(task.get());
+    }
+    return result;
+}
+
+bool Dispatcher::QueueEntry::operator<(const QueueEntry &other) const {
+    if (priority != other.priority) {
+        return priority > other.priority;
+    }
+    return job_id < other.job_id;
+}
+
+Dispatcher::Dispatcher(fd_t server_socket_fd, const std::vector<std::unique_ptr<Worker>> &workers)
+    : server_socket_fd_(server_socket_fd), queue_depth_(Config::get().get_queue_depth()),
+      next_connection_id_(FIRST_CONNECTION_TAG) {
+    request_validator_ = std::make_unique<SchemaValidator>(request_schema_data);
+    if (!request_validator_->get_error().empty()) {
+        die(request_validator_->get_error());
+    }
+
+    // All descriptors are edge-triggered, so every handler reads and writes until EAGAIN
+    event_monitor_.add(server_socket_fd_, EPOLLIN | EPOLLET, LISTEN_TAG);
+    for (size_t i = 0; i < workers.size(); ++i) {
+        fd_t fd = workers[i]->get_channel_fd();
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+            die(format("Cannot make worker channel non-blocking: %m"));
+        }
+        worker_channels_.push_back(fd);
+        worker_jobs_.push_back(0);
+        event_monitor_.add(fd, EPOLLIN | EPOLLET, FIRST_WORKER_TAG + i);
+    }
+    for (size_t i = workers.size(); i > 0; --i) {
+        idle_workers_.push_back(i - 1);
+    }
+}
+
+bool Dispatcher::run(const volatile bool &terminated) {
+    while (!terminated) {
+        uint64_t tag;
+        if (!event_monitor_.wait_interruptible(tag)) {
+            continue;
+        }
+
+        if (tag == LISTEN_TAG) {
+            accept_connections();
+        } else if (tag < FIRST_CONNECTION_TAG) {
+            if (!handle_worker(tag - FIRST_WORKER_TAG)) {
+                return false;
+            }
+        } else {
+            handle_connection(tag);
+        }
+        dispatch();
+    }
+    return true;
+}
+
+void Dispatcher::stop() {
+    stopping_ = true;
+    event_monitor_.remove(server_socket_fd_);
+
+    // Replying may close connections, which drops their jobs, so requests are answered after queue is emptied
+    std::vector<uint64_t> failed_requests;
+    for (auto job = jobs_.begin(); job != jobs_.end();) {
+        if (job->second.running) {
+            ++job;
+            continue;
+        }
+        Request &request = requests_.at(job->second.request_key);
+        request.error = "Daemon is stopping";
+        if (--request.pending_jobs == 0) {
+            failed_requests.push_back(job->second.request_key);
+        }
+        job = jobs_.erase(job);
+    }
+    for (uint64_t request_key : failed_requests) {
+        finish_request(request_key);
+    }
+    queue_.clear();
+    queued_count_ = 0;
+
+    // Let running requests complete. New requests are rejected meanwhile
+    auto is_running = [this]() {
+        for (uint64_t job_id : worker_jobs_) {
+            if (job_id != 0) return true;
+        }
+        return false;
+    };
+    while (is_running()) {
+        uint64_t tag;
+        if (!event_monitor_.wait_interruptible(tag)) {
+            continue;
+        }
+
+        if (tag < FIRST_CONNECTION_TAG) {
+            if (!handle_worker(tag - FIRST_WORKER_TAG)) {
+                // Daemon finds out what happened when waiting for workers
+                return;
+            }
+        } else {
+            handle_connection(tag);
+        }
+    }
+}
+
+void Dispatcher::accept_connections() {
+    while (true) {
+        fd_t fd = accept4(server_socket_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                // Probably out of file descriptors. Connections stay in listen backlog until some are closed
+                log(format("Failed to accept connection: %m"));
+            }
+            return;
+        }
+
+        uint64_t connection_id = next_connection_id_++;
+        connections_[connection_id].fd = fd;
+        event_monitor_.add(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, connection_id);
+    }
+}
+
+void Dispatcher::handle_connection(uint64_t connection_id) {
+    auto it = connections_.find(connection_id);
+    if (it == connections_.end()) {
+        // Event was queued before connection was closed
+        return;
+    }
+    Connection &connection = it->second;
+
+    bool keep = true;
+    while (keep && !connection.peer_closed) {
+        char buf[65536];
+        ssize_t cnt = recv(connection.fd, buf, sizeof(buf), 0);
+        if (cnt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            keep = (errno == EAGAIN);
+            break;
+        }
+        if (cnt == 0) {
+            connection.peer_closed = true;
+        } else if (connection.state == Connection::State::LEGACY_WAITING ||
+                   connection.state == Connection::State::LEGACY_DONE) {
+            // Legacy client sends single request, anything after it is ignored
+            continue;
+        } else {
+            connection.in_buffer.append(buf, static_cast<size_t>(cnt));
+        }
+        // Input is processed chunk by chunk, so client can't make us buffer more than single frame
+        keep = process_input(connection_id, connection);
+    }
+
+    finish_io(connection_id, connection, keep);
+}
+
+bool Dispatcher::process_input(uint64_t connection_id, Connection &connection) {
+    if (connection.state == Connection::State::NEW) {
+        if (connection.in_buffer.empty()) {
+            return true;
+        }
+        // First byte tells which protocol client speaks
+        if (connection.in_buffer[0] == protocol::MAGIC[0]) {
+            connection.state = Connection::State::HELLO;
+        } else {
+            connection.state = Connection::State::LEGACY;
+        }
+    }
+
+    if (connection.state == Connection::State::HELLO && !process_hello(connection)) {
+        return false;
+    }
+    if (connection.state == Connection::State::SESSION) {
+        return process_frames(connection_id, connection);
+    }
+    if (connection.state == Connection::State::LEGACY) {
+        // Request ends with null-byte or end-of-file
+        size_t end = connection.in_buffer.find('\0');
+        if (end == std::string::npos && !connection.peer_closed) {
+            if (connection.in_buffer.size() > protocol::MAX_FRAME_SIZE) {
+                log("Request is too large");
+                return false;
+            }
+            return true;
+        }
+
+        std::string request = connection.in_buffer.substr(0, end);
+        connection.in_buffer.clear();
+        connection.state = Connection::State::LEGACY_WAITING;
+        handle_request(connection_id, connection, 0, Reply::LEGACY, request);
+    }
+    return true;
+}
+
+bool Dispatcher::process_hello(Connection &connection) {
+    // Connection problems in session are caused by client, so we just drop connection instead of dying
+    protocol::Hello hello{};
+    if (connection.in_buffer.size() < sizeof(hello)) {
+        return true;
+    }
+    memcpy(&hello, connection.in_buffer.data(), sizeof(hello));
+    connection.in_buffer.erase(0, sizeof(hello));
+    if (!protocol::is_valid_hello(hello)) {
+        log(format("Invalid session hello (version %u)", hello.version));
+        return false;
+    }
+
+    // Agree to every known feature client asks for
+    connection.binary = (hello.flags & protocol::FLAG_BINARY_V1) != 0;
+    bool use_ring = (hello.flags & protocol::FLAG_SHM_RING_V1) != 0;
+    hello = protocol::make_hello(hello.flags & protocol::SUPPORTED_FLAGS);
+
+    // Nothing is sent before hello, so it fits into socket buffer even though socket is non-blocking
+    if (use_ring) {
+        connection.ring = std::make_unique<SharedRing>();
+        ssize_t cnt = protocol::write_full_with_fd(connection.fd, &hello, sizeof(hello), connection.ring->get_fd());
+        // Client has its own reference to memfd now
+        connection.ring->close_fd();
+        if (cnt < 0) {
+            log(format("Failed to send session hello: %m"));
+            return false;
+        }
+    } else if (protocol::write_full(connection.fd, &hello, sizeof(hello)) < 0) {
+        log(format("Failed to send session hello: %m"));
+        return false;
+    }
+
+    connection.state = Connection::State::SESSION;
+    return true;
+}
+
+bool Dispatcher::process_frames(uint64_t connection_id, Connection &connection) {
+    size_t offset = 0;
+    bool keep = true;
+    while (keep && connection.in_buffer.size() - offset >= sizeof(protocol::FrameHeader)) {
+        protocol::FrameHeader header{};
+        memcpy(&header, connection.in_buffer.data() + offset, sizeof(header));
+        if (header.type == protocol::FRAME_RING_SUBMIT && connection.ring && header.length == 0) {
+            offset += sizeof(header);
+            keep = drain_ring(connection_id, connection);
+            continue;
+        }
+        if (header.type != protocol::FRAME_REQUEST || header.length > protocol::MAX_FRAME_SIZE) {
+            log(format("Invalid frame (type %u, length %u)", header.type, header.length));
+            keep = false;
+            break;
+        }
+        if (connection.in_buffer.size() - offset - sizeof(header) < header.length) {
+            break;
+        }
+
+        std::string request = connection.in_buffer.substr(offset + sizeof(header), header.length);
+        offset += sizeof(header) + header.length;
+        handle_request(connection_id, connection, header.request_id, Reply::FRAME, request);
+    }
+    connection.in_buffer.erase(0, offset);
+    return keep;
+}
+
+bool Dispatcher::drain_ring(uint64_t connection_id, Connection &connection) {
+    // Drain all submitted slots, doorbell may cover several of them
+    shm_ring::Region *ring = connection.ring->get();
+    uint32_t index;
+    while (ring->submit.is_consistent() && ring->submit.pop(index)) {
+        if (index >= shm_ring::SLOT_COUNT) {
+            log(format("Invalid ring slot index %u", index));
+            return false;
+        }
+
+        shm_ring::Slot &slot = ring->slots[index];
+        // Copy request fields before parsing, so results are reported to the right request whatever client does with
+        // slot
+        uint64_t request_id = slot.request_id;
+        int32_t priority = slot.priority;
+        int64_t start_ns = get_monotonic_ns();
+        std::vector<libsbox::Task *> tasks;
+        auto error = shm_ring::read_request(slot, tasks);
+        if (!error) {
+            error = enqueue(connection_id, request_id, Reply::RING, index, priority, tasks, start_ns);
+        }
+        if (error) {
+            reply_error(connection, request_id, Reply::RING, index, error.get());
+        }
+    }
+
+    if (!ring->submit.is_consistent()) {
+        log("Ring submit queue is corrupted");
+        return false;
+    }
+    return true;
+}
+
+bool Dispatcher::flush(Connection &connection) {
+    while (connection.out_offset < connection.out_buffer.size()) {
+        ssize_t cnt = send(
+            connection.fd,
+            connection.out_buffer.data() + connection.out_offset,
+            connection.out_buffer.size() - connection.out_offset,
+            MSG_NOSIGNAL
+        );
+        if (cnt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Rest is sent when socket becomes writable
+            return errno == EAGAIN;
+        }
+        connection.out_offset += static_cast<size_t>(cnt);
+    }
+    connection.out_buffer.clear();
+    connection.out_offset = 0;
+    return true;
+}
+
+void Dispatcher::finish_io(uint64_t connection_id, Connection &connection, bool keep) {
+    keep = keep && flush(connection);
+    // Session ends when client closes connection, legacy connection ends when response is sent
+    if (connection.peer_closed && (connection.state == Connection::State::NEW ||
+                                   connection.state == Connection::State::HELLO ||
+                                   connection.state == Connection::State::SESSION)) {
+        keep = false;
+    }
+    if (connection.state == Connection::State::LEGACY_DONE && connection.out_buffer.empty()) {
+        keep = false;
+    }
+    if (!keep) {
+        close_connection(connection_id);
+    }
+}
+
+void Dispatcher::close_connection(uint64_t connection_id) {
+    auto it = connections_.find(connection_id);
+    event_monitor_.remove(it->second.fd);
+    if (close(it->second.fd) != 0) {
+        die(format("Cannot close socket: %m"));
+    }
+    connections_.erase(it);
+
+    // Queued jobs of connection are dropped, running ones are discarded when they complete
+    for (auto job = jobs_.begin(); job != jobs_.end();) {
+        Request &request = requests_.at(job->second.request_key);
+        if (request.connection_id != connection_id || job->second.running) {
+            ++job;
+            continue;
+        }
+        --queued_count_;
+        --request.pending_jobs;
+        if (request.pending_jobs == 0) {
+            requests_.erase(job->second.request_key);
+        }
+        job = jobs_.erase(job);
+    }
+}
+
+void Dispatcher::handle_request(uint64_t connection_id, Connection &connection, uint64_t request_id, Reply reply,
+                                const std::string &request) {
+    int64_t start_ns = get_monotonic_ns();
+    std::vector<libsbox::Task *> tasks;
+    int32_t priority = 0;
+    bool stats_query = false;
+    auto error = connection.binary ? parse_binary_request(request, tasks, priority)
+                                   : parse_json_request(request, tasks, priority, stats_query);
+    if (stats_query) {
+        send_response(connection, request_id, reply, Stats::to_json());
+        return;
+    }
+    if (!error) {
+        error = enqueue(connection_id, request_id, reply, 0, priority, tasks, start_ns);
+    }
+    if (error) {
+        reply_error(connection, request_id, reply, 0, error.get());
+    }
+}
+
+Error Dispatcher::parse_json_request(const std::string &request, std::vector<libsbox::Task *> &tasks,
+                                     int32_t &priority, bool &stats_query) {
+    rapidjson::Document document;
+    document.Parse(request.c_str());
+
+    if (document.HasParseError()) {
+        return Error(format(
+            "Request JSON incorrect: %s (at %zi)",
+            GetParseError_En(document.GetParseError()),
+            document.GetErrorOffset()
+        ));
+    }
+
+    // {"query": "stats"} asks for stage latency stats instead of running tasks
+    if (document.IsObject() && document.HasMember("query")) {
+        if (!document["query"].IsString() || std::string(document["query"].GetString()) != "stats") {
+            return Error("Unknown query");
+        }
+        stats_query = true;
+        return Error();
+    }
+
+    if (!request_validator_->validate(document)) {
+        return Error(request_validator_->get_error());
+    }
+
+    if (document.HasMember("priority")) {
+        priority = document["priority"].GetInt();
+    }
+    for (const auto &json_task : document["tasks"].GetArray()) {
+        libsbox::Task *task = new libsbox::Task();
+        task->deserialize_request(json_task);
+        tasks.push_back(task);
+    }
+
+    return Error();
+}
+
+Error Dispatcher::parse_binary_request(const std::string &request, std::vector<libsbox::Task *> &tasks,
+                                       int32_t &priority) {
+    BinaryReader reader(request.data(), request.size());
+    priority = reader.read_int32();
+    for (uint32_t i = reader.read_uint32(); i > 0 && !reader.failed(); --i) {
+        libsbox::Task *task = new libsbox::Task();
+        task->deserialize_request(reader);
+        tasks.push_back(task);
+    }
+
+    if (reader.failed() || !reader.at_end()) {
+        for (auto task : tasks) {
+            delete task;
+        }
+        tasks.clear();
+        return Error("Binary request is incorrect");
+    }
+
+    return Error();
+}
+
+Error Dispatcher::enqueue(uint64_t connection_id, uint64_t request_id, Reply reply, uint32_t slot, int32_t priority,
+                          std::vector<libsbox::Task *> &tasks, int64_t parse_start_ns) {
+    auto groups = group_by_pipes(tasks);
+    auto streams_error = check_streams(tasks);
+    Request request;
+    for (auto task : tasks) {
+        request.tasks.emplace_back(task);
+    }
+    tasks.clear();
+
+    if (streams_error) {
+        return streams_error;
+    }
+    if (stopping_) {
+        return Error("Daemon is stopping");
+    }
+    // Admission control: burst beyond queue depth is rejected instead of making everyone wait. Request is queued
+    // either whole or not at all
+    if (groups.size() > queue_depth_) {
+        return Error("Request has more jobs than queue can hold");
+    }
+    if (queued_count_ + groups.size() > queue_depth_) {
+        return Error("Request queue is full");
+    }
+
+    int64_t now_ns = get_monotonic_ns();
+    request.connection_id = connection_id;
+    request.request_id = request_id;
+    request.reply = reply;
+    request.slot = slot;
+    request.parse_ns = now_ns - parse_start_ns;
+    request.pending_jobs = groups.size();
+    Stats::record(STAGE_PARSE, request.parse_ns);
+
+    if (groups.empty()) {
+        // Nothing to run, answer right away
+        reply_results(connections_.at(connection_id), request);
+        return Error();
+    }
+    uint64_t request_key = next_request_key_++;
+    requests_.emplace(request_key, std::move(request));
+
+    for (auto &group : groups) {
+        uint64_t job_id = next_job_id_++;
+        Job &job = jobs_[job_id];
+        job.request_key = request_key;
+        job.task_indices = std::move(group);
+        job.queued_at_ns = now_ns;
+        queue_.insert({priority, job_id});
+        ++queued_count_;
+    }
+    return Error();
+}
+
+void Dispatcher::dispatch() {
+    while (!idle_workers_.empty() && !queue_.empty()) {
+        uint64_t job_id = queue_.begin()->job_id;
+        queue_.erase(queue_.begin());
+        auto it = jobs_.find(job_id);
+        if (it == jobs_.end()) {
+            // Connection was closed while job was queued
+            continue;
+        }
+        Job &job = it->second;
+        const Request &request = requests_.at(job.request_key);
+        --queued_count_;
+
+        size_t index = idle_workers_.back();
+        idle_workers_.pop_back();
+
+        BinaryWriter writer;
+        writer.write_uint32(static_cast<uint32_t>(job.task_indices.size()));
+        for (size_t task_index : job.task_indices) {
+            request.tasks[task_index]->serialize_request(writer);
+        }
+        // Worker is idle, so its channel is empty and message fits into it
+        if (protocol::write_frame(worker_channels_[index], job_id, protocol::FRAME_REQUEST, writer.get()) < 0) {
+            die(format("Failed to send job to worker: %m"));
+        }
+
+        job.running = true;
+        job.queue_ns = get_monotonic_ns() - job.queued_at_ns;
+        Stats::record(STAGE_QUEUE, job.queue_ns);
+        worker_jobs_[index] = job_id;
+    }
+}
+
+bool Dispatcher::handle_worker(size_t index) {
+    while (true) {
+        std::string packet;
+        ssize_t cnt = protocol::read_packet(worker_channels_[index], packet);
+        if (cnt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                return true;
+            }
+            die(format("Failed to receive results from worker: %m"));
+        }
+        if (cnt == 0) {
+            return false;
+        }
+
+        protocol::FrameHeader header{};
+        if (packet.size() < sizeof(header)) {
+            die("Worker sent incorrect results");
+        }
+        memcpy(&header, packet.data(), sizeof(header));
+        if (header.request_id != worker_jobs_[index] || header.length != packet.size() - sizeof(header)) {
+            die("Worker sent incorrect results");
+        }
+        if (header.type == protocol::FRAME_TELEMETRY) {
+            forward_sample(header.request_id, packet.substr(sizeof(header)));
+            continue;
+        }
+        if (header.type != protocol::FRAME_RESPONSE) {
+            die("Worker sent incorrect results");
+        }
+
+        worker_jobs_[index] = 0;
+        idle_workers_.push_back(index);
+        complete_job(header.request_id, packet.substr(sizeof(header)));
+    }
+}
+
+void Dispatcher::forward_sample(uint64_t job_id, const std::string &payload) {
+    const Job &job = jobs_.at(job_id);
+    BinaryReader reader(payload.data(), payload.size());
+    uint32_t index = reader.read_uint32();
+    libsbox::TelemetrySample sample;
+    if (sample.deserialize(reader) || !reader.at_end() || index >= job.task_indices.size()) {
+        die("Worker sent incorrect telemetry sample");
+    }
+
+    const Request &request = requests_.at(job.request_key);
+    auto connection = connections_.find(request.connection_id);
+    // Legacy protocol has no frames to carry samples
+    if (connection == connections_.end() || request.reply == Reply::LEGACY) {
+        return;
+    }
+    // Samples are sent with index of task in request, which is not known to worker
+    auto task_index = static_cast<uint32_t>(job.task_indices[index]);
+    if (connection->second.binary) {
+        BinaryWriter writer;
+        writer.write_uint32(task_index);
+        sample.serialize(writer);
+        protocol::append_frame(connection->second.out_buffer, request.request_id, protocol::FRAME_TELEMETRY,
+                               writer.get());
+    } else {
+        rapidjson::StringBuffer buffer;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("task");
+        writer.Uint(task_index);
+        writer.Key("sample");
+        sample.serialize(writer);
+        writer.EndObject();
+        protocol::append_frame(connection->second.out_buffer, request.request_id, protocol::FRAME_TELEMETRY,
+                               buffer.GetString());
+    }
+    finish_io(connection->first, connection->second, true);
+}
+
+void Dispatcher::complete_job(uint64_t job_id, const std::string &response) {
+    auto it = jobs_.find(job_id);
+    Job job = std::move(it->second);
+    jobs_.erase(it);
+
+    auto request_it = requests_.find(job.request_key);
+    Request &request = request_it->second;
+    --request.pending_jobs;
+
+    if (connections_.count(request.connection_id) != 0) {
+        BinaryReader reader(response.data(), response.size());
+        if (reader.read_uint32() != 0) {
+            std::string error = reader.read_string();
+            if (request.error.empty()) {
+                request.error = error;
+            }
+        } else {
+            if (reader.read_uint32() != job.task_indices.size()) {
+                die("Worker sent incorrect results");
+            }
+            for (size_t task_index : job.task_indices) {
+                libsbox::Task *task = request.tasks[task_index].get();
+                if (task->deserialize_response(reader) || reader.failed()) {
+                    die("Worker sent incorrect results");
+                }
+                // Stages passed in daemon are not known to worker
+                if (task->get_collect_timings()) {
+                    task->set_timing_ns(STAGE_NAMES[STAGE_PARSE], request.parse_ns);
+                    task->set_timing_ns(STAGE_NAMES[STAGE_QUEUE], job.queue_ns);
+                }
+            }
+        }
+    }
+
+    if (request.pending_jobs == 0) {
+        finish_request(job.request_key);
+    }
+}
+
+void Dispatcher::finish_request(uint64_t request_key) {
+    auto it = requests_.find(request_key);
+    Request request = std::move(it->second);
+    requests_.erase(it);
+
+    auto connection = connections_.find(request.connection_id);
+    if (connection == connections_.end()) {
+        return;
+    }
+    if (!request.error.empty()) {
+        reply_error(connection->second, request.request_id, request.reply, request.slot, request.error);
+    } else {
+        reply_results(connection->second, request);
+    }
+    finish_io(connection->first, connection->second, true);
+}
+
+void Dispatcher::reply_results(Connection &connection, const Request &request) {
+    int64_t start_ns = get_monotonic_ns();
+    if (request.reply == Reply::RING) {
+        shm_ring::Region *ring = connection.ring->get();
+        if (!shm_ring::write_results(ring->slots[request.slot], request.get_tasks())) {
+            // Client checks capture limits before using ring, so only broken client gets here
+            shm_ring::write_error(ring->slots[request.slot], "Captured output doesn't fit into shared memory slot");
+        }
+        complete_slot(connection.out_buffer, ring, request.request_id, request.slot);
+    } else if (connection.binary) {
+        BinaryWriter writer;
+        writer.write_uint32(0);
+        writer.write_uint32(static_cast<uint32_t>(request.tasks.size()));
+        for (const auto &task : request.tasks) {
+            task->serialize_response(writer);
+        }
+        send_response(connection, request.request_id, request.reply, writer.get());
+    } else {
+        rapidjson::StringBuffer buffer;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("tasks");
+        writer.StartArray();
+        for (const auto &task : request.tasks) {
+            task->serialize_response(writer);
+        }
+        writer.EndArray();
+        writer.EndObject();
+        send_response(connection, request.request_id, request.reply, buffer.GetString());
+    }
+    Stats::record(STAGE_SERIALIZE, get_monotonic_ns() - start_ns);
+}
+
+void Dispatcher::reply_error(Connection &connection, uint64_t request_id, Reply reply, uint32_t slot,
+                             const std::string &error) {
+    if (reply == Reply::RING) {
+        shm_ring::Region *ring = connection.ring->get();
+        shm_ring::write_error(ring->slots[slot], error);
+        complete_slot(connection.out_buffer, ring, request_id, slot);
+    } else if (connection.binary) {
+        BinaryWriter writer;
+        writer.write_uint32(1);
+        writer.write_string(error);
+        send_response(connection, request_id, reply, writer.get());
+    } else {
+        rapidjson::StringBuffer buffer;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("error");
+        writer.String(error.c_str());
+        writer.EndObject();
+        send_response(connection, request_id, reply, buffer.GetString());
+    }
+}
+
+void Dispatcher::send_response(Connection &connection, uint64_t request_id, Reply reply,
+                               const std::string &response) {
+    // Response is only queued here, caller flushes connection
+    if (reply == Reply::LEGACY) {
+        connection.out_buffer += response;
+        connection.state = Connection::State::LEGACY_DONE;
+    } else {
+        protocol::append_frame(connection.out_buffer, request_id, protocol::FRAME_RESPONSE, response);
+    }
+}
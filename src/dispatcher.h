@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_DISPATCHER_H
+#define LIBSBOX_DISPATCHER_H
+
+#include "worker.h"
+#include "event_monitor.h"
+#include "schema_validator.h"
+#include "shared_ring.h"
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+// Serves all client connections in daemon process. Requests are parsed once and split into jobs: tasks connected with
+// pipes stay in one job, every other task is a job of its own. Jobs are put into single queue ordered by priority and
+// handed to workers as soon as any of them becomes free, so independent tasks of one request spread over all idle
+// boxes and connection never holds a worker. Client gets single response when all jobs of request complete. Request
+// whose jobs don't fit into queue of queue_depth jobs is rejected right away
+class Dispatcher {
+public:
+    Dispatcher(fd_t server_socket_fd, const std::vector<std::unique_ptr<Worker>> &workers);
+
+    Dispatcher(const Dispatcher &) = delete;
+    Dispatcher &operator=(const Dispatcher &) = delete;
+
+    // Serve until terminated is set (returns true) or some worker exits (returns false)
+    bool run(const volatile bool &terminated);
+    // Stop accepting, fail queued requests and wait until running ones are answered. Called after run() returned true
+    void stop();
+private:
+    // How results are delivered to client
+    enum class Reply {
+        LEGACY,
+        FRAME,
+        RING
+    };
+
+    struct Request {
+        uint64_t connection_id;
+        uint64_t request_id;
+        Reply reply;
+        // Ring slot of RING request
+        uint32_t slot;
+        std::vector<std::unique_ptr<libsbox::Task>> tasks;
+        int64_t parse_ns;
+        // Jobs of request, which are not completed yet
+        size_t pending_jobs = 0;
+        // First error reported by any job
+        std::string error;
+
+        std::vector<libsbox::Task *> get_tasks() const;
+    };
+
+    // Part of request run on single worker: group of tasks connected with pipes, which must run together
+    struct Job {
+        uint64_t request_key;
+        std::vector<size_t> task_indices;
+        bool running = false;
+        int64_t queued_at_ns;
+        int64_t queue_ns = 0;
+    };
+
+    struct QueueEntry {
+        int32_t priority;
+        uint64_t job_id;
+
+        // Job to be run first is the smallest one: higher priority first, then older job first
+        bool operator<(const QueueEntry &other) const;
+    };
+
+    struct Connection {
+        enum class State {
+            // Nothing is received yet
+            NEW,
+            HELLO,
+            SESSION,
+            LEGACY,
+            // Legacy request is received and is being processed
+            LEGACY_WAITING,
+            // Connection is closed as soon as legacy response is sent
+            LEGACY_DONE
+        };
+
+        fd_t fd = -1;
+        State state = State::NEW;
+        bool binary = false;
+        std::unique_ptr<SharedRing> ring;
+        std::string in_buffer;
+        std::string out_buffer;
+        size_t out_offset = 0;
+        bool peer_closed = false;
+    };
+
+    fd_t server_socket_fd_;
+    bool stopping_ = false;
+    uint32_t queue_depth_;
+    EventMonitor event_monitor_;
+    std::unique_ptr<SchemaValidator> request_validator_;
+
+    std::vector<fd_t> worker_channels_;
+    std::vector<size_t> idle_workers_;
+    // Job running on each worker, 0 if worker is idle
+    std::vector<uint64_t> worker_jobs_;
+
+    uint64_t next_request_key_ = 1;
+    std::map<uint64_t, Request> requests_;
+    uint64_t next_job_id_ = 1;
+    std::map<uint64_t, Job> jobs_;
+    std::set<QueueEntry> queue_;
+    size_t queued_count_ = 0;
+
+    uint64_t next_connection_id_;
+    std::map<uint64_t, Connection> connections_;
+
+    void accept_connections();
+    void handle_connection(uint64_t connection_id);
+    // Handlers below return false if connection must be closed
+    bool process_input(uint64_t connection_id, Connection &connection);
+    bool process_hello(Connection &connection);
+    bool process_frames(uint64_t connection_id, Connection &connection);
+    bool drain_ring(uint64_t connection_id, Connection &connection);
+    static bool flush(Connection &connection);
+    // Send queued output and close connection if it is done or keep is false
+    void finish_io(uint64_t connection_id, Connection &connection, bool keep);
+    void close_connection(uint64_t connection_id);
+
+    void handle_request(uint64_t connection_id, Connection &connection, uint64_t request_id, Reply reply,
+                        const std::string &request);
+    Error parse_json_request(const std::string &request, std::vector<libsbox::Task *> &tasks, int32_t &priority,
+                             bool &stats_query);
+    static Error parse_binary_request(const std::string &request, std::vector<libsbox::Task *> &tasks,
+                                      int32_t &priority);
+    // Split request into independent jobs and queue them. Takes ownership of tasks, also if request is rejected
+    Error enqueue(uint64_t connection_id, uint64_t request_id, Reply reply, uint32_t slot, int32_t priority,
+                  std::vector<libsbox::Task *> &tasks, int64_t parse_start_ns);
+    void dispatch();
+
+    // Returns false if worker exited
+    bool handle_worker(size_t index);
+    // Pass telemetry sample of running job to client of its request
+    void forward_sample(uint64_t job_id, const std::string &payload);
+    void complete_job(uint64_t job_id, const std::string &response);
+    // Answer request when all its jobs are completed
+    void finish_request(uint64_t request_key);
+    void reply_results(Connection &connection, const Request &request);
+    static void reply_error(Connection &connection, uint64_t request_id, Reply reply, uint32_t slot,
+                            const std::string &error);
+    static void send_response(Connection &connection, uint64_t request_id, Reply reply, const std::string &response);
+};
+
+#endif //LIBSBOX_DISPATCHER_H
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "event_monitor.h"
+#include "context_manager.h"
+#include "utils.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+EventMonitor::EventMonitor() {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        die(format("Cannot create epoll instance: %m"));
+    }
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timer_fd_ < 0) {
+        die(format("Cannot create timerfd: %m"));
+    }
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = TIMER_EVENT;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &event) != 0) {
+        die(format("Cannot add timerfd to epoll: %m"));
+    }
+}
+
+EventMonitor::~EventMonitor() {
+    if (close(timer_fd_) != 0) {
+        die(format("Cannot close timerfd: %m"));
+    }
+    if (close(epoll_fd_) != 0) {
+        die(format("Cannot close epoll instance: %m"));
+    }
+}
+
+void EventMonitor::add(fd_t fd, uint32_t events, uint64_t tag) {
+    if (tag == TIMER_EVENT) {
+        die("Event tag is reserved for timer");
+    }
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.u64 = tag;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+        die(format("Cannot add fd %d to epoll: %m", fd));
+    }
+}
+
+void EventMonitor::remove(fd_t fd) {
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr) != 0) {
+        die(format("Cannot remove fd %d from epoll: %m", fd));
+    }
+}
+
+void EventMonitor::set_timer(int64_t delay_ns) {
+    struct itimerspec timer = {};
+    timer.it_value.tv_sec = delay_ns / 1000000000;
+    timer.it_value.tv_nsec = delay_ns % 1000000000;
+    if (timerfd_settime(timer_fd_, 0, &timer, nullptr) != 0) {
+        die(format("Cannot set timerfd: %m"));
+    }
+}
+
+uint64_t EventMonitor::wait() {
+    uint64_t tag;
+    while (!wait_interruptible(tag)) {}
+    return tag;
+}
+
+bool EventMonitor::wait_interruptible(uint64_t &tag) {
+    while (true) {
+        struct epoll_event event = {};
+        int cnt = epoll_wait(epoll_fd_, &event, 1, -1);
+        if (cnt < 0) {
+            if (errno == EINTR) return false;
+            die(format("epoll_wait() failed: %m"));
+        }
+        if (cnt == 0) continue;
+
+        if (event.data.u64 == TIMER_EVENT) {
+            uint64_t expirations;
+            if (read(timer_fd_, &expirations, sizeof(expirations)) < 0) {
+                // Timer could be rearmed after it was reported
+                if (errno == EAGAIN) continue;
+                die(format("Cannot read from timerfd: %m"));
+            }
+        }
+        tag = event.data.u64;
+        return true;
+    }
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_EVENT_MONITOR_H
+#define LIBSBOX_EVENT_MONITOR_H
+
+#include "libsbox_internal.h"
+
+#include <stdint.h>
+
+// Waits for events on registered file descriptors and for single one-shot timer. Used instead of periodic timer
+// interrupts, so nothing wakes up unless there is something to check
+class EventMonitor {
+public:
+    EventMonitor();
+    ~EventMonitor();
+
+    // Tag reported when timer expires
+    static const uint64_t TIMER_EVENT = 0;
+
+    // Register fd, its events will be reported with given tag (must not be TIMER_EVENT)
+    void add(fd_t fd, uint32_t events, uint64_t tag);
+    void remove(fd_t fd);
+
+    // Arm timer to expire after delay_ns nanoseconds, delay_ns = 0 disarms timer
+    void set_timer(int64_t delay_ns);
+
+    // Wait for next event and return its tag. Interrupted waits are restarted
+    uint64_t wait();
+    // Same as wait(), but returns false instead of restarting if interrupted by signal
+    bool wait_interruptible(uint64_t &tag);
+private:
+    fd_t epoll_fd_ = -1;
+    fd_t timer_fd_ = -1;
+};
+
+#endif //LIBSBOX_EVENT_MONITOR_H
@@ -5,6 +5,9 @@
 #include "utils.h"
 #include "context_manager.h"
 #include "schema_validator.h"
+#include "protocol.h"
+#include "binary_codec.h"
+#include "shm_ring.h"
 #include "generated/response_schema.h"
 
 #include <libsbox.h>
@@ -12,6 +15,9 @@
 #include <rapidjson/document.h>
 #include <sys/un.h>
 #include <sys/socket.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
 #include <rapidjson/error/en.h>
 
 using namespace libsbox;
@@ -68,23 +74,69 @@ const std::string &Pipe::get_name() const {
     return name_;
 }
 
-void Stream::disable() {
+void Stream::reset() {
     filename_.clear();
+    inline_ = false;
+    capture_limit_ = -1;
+    data_.clear();
+    truncated_ = false;
+}
+
+void Stream::disable() {
+    reset();
 }
 
 void Stream::use_pipe(const Pipe &pipe) {
+    reset();
     filename_ = "@" + pipe.get_name();
 }
 
 void Stream::use_file(const std::string &filename) {
+    reset();
     filename_ = filename;
 }
 
+void Stream::use_data(const std::string &data) {
+    reset();
+    inline_ = true;
+    data_ = data;
+}
+
+void Stream::capture(int64_t limit_bytes) {
+    reset();
+    capture_limit_ = limit_bytes;
+}
+
 const std::string &Stream::get_filename() const {
     return filename_;
 }
 
+bool Stream::is_inline() const {
+    return inline_;
+}
+
+int64_t Stream::get_capture_limit() const {
+    return capture_limit_;
+}
+
+const std::string &Stream::get_data() const {
+    return data_;
+}
+
+void Stream::set_data(const std::string &data) {
+    data_ = data;
+}
+
+bool Stream::is_truncated() const {
+    return truncated_;
+}
+
+void Stream::set_truncated(bool truncated) {
+    truncated_ = truncated;
+}
+
 void StderrStream::use_stdout() {
+    reset();
     filename_ = "@_stdout";
 }
 
@@ -152,18 +204,70 @@ void Task::set_use_standard_binds(bool use_standard_binds) {
     use_standard_binds_ = use_standard_binds;
 }
 
+bool Task::get_collect_timings() const {
+    return collect_timings_;
+}
+
+void Task::set_collect_timings(bool collect_timings) {
+    collect_timings_ = collect_timings;
+}
+
+bool Task::get_collect_counters() const {
+    return collect_counters_;
+}
+
+void Task::set_collect_counters(bool collect_counters) {
+    collect_counters_ = collect_counters;
+}
+
+int64_t Task::get_instruction_limit() const {
+    return instruction_limit_;
+}
+
+void Task::set_instruction_limit(int64_t instruction_limit) {
+    instruction_limit_ = instruction_limit;
+}
+
+time_ms_t Task::get_telemetry_interval_ms() const {
+    return telemetry_interval_ms_;
+}
+
+void Task::set_telemetry_interval_ms(time_ms_t telemetry_interval_ms) {
+    telemetry_interval_ms_ = telemetry_interval_ms;
+}
+
+const Task::TelemetryCallback &Task::get_telemetry_callback() const {
+    return telemetry_callback_;
+}
+
+void Task::set_telemetry_callback(TelemetryCallback callback) {
+    telemetry_callback_ = std::move(callback);
+}
+
 Stream &Task::get_stdin() {
     return stdin_;
 }
 
+const Stream &Task::get_stdin() const {
+    return stdin_;
+}
+
 Stream &Task::get_stdout() {
     return stdout_;
 }
 
+const Stream &Task::get_stdout() const {
+    return stdout_;
+}
+
 StderrStream &Task::get_stderr() {
     return stderr_;
 }
 
+const StderrStream &Task::get_stderr() const {
+    return stderr_;
+}
+
 std::vector<std::string> &Task::get_env() {
     return env_;
 }
@@ -292,6 +396,70 @@ void Task::set_memory_limit_hit(bool memory_limit_hit) {
     memory_limit_hit_ = memory_limit_hit;
 }
 
+time_ms_t Task::get_oom_time_ms() const {
+    return oom_time_ms_;
+}
+
+void Task::set_oom_time_ms(time_ms_t oom_time_ms) {
+    oom_time_ms_ = oom_time_ms;
+}
+
+memory_kb_t Task::get_oom_memory_usage_kb() const {
+    return oom_memory_usage_kb_;
+}
+
+void Task::set_oom_memory_usage_kb(memory_kb_t oom_memory_usage_kb) {
+    oom_memory_usage_kb_ = oom_memory_usage_kb;
+}
+
+bool Task::is_instruction_limit_exceeded() const {
+    return instruction_limit_exceeded_;
+}
+
+void Task::set_instruction_limit_exceeded(bool instruction_limit_exceeded) {
+    instruction_limit_exceeded_ = instruction_limit_exceeded;
+}
+
+int64_t Task::get_instructions() const {
+    return instructions_;
+}
+
+void Task::set_instructions(int64_t instructions) {
+    instructions_ = instructions;
+}
+
+int64_t Task::get_cycles() const {
+    return cycles_;
+}
+
+void Task::set_cycles(int64_t cycles) {
+    cycles_ = cycles;
+}
+
+int64_t Task::get_cache_misses() const {
+    return cache_misses_;
+}
+
+void Task::set_cache_misses(int64_t cache_misses) {
+    cache_misses_ = cache_misses;
+}
+
+int64_t Task::get_context_switches() const {
+    return context_switches_;
+}
+
+void Task::set_context_switches(int64_t context_switches) {
+    context_switches_ = context_switches;
+}
+
+const std::map<std::string, int64_t> &Task::get_timings_ns() const {
+    return timings_ns_;
+}
+
+void Task::set_timing_ns(const std::string &stage, int64_t ns) {
+    timings_ns_[stage] = ns;
+}
+
 #define KEY(s) writer.Key(s)
 #define STRING(s) writer.String(s.c_str(), s.size(), true)
 #define INT(x) writer.Int(x)
@@ -313,7 +481,19 @@ void BindRule::serialize_request(rapidjson::Writer<rapidjson::StringBuffer> &wri
 
 template<>
 void Stream::serialize_request(rapidjson::Writer<rapidjson::StringBuffer> &writer) const {
-    STRING(filename_);
+    if (inline_) {
+        writer.StartObject();
+        KEY("data");
+        STRING(data_);
+        writer.EndObject();
+    } else if (capture_limit_ != -1) {
+        writer.StartObject();
+        KEY("capture");
+        INT64(capture_limit_);
+        writer.EndObject();
+    } else {
+        STRING(filename_);
+    }
 }
 
 template<>
@@ -335,6 +515,14 @@ void Task::serialize_request(rapidjson::Writer<rapidjson::StringBuffer> &writer)
     BOOL(need_ipc_);
     KEY("use_standard_binds");
     BOOL(use_standard_binds_);
+    KEY("collect_timings");
+    BOOL(collect_timings_);
+    KEY("collect_counters");
+    BOOL(collect_counters_);
+    KEY("instruction_limit");
+    INT64(instruction_limit_);
+    KEY("telemetry_interval_ms");
+    INT64(telemetry_interval_ms_);
     KEY("stdin");
     stdin_.serialize_request(writer);
     KEY("stdout");
@@ -379,6 +567,63 @@ void Task::serialize_response(rapidjson::Writer<rapidjson::StringBuffer> &writer
     BOOL(oom_killed_);
     KEY("memory_limit_hit");
     BOOL(memory_limit_hit_);
+    KEY("oom_time_ms");
+    INT64(oom_time_ms_);
+    KEY("oom_memory_usage_kb");
+    INT64(oom_memory_usage_kb_);
+    KEY("instruction_limit_exceeded");
+    BOOL(instruction_limit_exceeded_);
+    if (stdout_.get_capture_limit() != -1) {
+        KEY("stdout_data");
+        STRING(stdout_.get_data());
+        KEY("stdout_truncated");
+        BOOL(stdout_.is_truncated());
+    }
+    if (stderr_.get_capture_limit() != -1) {
+        KEY("stderr_data");
+        STRING(stderr_.get_data());
+        KEY("stderr_truncated");
+        BOOL(stderr_.is_truncated());
+    }
+    if (collect_counters_) {
+        KEY("instructions");
+        INT64(instructions_);
+        KEY("cycles");
+        INT64(cycles_);
+        KEY("cache_misses");
+        INT64(cache_misses_);
+        KEY("context_switches");
+        INT64(context_switches_);
+    }
+    if (collect_timings_) {
+        KEY("timings");
+        writer.StartArray();
+        for (const auto &it : timings_ns_) {
+            writer.StartObject();
+            KEY("stage");
+            STRING(it.first);
+            KEY("ns");
+            INT64(it.second);
+            writer.EndObject();
+        }
+        writer.EndArray();
+    }
+    writer.EndObject();
+}
+
+template<>
+void TelemetrySample::serialize(rapidjson::Writer<rapidjson::StringBuffer> &writer) const {
+    writer.StartObject();
+    KEY("wall_time_ms");
+    INT64(wall_time_ms);
+    KEY("time_usage_ms");
+    INT64(time_usage_ms);
+    KEY("memory_usage_kb");
+    INT64(memory_usage_kb);
+    KEY("pids");
+    INT64(pids);
+    KEY("stdout_bytes");
+    INT64(stdout_bytes);
     writer.EndObject();
 }
 
@@ -405,8 +650,18 @@ BindRule::BindRule(const rapidjson::Value &value) {
 
 template<>
 void Stream::deserialize_request(const rapidjson::Value &value) {
+    reset();
     if (value.IsNull()) {
         filename_ = "";
+    } else if (value.IsObject()) {
+        if (value.HasMember("data")) {
+            // Data may contain zero bytes
+            inline_ = true;
+            CHECK_TYPE(value["data"], String);
+            data_.assign(value["data"].GetString(), value["data"].GetStringLength());
+        } else {
+            GET_MEMBER(capture_limit_, value, "capture", Int64);
+        }
     } else {
         CHECK_TYPE(value, String);
         GET(filename_, value, String);
@@ -424,6 +679,18 @@ void Task::deserialize_request(const rapidjson::Value &value) {
     GET_MEMBER(max_threads_, value, "max_threads", Int);
     GET_MEMBER(need_ipc_, value, "need_ipc", Bool);
     GET_MEMBER(use_standard_binds_, value, "use_standard_binds", Bool);
+    if (value.HasMember("collect_timings")) {
+        GET_MEMBER(collect_timings_, value, "collect_timings", Bool);
+    }
+    if (value.HasMember("collect_counters")) {
+        GET_MEMBER(collect_counters_, value, "collect_counters", Bool);
+    }
+    if (value.HasMember("instruction_limit")) {
+        GET_MEMBER(instruction_limit_, value, "instruction_limit", Int64);
+    }
+    if (value.HasMember("telemetry_interval_ms")) {
+        GET_MEMBER(telemetry_interval_ms_, value, "telemetry_interval_ms", Int64);
+    }
     CHECK_MEMBER(value, "stdin");
     stdin_.deserialize_request(value["stdin"]);
     CHECK_MEMBER(value, "stdout");
@@ -481,6 +748,53 @@ Error Task::deserialize_response(const rapidjson::Value &value) {
     GET_MEMBER(term_signal_, value, "term_signal", Int);
     GET_MEMBER(oom_killed_, value, "oom_killed", Bool);
     GET_MEMBER(memory_limit_hit_, value, "memory_limit_hit", Bool);
+    if (value.HasMember("oom_time_ms")) {
+        GET_MEMBER(oom_time_ms_, value, "oom_time_ms", Int64);
+        GET_MEMBER(oom_memory_usage_kb_, value, "oom_memory_usage_kb", Int64);
+    }
+    if (value.HasMember("instruction_limit_exceeded")) {
+        GET_MEMBER(instruction_limit_exceeded_, value, "instruction_limit_exceeded", Bool);
+    }
+    if (value.HasMember("stdout_data")) {
+        CHECK_TYPE(value["stdout_data"], String);
+        stdout_.data_.assign(value["stdout_data"].GetString(), value["stdout_data"].GetStringLength());
+        GET_MEMBER(stdout_.truncated_, value, "stdout_truncated", Bool);
+    }
+    if (value.HasMember("stderr_data")) {
+        CHECK_TYPE(value["stderr_data"], String);
+        stderr_.data_.assign(value["stderr_data"].GetString(), value["stderr_data"].GetStringLength());
+        GET_MEMBER(stderr_.truncated_, value, "stderr_truncated", Bool);
+    }
+    if (value.HasMember("instructions")) {
+        GET_MEMBER(instructions_, value, "instructions", Int64);
+        GET_MEMBER(cycles_, value, "cycles", Int64);
+        GET_MEMBER(cache_misses_, value, "cache_misses", Int64);
+        GET_MEMBER(context_switches_, value, "context_switches", Int64);
+    }
+    timings_ns_.clear();
+    if (value.HasMember("timings")) {
+        CHECK_TYPE(value["timings"], Array);
+        for (size_t i = 0; i < value["timings"].Size(); ++i) {
+            const auto &timing = value["timings"][i];
+            CHECK_TYPE(timing, Object);
+            std::string stage;
+            int64_t ns;
+            GET_MEMBER(stage, timing, "stage", String);
+            GET_MEMBER(ns, timing, "ns", Int64);
+            timings_ns_[stage] = ns;
+        }
+    }
+    return Error();
+}
+
+template<>
+Error TelemetrySample::deserialize(const rapidjson::Value &value) {
+    CHECK_TYPE(value, Object);
+    GET_MEMBER(wall_time_ms, value, "wall_time_ms", Int64);
+    GET_MEMBER(time_usage_ms, value, "time_usage_ms", Int64);
+    GET_MEMBER(memory_usage_kb, value, "memory_usage_kb", Int64);
+    GET_MEMBER(pids, value, "pids", Int64);
+    GET_MEMBER(stdout_bytes, value, "stdout_bytes", Int64);
     return Error();
 }
 
@@ -490,10 +804,215 @@ Error Task::deserialize_response(const rapidjson::Value &value) {
 #undef GET
 #undef GET_MEMBER
 
-Error libsbox::run_together(const std::vector<Task *> &tasks, const std::string &socket_path) {
+template<>
+void BindRule::serialize_request(BinaryWriter &writer) const {
+    writer.write_string(inside_);
+    writer.write_string(outside_);
+    writer.write_int32(flags_);
+}
+
+template<>
+void Stream::serialize_request(BinaryWriter &writer) const {
+    writer.write_string(filename_);
+    writer.write_bool(inline_);
+    if (inline_) {
+        writer.write_string(data_);
+    }
+    writer.write_int64(capture_limit_);
+}
+
+template<>
+void Task::serialize_request(BinaryWriter &writer) const {
+    writer.write_int64(time_limit_ms_);
+    writer.write_int64(wall_time_limit_ms_);
+    writer.write_int64(memory_limit_kb_);
+    writer.write_int64(fsize_limit_kb_);
+    writer.write_int32(max_files_);
+    writer.write_int32(max_threads_);
+    writer.write_bool(need_ipc_);
+    writer.write_bool(use_standard_binds_);
+    writer.write_bool(collect_timings_);
+    writer.write_bool(collect_counters_);
+    writer.write_int64(instruction_limit_);
+    writer.write_int64(telemetry_interval_ms_);
+    stdin_.serialize_request(writer);
+    stdout_.serialize_request(writer);
+    stderr_.serialize_request(writer);
+    writer.write_uint32(static_cast<uint32_t>(argv_.size()));
+    for (const auto &arg : argv_) {
+        writer.write_string(arg);
+    }
+    writer.write_uint32(static_cast<uint32_t>(env_.size()));
+    for (const auto &var : env_) {
+        writer.write_string(var);
+    }
+    writer.write_uint32(static_cast<uint32_t>(binds_.size()));
+    for (const auto &bind : binds_) {
+        bind.serialize_request(writer);
+    }
+}
+
+template<>
+void Task::serialize_response(BinaryWriter &writer) const {
+    writer.write_int64(time_usage_ms_);
+    writer.write_int64(time_usage_sys_ms_);
+    writer.write_int64(time_usage_user_ms_);
+    writer.write_int64(wall_time_usage_ms_);
+    writer.write_int64(memory_usage_kb_);
+    writer.write_bool(time_limit_exceeded_);
+    writer.write_bool(wall_time_limit_exceeded_);
+    writer.write_bool(exited_);
+    writer.write_int32(exit_code_);
+    writer.write_bool(signaled_);
+    writer.write_int32(term_signal_);
+    writer.write_bool(oom_killed_);
+    writer.write_bool(memory_limit_hit_);
+    writer.write_int64(oom_time_ms_);
+    writer.write_int64(oom_memory_usage_kb_);
+    writer.write_bool(instruction_limit_exceeded_);
+    writer.write_string(stdout_.data_);
+    writer.write_bool(stdout_.truncated_);
+    writer.write_string(stderr_.data_);
+    writer.write_bool(stderr_.truncated_);
+    writer.write_int64(instructions_);
+    writer.write_int64(cycles_);
+    writer.write_int64(cache_misses_);
+    writer.write_int64(context_switches_);
+    writer.write_uint32(static_cast<uint32_t>(timings_ns_.size()));
+    for (const auto &timing : timings_ns_) {
+        writer.write_string(timing.first);
+        writer.write_int64(timing.second);
+    }
+}
+
+template<>
+void TelemetrySample::serialize(BinaryWriter &writer) const {
+    writer.write_int64(wall_time_ms);
+    writer.write_int64(time_usage_ms);
+    writer.write_int64(memory_usage_kb);
+    writer.write_int64(pids);
+    writer.write_int64(stdout_bytes);
+}
+
+// Binary readers don't fail in the middle, caller checks BinaryReader::failed() after reading everything
+
+template<>
+BindRule::BindRule(const BinaryReader &reader) {
+    inside_ = reader.read_string();
+    outside_ = reader.read_string();
+    flags_ = reader.read_int32();
+}
+
+template<>
+void Stream::deserialize_request(const BinaryReader &reader) {
+    reset();
+    filename_ = reader.read_string();
+    inline_ = reader.read_bool();
+    if (inline_) {
+        data_ = reader.read_string();
+    }
+    capture_limit_ = reader.read_int64();
+}
+
+template<>
+void Task::deserialize_request(const BinaryReader &reader) {
+    time_limit_ms_ = reader.read_int64();
+    wall_time_limit_ms_ = reader.read_int64();
+    memory_limit_kb_ = reader.read_int64();
+    fsize_limit_kb_ = reader.read_int64();
+    max_files_ = reader.read_int32();
+    max_threads_ = reader.read_int32();
+    need_ipc_ = reader.read_bool();
+    use_standard_binds_ = reader.read_bool();
+    collect_timings_ = reader.read_bool();
+    collect_counters_ = reader.read_bool();
+    instruction_limit_ = reader.read_int64();
+    telemetry_interval_ms_ = reader.read_int64();
+    stdin_.deserialize_request(reader);
+    stdout_.deserialize_request(reader);
+    stderr_.deserialize_request(reader);
+    // Counts are checked against reader state, so corrupted count can't make us allocate a lot
+    argv_.clear();
+    for (uint32_t i = reader.read_uint32(); i > 0 && !reader.failed(); --i) {
+        argv_.push_back(reader.read_string());
+    }
+    env_.clear();
+    for (uint32_t i = reader.read_uint32(); i > 0 && !reader.failed(); --i) {
+        env_.push_back(reader.read_string());
+    }
+    binds_.clear();
+    for (uint32_t i = reader.read_uint32(); i > 0 && !reader.failed(); --i) {
+        binds_.push_back(BindRule(reader));
+    }
+}
+
+template<>
+Error Task::deserialize_response(const BinaryReader &reader) {
+    time_usage_ms_ = reader.read_int64();
+    time_usage_sys_ms_ = reader.read_int64();
+    time_usage_user_ms_ = reader.read_int64();
+    wall_time_usage_ms_ = reader.read_int64();
+    memory_usage_kb_ = reader.read_int64();
+    time_limit_exceeded_ = reader.read_bool();
+    wall_time_limit_exceeded_ = reader.read_bool();
+    exited_ = reader.read_bool();
+    exit_code_ = reader.read_int32();
+    signaled_ = reader.read_bool();
+    term_signal_ = reader.read_int32();
+    oom_killed_ = reader.read_bool();
+    memory_limit_hit_ = reader.read_bool();
+    oom_time_ms_ = reader.read_int64();
+    oom_memory_usage_kb_ = reader.read_int64();
+    instruction_limit_exceeded_ = reader.read_bool();
+    stdout_.data_ = reader.read_string();
+    stdout_.truncated_ = reader.read_bool();
+    stderr_.data_ = reader.read_string();
+    stderr_.truncated_ = reader.read_bool();
+    instructions_ = reader.read_int64();
+    cycles_ = reader.read_int64();
+    cache_misses_ = reader.read_int64();
+    context_switches_ = reader.read_int64();
+    timings_ns_.clear();
+    for (uint32_t i = reader.read_uint32(); i > 0 && !reader.failed(); --i) {
+        std::string stage = reader.read_string();
+        timings_ns_[stage] = reader.read_int64();
+    }
+    if (reader.failed()) {
+        return Error("Binary response is incorrect");
+    }
+    return Error();
+}
+
+template<>
+Error TelemetrySample::deserialize(const BinaryReader &reader) {
+    wall_time_ms = reader.read_int64();
+    time_usage_ms = reader.read_int64();
+    memory_usage_kb = reader.read_int64();
+    pids = reader.read_int64();
+    stdout_bytes = reader.read_int64();
+    if (reader.failed()) {
+        return Error("Binary telemetry sample is incorrect");
+    }
+    return Error();
+}
+
+namespace {
+std::string serialize_tasks_request(const std::vector<Task *> &tasks, bool binary, int32_t priority) {
+    if (binary) {
+        BinaryWriter writer;
+        writer.write_int32(priority);
+        writer.write_uint32(static_cast<uint32_t>(tasks.size()));
+        for (auto task : tasks) {
+            task->serialize_request(writer);
+        }
+        return writer.get();
+    }
+
     rapidjson::StringBuffer buffer;
     rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
     writer.StartObject();
+    writer.Key("priority");
+    writer.Int(priority);
     writer.Key("tasks");
     writer.StartArray();
     for (auto task : tasks) {
@@ -501,42 +1020,41 @@ Error libsbox::run_together(const std::vector<Task *> &tasks, const std::string
     }
     writer.EndArray();
     writer.EndObject();
+    return std::string(buffer.GetString(), buffer.GetSize());
+}
 
-    std::string message = buffer.GetString();
-
-    fd_t socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (socket_fd < 0) {
-        return Error(format("Cannot create socket: %m"));
+Error deserialize_binary_tasks_response(const std::string &response, const std::vector<Task *> &tasks) {
+    BinaryReader reader(response.data(), response.size());
+    // Binary response is either error (status 1 and message) or results (status 0, count and tasks)
+    uint32_t status = reader.read_uint32();
+    if (status != 0) {
+        std::string error = reader.read_string();
+        if (reader.failed()) {
+            return Error("Binary response is incorrect");
+        }
+        return Error(format("[remote] %s", error.c_str()));
     }
 
-    std::shared_ptr<fd_t> ptr(&socket_fd, [](const fd_t *fd) { close(*fd); });
-
-    sockaddr_un addr{};
-    addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, socket_path.c_str(), std::min(sizeof(addr.sun_path) - 1, socket_path.size()));
+    if (reader.read_uint32() != tasks.size()) {
+        return Error("Response tasks count is not equal to requested tasks count");
+    }
 
-    int status = connect(socket_fd, reinterpret_cast<const struct sockaddr *>(&addr), sizeof(struct sockaddr_un));
-    if (status != 0) {
-        return Error(format("Cannot connect to socket: %m"));
+    for (auto task : tasks) {
+        auto error = task->deserialize_response(reader);
+        if (error) {
+            return error;
+        }
     }
 
-    int cnt = send(socket_fd, message.c_str(), message.size() + 1, 0);
-    if (cnt < 0 || static_cast<size_t>(cnt) != message.size() + 1) {
-        return Error(format("Cannot send request: %m"));
+    if (!reader.at_end()) {
+        return Error("Binary response is incorrect");
     }
+    return Error();
+}
 
-    std::string res;
-    char buf[1024];
-    while (true) {
-        cnt = recv(socket_fd, buf, 1023, 0);
-        if (cnt < 0) {
-            return Error(format("Cannot receive response: %m"));
-        }
-        if (cnt == 0) {
-            break;
-        }
-        buf[cnt] = 0;
-        res += buf;
+Error deserialize_tasks_response(const std::string &response, const std::vector<Task *> &tasks, bool binary) {
+    if (binary) {
+        return deserialize_binary_tasks_response(response, tasks);
     }
 
     static SchemaValidator response_validator(response_schema_data);
@@ -545,7 +1063,7 @@ Error libsbox::run_together(const std::vector<Task *> &tasks, const std::string
     }
 
     rapidjson::Document document;
-    if (document.Parse(res.c_str()).HasParseError()) {
+    if (document.Parse(response.c_str()).HasParseError()) {
         return Error(
             format(
                 "Cannot parse response (offset %zi): %s",
@@ -576,3 +1094,504 @@ Error libsbox::run_together(const std::vector<Task *> &tasks, const std::string
 
     return Error();
 }
+} // namespace
+
+Session::~Session() {
+    disconnect();
+}
+
+Error Session::connect(const std::string &socket_path, Mode mode) {
+    if (is_connected()) {
+        return Error("Session is already connected");
+    }
+
+    socket_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket_fd_ < 0) {
+        return Error(format("Cannot create socket: %m"));
+    }
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), std::min(sizeof(addr.sun_path) - 1, socket_path.size()));
+
+    int status = ::connect(socket_fd_, reinterpret_cast<const struct sockaddr *>(&addr), sizeof(struct sockaddr_un));
+    if (status != 0) {
+        return fail(Error(format("Cannot connect to socket: %m")));
+    }
+
+    uint32_t hello_flags = 0;
+    if (mode != Mode::JSON) {
+        hello_flags |= protocol::FLAG_BINARY_V1;
+    }
+    if (mode == Mode::SHARED_MEMORY) {
+        hello_flags |= protocol::FLAG_SHM_RING_V1;
+    }
+    protocol::Hello hello = protocol::make_hello(hello_flags);
+    if (protocol::write_full(socket_fd_, &hello, sizeof(hello)) < 0) {
+        return fail(Error(format("Cannot send hello: %m")));
+    }
+
+    fd_t ring_fd;
+    ssize_t cnt = protocol::read_full_with_fd(socket_fd_, &hello, sizeof(hello), ring_fd);
+    if (cnt <= 0 || !protocol::is_valid_hello(hello)) {
+        if (ring_fd >= 0) {
+            close(ring_fd);
+        }
+        return fail(Error(cnt < 0 ? format("Cannot receive hello: %m") : "Daemon does not support sessions"));
+    }
+
+    mode_ = Mode::JSON;
+    if (hello.flags & protocol::FLAG_BINARY_V1) {
+        mode_ = Mode::BINARY;
+    }
+    if (hello.flags & protocol::FLAG_SHM_RING_V1) {
+        if (ring_fd < 0) {
+            return fail(Error("Daemon did not pass shared memory ring"));
+        }
+        void *ptr = mmap(nullptr, sizeof(shm_ring::Region), PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+        if (ptr == MAP_FAILED) {
+            Error error(format("Cannot map shared memory ring: %m"));
+            close(ring_fd);
+            return fail(error);
+        }
+        ring_ = ptr;
+        if (!shm_ring::is_valid(static_cast<shm_ring::Region *>(ring_))) {
+            close(ring_fd);
+            return fail(Error("Shared memory ring is incorrect"));
+        }
+        for (uint32_t i = shm_ring::SLOT_COUNT; i > 0; --i) {
+            free_slots_.push_back(i - 1);
+        }
+        mode_ = Mode::SHARED_MEMORY;
+    }
+    if (ring_fd >= 0) {
+        close(ring_fd);
+    }
+
+    // Handshake is done, from now on nothing blocks
+    int flags = fcntl(socket_fd_, F_GETFL);
+    if (flags < 0 || fcntl(socket_fd_, F_SETFL, flags | O_NONBLOCK) != 0) {
+        return fail(Error(format("Cannot make socket non-blocking: %m")));
+    }
+
+    return Error();
+}
+
+void Session::disconnect() {
+    fail(Error("Session is disconnected"));
+}
+
+bool Session::is_connected() const {
+    return socket_fd_ >= 0;
+}
+
+Session::Mode Session::get_mode() const {
+    return mode_;
+}
+
+int32_t Session::get_priority() const {
+    return priority_;
+}
+
+void Session::set_priority(int32_t priority) {
+    priority_ = priority;
+}
+
+Error Session::run_together(const std::vector<Task *> &tasks) {
+    bool done = false;
+    Error result;
+    auto error = submit(tasks, [&done, &result](const Error &request_error) {
+        done = true;
+        result = request_error;
+    });
+    if (error) {
+        return error;
+    }
+
+    while (!done) {
+        error = wait_one();
+        if (error && !done) {
+            return error;
+        }
+    }
+    return result;
+}
+
+Error Session::submit(const std::vector<Task *> &tasks, Callback callback) {
+    if (!is_connected()) {
+        return Error("Session is not connected");
+    }
+
+    uint64_t request_id = next_request_id_++;
+    if (submit_to_ring(request_id, tasks)) {
+        protocol::append_frame(out_buffer_, request_id, protocol::FRAME_RING_SUBMIT, "");
+    } else {
+        std::string request = serialize_tasks_request(tasks, mode_ != Mode::JSON, priority_);
+        protocol::append_frame(out_buffer_, request_id, protocol::FRAME_REQUEST, request);
+    }
+    pending_[request_id] = {tasks, std::move(callback)};
+
+    // Start sending right away. If it fails, callback is already called with error
+    flush();
+    return Error();
+}
+
+std::future<Error> Session::submit(const std::vector<Task *> &tasks) {
+    auto promise = std::make_shared<std::promise<Error>>();
+    auto future = promise->get_future();
+    auto error = submit(tasks, [promise](const Error &request_error) {
+        promise->set_value(request_error);
+    });
+    if (error) {
+        promise->set_value(error);
+    }
+    return future;
+}
+
+fd_t Session::get_fd() const {
+    return socket_fd_;
+}
+
+bool Session::wants_write() const {
+    return out_offset_ < out_buffer_.size();
+}
+
+size_t Session::get_pending_count() const {
+    return pending_.size();
+}
+
+Error Session::process_events() {
+    if (!is_connected()) {
+        return Error("Session is not connected");
+    }
+
+    auto error = flush();
+    if (error) {
+        return error;
+    }
+    return receive();
+}
+
+Error Session::wait_one() {
+    uint64_t completed = completed_;
+    while (completed_ == completed && !pending_.empty()) {
+        if (!is_connected()) {
+            return Error("Session is not connected");
+        }
+
+        pollfd pfd{};
+        pfd.fd = socket_fd_;
+        pfd.events = static_cast<short>(POLLIN | (wants_write() ? POLLOUT : 0));
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return Error(format("poll() failed: %m"));
+        }
+
+        auto error = process_events();
+        if (error) {
+            return error;
+        }
+    }
+    return Error();
+}
+
+Error Session::fail(const Error &error) {
+    if (socket_fd_ >= 0) {
+        close(socket_fd_);
+        socket_fd_ = -1;
+    }
+    out_buffer_.clear();
+    out_offset_ = 0;
+    in_buffer_.clear();
+    if (ring_ != nullptr) {
+        munmap(ring_, sizeof(shm_ring::Region));
+        ring_ = nullptr;
+    }
+    free_slots_.clear();
+
+    // Callbacks may submit new requests, which fail immediately because session is not connected
+    auto pending = std::move(pending_);
+    pending_.clear();
+    for (auto &entry : pending) {
+        ++completed_;
+        entry.second.callback(error);
+    }
+    return error;
+}
+
+Error Session::flush() {
+    while (out_offset_ < out_buffer_.size()) {
+        ssize_t cnt = send(
+            socket_fd_,
+            out_buffer_.data() + out_offset_,
+            out_buffer_.size() - out_offset_,
+            MSG_NOSIGNAL | MSG_DONTWAIT
+        );
+        if (cnt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                return Error();
+            }
+            return fail(Error(format("Cannot send request: %m")));
+        }
+        out_offset_ += static_cast<size_t>(cnt);
+    }
+    out_buffer_.clear();
+    out_offset_ = 0;
+    return Error();
+}
+
+Error Session::receive() {
+    while (true) {
+        char buf[65536];
+        ssize_t cnt = recv(socket_fd_, buf, sizeof(buf), MSG_DONTWAIT);
+        if (cnt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                break;
+            }
+            return fail(Error(format("Cannot receive response: %m")));
+        }
+        if (cnt == 0) {
+            return fail(Error("Connection closed by daemon"));
+        }
+        in_buffer_.append(buf, static_cast<size_t>(cnt));
+    }
+
+    // Frame is removed from buffer before it is handled, so callbacks may process events of session themselves
+    while (in_buffer_.size() >= sizeof(protocol::FrameHeader)) {
+        protocol::FrameHeader header{};
+        memcpy(&header, in_buffer_.data(), sizeof(header));
+        if (header.type == protocol::FRAME_RING_COMPLETE && header.length == 0 && ring_ != nullptr) {
+            in_buffer_.erase(0, sizeof(header));
+            auto error = complete_from_ring();
+            if (error || !is_connected()) {
+                return error;
+            }
+            continue;
+        }
+        if ((header.type != protocol::FRAME_RESPONSE && header.type != protocol::FRAME_TELEMETRY) ||
+            header.length > protocol::MAX_FRAME_SIZE) {
+            return fail(Error("Unexpected frame received"));
+        }
+        if (in_buffer_.size() - sizeof(header) < header.length) {
+            break;
+        }
+        std::string payload = in_buffer_.substr(sizeof(header), header.length);
+        in_buffer_.erase(0, sizeof(header) + header.length);
+
+        if (header.type == protocol::FRAME_TELEMETRY) {
+            auto error = handle_sample(header.request_id, payload);
+            if (error || !is_connected()) {
+                return error;
+            }
+            continue;
+        }
+
+        auto it = pending_.find(header.request_id);
+        if (it == pending_.end()) {
+            return fail(Error("Response to unknown request received"));
+        }
+        PendingRequest request = std::move(it->second);
+        pending_.erase(it);
+
+        ++completed_;
+        request.callback(deserialize_tasks_response(payload, request.tasks, mode_ != Mode::JSON));
+        if (!is_connected()) {
+            // Callback disconnected session
+            return Error();
+        }
+    }
+
+    return Error();
+}
+
+Error Session::handle_sample(uint64_t request_id, const std::string &payload) {
+    auto it = pending_.find(request_id);
+    if (it == pending_.end()) {
+        return fail(Error("Telemetry of unknown request received"));
+    }
+
+    uint32_t index;
+    TelemetrySample sample;
+    if (mode_ != Mode::JSON) {
+        BinaryReader reader(payload.data(), payload.size());
+        index = reader.read_uint32();
+        auto error = sample.deserialize(reader);
+        if (error || !reader.at_end()) {
+            return fail(Error("Telemetry frame is incorrect"));
+        }
+    } else {
+        rapidjson::Document document;
+        if (document.Parse(payload.c_str()).HasParseError() || !document.IsObject() || !document.HasMember("task") ||
+            !document["task"].IsUint() || !document.HasMember("sample") || sample.deserialize(document["sample"])) {
+            return fail(Error("Telemetry frame is incorrect"));
+        }
+        index = document["task"].GetUint();
+    }
+    if (index >= it->second.tasks.size()) {
+        return fail(Error("Telemetry frame is incorrect"));
+    }
+
+    const auto &callback = it->second.tasks[index]->get_telemetry_callback();
+    if (callback) {
+        callback(sample);
+    }
+    return Error();
+}
+
+bool Session::submit_to_ring(uint64_t request_id, const std::vector<Task *> &tasks) {
+    if (ring_ == nullptr || free_slots_.empty()) {
+        return false;
+    }
+
+    auto *region = static_cast<shm_ring::Region *>(ring_);
+    uint32_t index = free_slots_.back();
+    if (!shm_ring::write_request(region->slots[index], request_id, priority_, tasks)) {
+        return false;
+    }
+    // Every slot is either free or in exactly one of rings, so ring can't overflow
+    region->submit.push(index);
+    free_slots_.pop_back();
+    return true;
+}
+
+Error Session::complete_from_ring() {
+    auto *region = static_cast<shm_ring::Region *>(ring_);
+    uint32_t index;
+    while (region->complete.is_consistent() && region->complete.pop(index)) {
+        if (index >= shm_ring::SLOT_COUNT) {
+            return fail(Error("Shared memory ring is corrupted"));
+        }
+
+        const shm_ring::Slot &slot = region->slots[index];
+        auto it = pending_.find(slot.request_id);
+        if (it == pending_.end()) {
+            return fail(Error("Response to unknown request received"));
+        }
+        PendingRequest request = std::move(it->second);
+        pending_.erase(it);
+
+        auto error = shm_ring::read_results(slot, request.tasks);
+        free_slots_.push_back(index);
+
+        ++completed_;
+        request.callback(error);
+        if (!is_connected()) {
+            // Callback disconnected session
+            return Error();
+        }
+    }
+
+    if (!region->complete.is_consistent()) {
+        return fail(Error("Shared memory ring is corrupted"));
+    }
+    return Error();
+}
+
+Error libsbox::run_together(const std::vector<Task *> &tasks, const std::string &socket_path) {
+    Session session;
+    auto error = session.connect(socket_path);
+    if (error) {
+        return error;
+    }
+    return session.run_together(tasks);
+}
+
+Error libsbox::get_stats(std::vector<StageLatency> &stages, const std::string &socket_path) {
+    PoolStats pool{};
+    return get_stats(stages, pool, socket_path);
+}
+
+Error libsbox::get_stats(std::vector<StageLatency> &stages, PoolStats &pool, const std::string &socket_path) {
+    // Stats query uses one-shot JSON protocol: single null-terminated request, response is read until end-of-file
+    fd_t socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket_fd < 0) {
+        return Error(format("Cannot create socket: %m"));
+    }
+    std::shared_ptr<fd_t> ptr(&socket_fd, [](const fd_t *fd) { close(*fd); });
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), std::min(sizeof(addr.sun_path) - 1, socket_path.size()));
+    if (::connect(socket_fd, reinterpret_cast<const struct sockaddr *>(&addr), sizeof(struct sockaddr_un)) != 0) {
+        return Error(format("Cannot connect to socket: %m"));
+    }
+
+    const char request[] = "{\"query\":\"stats\"}";
+    if (protocol::write_full(socket_fd, request, sizeof(request)) < 0) {
+        return Error(format("Cannot send request: %m"));
+    }
+
+    std::string response;
+    char buf[4096];
+    while (true) {
+        ssize_t cnt = recv(socket_fd, buf, sizeof(buf), 0);
+        if (cnt < 0) {
+            return Error(format("Cannot receive response: %m"));
+        }
+        if (cnt == 0) {
+            break;
+        }
+        response.append(buf, static_cast<size_t>(cnt));
+    }
+
+    rapidjson::Document document;
+    if (document.Parse(response.c_str()).HasParseError()) {
+        return Error(
+            format(
+                "Cannot parse response (offset %zi): %s",
+                document.GetErrorOffset(),
+                rapidjson::GetParseError_En(document.GetParseError())
+            )
+        );
+    }
+    if (!document.IsObject()) {
+        return Error("Stats response is incorrect");
+    }
+    if (document.HasMember("error") && document["error"].IsString()) {
+        return Error(format("[remote] %s", document["error"].GetString()));
+    }
+    if (!document.HasMember("stages") || !document["stages"].IsArray()) {
+        return Error("Stats response is incorrect");
+    }
+
+    stages.clear();
+    for (size_t i = 0; i < document["stages"].Size(); ++i) {
+        const auto &value = document["stages"][i];
+        if (!value.IsObject() || !value.HasMember("stage") || !value["stage"].IsString() ||
+            !value.HasMember("count") || !value["count"].IsUint64()) {
+            return Error("Stats response is incorrect");
+        }
+        StageLatency stage{};
+        stage.stage = value["stage"].GetString();
+        stage.count = value["count"].GetUint64();
+        for (auto field : {std::make_pair("p50_ns", &stage.p50_ns), std::make_pair("p99_ns", &stage.p99_ns),
+                           std::make_pair("p999_ns", &stage.p999_ns), std::make_pair("max_ns", &stage.max_ns)}) {
+            if (!value.HasMember(field.first) || !value[field.first].IsInt64()) {
+                return Error("Stats response is incorrect");
+            }
+            *field.second = value[field.first].GetInt64();
+        }
+        stages.push_back(stage);
+    }
+
+    if (!document.HasMember("pool") || !document["pool"].IsObject()) {
+        return Error("Stats response is incorrect");
+    }
+    const auto &value = document["pool"];
+    if (!value.HasMember("hits") || !value["hits"].IsUint64() || !value.HasMember("misses") ||
+        !value["misses"].IsUint64()) {
+        return Error("Stats response is incorrect");
+    }
+    pool.hits = value["hits"].GetUint64();
+    pool.misses = value["misses"].GetUint64();
+
+    return Error();
+}
@@ -47,10 +47,15 @@
  *
  * Daemon process is systemd service itself, which creates unix-socket and spawn certain amount of worker processes
  * (number may be changed in config).
- * Worker process accepts connections on unix-socket, receives query and after processing sends response and closes
- * connection. It creates pipes and prepares containers' structures, which lie in memory, shared between worker and
- * containers. Worker and container processes share file descriptor table, so pipes, created in worker process are also
- * visible in container processes.
+ * Daemon also serves all connections on unix-socket from single event loop (see dispatcher.h): it receives and parses
+ * requests, splits them into jobs (tasks connected with pipes form one job, every other task is a job of its own),
+ * queues jobs by priority and hands each one to the first idle worker through worker's SOCK_SEQPACKET channel, then
+ * merges results of all jobs and sends them back to client. Legacy clients send one query and get response, after
+ * which connection is closed. Clients opening session (see protocol.h) keep connection and may have any number of
+ * queries in flight.
+ * Worker process runs one job at a time. It creates pipes and prepares containers' structures, which lie in memory,
+ * shared between worker and containers. Worker and container processes share file descriptor table, so pipes, created
+ * in worker process are also visible in container processes.
  * Container process run in namespaces, so if any error occurs, to cleanup container need to just exit and namespaces
  * will do the rest.
  * Slave process in spawned by container and after some preparations executes target executable.
@@ -60,11 +65,11 @@
  * +-----------------------------------+-----------------------------------+--------------------------------------+
  * |               Worker              |             Containers            |                Slaves                |
  * +-----------------------------------+-----------------------------------+--------------------------------------+
- * | Get request                       |                                   |                                      |
+ * | Get job from daemon's queue       |                                   |                                      |
  * +-----------------------------------+-----------------------------------+                                      |
- * | Ensure that we have enough        | Actions on container creation:    |                                      |
- * | containers. If not, spawn as many |  - create container process in    |                                      |
- * | as necessary                      | new namespaces using clone()      |                                      |
+ * | Take idle containers with needed  | Actions on container creation:    |                                      |
+ * | profile from pool. On miss, spawn |  - create container process in    |                                      |
+ * | as many as necessary              | new namespaces using clone()      |                                      |
  * |                                   |  - prepare working directory and  |                                      |
  * |                                   | create necessary mounts (working  |                                      |
  * |                                   | directory setup is shown below)   |                                      |
@@ -76,14 +81,14 @@
  * |      [synchronized] Container waits for worker to write task data     |                                      |
  * +-----------------------------------+-----------------------------------+                                      |
  * |                                   |  - Create run-specific mounts     |                                      |
- * |                                   |  - Create cgroups                 |                                      |
+ * |                                   |  - Set cgroup limits              |                                      |
  * |                                   +-----------------------------------+--------------------------------------+
- * |                                   | fork() into slave                 | Actions on slave process creation:   |
- * |                                   |                                   |  - open target executable            |
- * |                                   |                                   |  - chdir()                           |
+ * |                                   | clone3() slave directly into its  | Actions on slave process creation:   |
+ * |                                   | cgroup (on cgroup v2) and get     |  - open target executable            |
+ * |                                   | pidfd of slave                    |  - chdir()                           |
  * |                                   |                                   |                                      |
  * |                                   |                                   |  - prepare file descriptors          |
- * |                                   |                                   |  - enter cgroups                     |
+ * |                                   |                                   |  - enter cgroups (on cgroup v1)      |
  * |                                   |                                   |  - setup rlimits                     |
  * |                                   |                                   |  - chroot()                          |
  * |                                   |                                   |  - drop privileges                   |
@@ -92,24 +97,33 @@
  * |     [synchronized] Worker waits for ALL containers to start slave     |                                      |
  * +-----------------------------------+-----------------------------------+                                      |
  * | Close pipes                       | Wait for slave to exit and        |                                      |
- * |                                   | collect results                   |                                      |
+ * |                                   | collect results, send telemetry   |                                      |
+ * |                                   | samples to daemon (if requested)  |                                      |
  * +-----------------------------------+-----------------------------------+                                      |
- * |                                   |  - Destroy run-specific mount     |                                      |
- * |                                   |  - Destroy cgroups                |                                      |
+ * |                                   | Destroy run-specific mounts       |                                      |
  * +-----------------------------------+-----------------------------------+                                      |
  * |   [synchronized] Worker waits for ALL containers to collect results   |                                      |
  * +-----------------------------------+-----------------------------------+                                      |
- * | Send response                     |                                   |                                      |
+ * | Send results to daemon            |  - Cleanup working directory and  |                                      |
+ * |                                   | ipc                               |                                      |
+ * |                                   |  - Reset cgroups                  |                                      |
+ * +-----------------------------------+-----------------------------------+                                      |
+ * | Refill container pool             |                                   |                                      |
  * +-----------------------------------+-----------------------------------+--------------------------------------+
  *
- * When using libsboxd you must follow this protocol:
+ * When using libsboxd without session you must follow this protocol:
  * 1. Connect to socket
  * 2. Write JSON request to socket
  * 3. Wait for JSON response
  * 4. Close connection
+ * Request may have "priority" (higher is run first). If its jobs don't fit into queue of "queue_depth" jobs, request
+ * is rejected with error.
  *
  * You can find request example in request.json and response example in response.json
  *
+ * Every stage of the timeline above is timed (see stage.h). Per-stage latency histograms are kept in shared memory
+ * and returned for {"query": "stats"} request; tasks with "collect_timings" also get their own stage times in response.
+ *
  * IMPORTANT: what is said in the next paragraph is not yet implemented. Currently all errors lead to libsboxd shutdown TODO
  * There are two types of errors: evaluation errors and internal. While evaluations errors are reported just by
  * returning json object with only one field "error" (e.g. {"error": "Executable not found"}), second are critical and
@@ -136,7 +150,7 @@
 // CLOSED(#17@forestryks): consider using exceptions
 // CLOSED(#18@forestryks): use correct data types
 // TODO(#19@forestryks): update description + add dir setup
-// WONTFIX(#20@forestryks): ownership and reset in shared_barrier (may be fixed automatically after #15)
+// CLOSED(#20@forestryks): ownership and reset in shared_barrier (may be fixed automatically after #15)
 // WONTFIX(#21@forestryks): normal debug
 // CLOSED(#22@forestryks): never use exit(), use _exit()
 // CLOSED(#23@forestryks): restore default SIGCHLD in containers
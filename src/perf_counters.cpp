@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "perf_counters.h"
+#include "context_manager.h"
+#include "utils.h"
+
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+PerfCounters::~PerfCounters() {
+    close();
+}
+
+void PerfCounters::open(pid_t pid) {
+    const struct {
+        uint32_t type;
+        uint64_t config;
+    } events[COUNTER_COUNT] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    };
+
+    for (int i = 0; i < COUNTER_COUNT; ++i) {
+        perf_event_attr attr = {};
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.enable_on_exec = 1;
+        attr.inherit = 1;
+        // Context switches happen in kernel, so they can't be counted in user space only
+        if (events[i].type == PERF_TYPE_HARDWARE) {
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+        }
+        fds_[i] = static_cast<fd_t>(syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC));
+        if (fds_[i] < 0 && errno != ENOENT && errno != EOPNOTSUPP && errno != ENODEV) {
+            die(format("Cannot open performance counter: %m"));
+        }
+    }
+}
+
+int64_t PerfCounters::read(Counter counter) {
+    if (fds_[counter] < 0) {
+        return -1;
+    }
+    uint64_t value;
+    if (::read(fds_[counter], &value, sizeof(value)) != sizeof(value)) {
+        die(format("Cannot read performance counter: %m"));
+    }
+    return static_cast<int64_t>(value);
+}
+
+void PerfCounters::close() {
+    for (fd_t &fd : fds_) {
+        if (fd >= 0 && ::close(fd) != 0) {
+            die(format("Cannot close performance counter: %m"));
+        }
+        fd = -1;
+    }
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_PERF_COUNTERS_H
+#define LIBSBOX_PERF_COUNTERS_H
+
+#include "libsbox_internal.h"
+
+#include <sys/types.h>
+
+// Hardware and software perf_event counters of slave. Counters count only user-space events of slave's program, so
+// instruction count doesn't depend on what slave does before exec() or on kernel work done on its behalf
+class PerfCounters {
+public:
+    enum Counter {
+        INSTRUCTIONS,
+        CYCLES,
+        CACHE_MISSES,
+        CONTEXT_SWITCHES,
+        COUNTER_COUNT
+    };
+
+    PerfCounters() = default;
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    // Attach counters to process, which hasn't called exec() yet. Counting starts on exec() and includes threads and
+    // children of process. Counters not supported by hardware (e.g. in virtual machines) stay unavailable
+    void open(pid_t pid);
+    // Current value, -1 if counter is unavailable. Events of threads and children are added when they exit
+    int64_t read(Counter counter);
+    void close();
+private:
+    fd_t fds_[COUNTER_COUNT] = {-1, -1, -1, -1};
+};
+
+#endif //LIBSBOX_PERF_COUNTERS_H
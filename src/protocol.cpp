@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "protocol.h"
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+
+protocol::Hello protocol::make_hello(uint32_t flags) {
+    Hello hello{};
+    memcpy(hello.magic, MAGIC, sizeof(MAGIC));
+    hello.version = VERSION;
+    hello.flags = flags;
+    return hello;
+}
+
+bool protocol::is_valid_hello(const Hello &hello) {
+    return memcmp(hello.magic, MAGIC, sizeof(MAGIC)) == 0 && hello.version == VERSION;
+}
+
+ssize_t protocol::read_full(fd_t fd, void *buf, size_t size) {
+    char *ptr = static_cast<char *>(buf);
+    size_t done = 0;
+    while (done < size) {
+        ssize_t cnt = read(fd, ptr + done, size - done);
+        if (cnt < 0) {
+            return -1;
+        }
+        if (cnt == 0) {
+            if (done == 0) {
+                return 0;
+            }
+            errno = ECONNRESET;
+            return -1;
+        }
+        done += static_cast<size_t>(cnt);
+    }
+    return static_cast<ssize_t>(done);
+}
+
+ssize_t protocol::write_full(fd_t fd, const void *buf, size_t size) {
+    const char *ptr = static_cast<const char *>(buf);
+    size_t done = 0;
+    while (done < size) {
+        ssize_t cnt = send(fd, ptr + done, size - done, MSG_NOSIGNAL);
+        if (cnt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += static_cast<size_t>(cnt);
+    }
+    return static_cast<ssize_t>(done);
+}
+
+ssize_t protocol::write_full_with_fd(fd_t fd, const void *buf, size_t size, fd_t passed_fd) {
+    iovec iov{};
+    iov.iov_base = const_cast<void *>(buf);
+    iov.iov_len = size;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fd_t))]{};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fd_t));
+    memcpy(CMSG_DATA(cmsg), &passed_fd, sizeof(fd_t));
+
+    ssize_t cnt;
+    do {
+        cnt = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (cnt < 0 && errno == EINTR);
+    if (cnt < 0) {
+        return -1;
+    }
+
+    // File descriptor is attached to first byte, so the rest is ordinary data
+    size_t sent = static_cast<size_t>(cnt);
+    if (write_full(fd, static_cast<const char *>(buf) + sent, size - sent) < 0) {
+        return -1;
+    }
+    return static_cast<ssize_t>(size);
+}
+
+ssize_t protocol::read_full_with_fd(fd_t fd, void *buf, size_t size, fd_t &received_fd) {
+    received_fd = -1;
+
+    iovec iov{};
+    iov.iov_base = buf;
+    iov.iov_len = size;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fd_t))]{};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t cnt = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (cnt <= 0) {
+        return cnt;
+    }
+
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&received_fd, CMSG_DATA(cmsg), sizeof(fd_t));
+        }
+    }
+
+    size_t done = static_cast<size_t>(cnt);
+    if (done < size) {
+        ssize_t rest = read_full(fd, static_cast<char *>(buf) + done, size - done);
+        if (rest <= 0) {
+            int saved_errno = (rest == 0 ? ECONNRESET : errno);
+            if (received_fd >= 0) {
+                close(received_fd);
+                received_fd = -1;
+            }
+            errno = saved_errno;
+            return -1;
+        }
+    }
+    return static_cast<ssize_t>(size);
+}
+
+ssize_t protocol::read_packet(fd_t fd, std::string &packet) {
+    // With MSG_TRUNC real size of message is returned, even though nothing is read
+    ssize_t size = recv(fd, nullptr, 0, MSG_PEEK | MSG_TRUNC);
+    if (size <= 0) {
+        return size;
+    }
+    packet.resize(static_cast<size_t>(size));
+    return recv(fd, packet.data(), packet.size(), 0);
+}
+
+ssize_t protocol::write_frame(fd_t fd, uint64_t request_id, uint32_t type, const std::string &payload) {
+    if (payload.size() > MAX_FRAME_SIZE) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    FrameHeader header{};
+    header.request_id = request_id;
+    header.length = static_cast<uint32_t>(payload.size());
+    header.type = type;
+
+    // Header and payload are sent with single syscall, so small frames are not split into two packets
+    iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = const_cast<char *>(payload.data());
+    iov[1].iov_len = payload.size();
+
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    size_t total = sizeof(header) + payload.size();
+    ssize_t cnt;
+    do {
+        cnt = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (cnt < 0 && errno == EINTR);
+    if (cnt < 0) {
+        return -1;
+    }
+
+    size_t sent = static_cast<size_t>(cnt);
+    if (sent < sizeof(header)) {
+        if (write_full(fd, reinterpret_cast<const char *>(&header) + sent, sizeof(header) - sent) < 0) {
+            return -1;
+        }
+        sent = sizeof(header);
+    }
+    if (write_full(fd, payload.data() + (sent - sizeof(header)), total - sent) < 0) {
+        return -1;
+    }
+    return static_cast<ssize_t>(total);
+}
+
+void protocol::append_frame(std::string &buffer, uint64_t request_id, uint32_t type, const std::string &payload) {
+    FrameHeader header{};
+    header.request_id = request_id;
+    header.length = static_cast<uint32_t>(payload.size());
+    header.type = type;
+
+    buffer.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    buffer.append(payload);
+}
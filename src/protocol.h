@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_PROTOCOL_H
+#define LIBSBOX_PROTOCOL_H
+
+#include "libsbox_internal.h"
+
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Session protocol. Legacy clients send single null-terminated JSON request and read response until end-of-file.
+// Session clients start connection with Hello (its first byte never occurs at the start of JSON text), server
+// answers with its own Hello, after which both sides exchange frames: FrameHeader followed by length bytes of
+// payload. Responses carry request_id of request they answer, so one connection can carry any number of requests.
+// Requests of one connection may complete in any order. Daemon talks to its workers with the same frames, one frame
+// per SOCK_SEQPACKET message, always in binary encoding.
+namespace protocol {
+
+static const char MAGIC[4] = {'\x7f', 'S', 'B', 'X'};
+static const uint32_t VERSION = 6;
+static const uint32_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+
+// Hello flags. Client sets flags it wants, server answers with subset it agrees to
+// Frame payloads use BinaryWriter encoding instead of JSON. Request is priority (int32), tasks count and tasks,
+// response is status (0 is followed by tasks count and tasks, 1 by error message)
+static const uint32_t FLAG_BINARY_V1 = 1;
+// Requests and results go through shared memory ring (see shm_ring.h), server hello carries memfd of ring
+static const uint32_t FLAG_SHM_RING_V1 = 2;
+static const uint32_t SUPPORTED_FLAGS = FLAG_BINARY_V1 | FLAG_SHM_RING_V1;
+
+struct Hello {
+    char magic[4];
+    uint32_t version;
+    uint32_t flags;
+};
+
+enum FrameType : uint32_t {
+    FRAME_REQUEST = 1,
+    FRAME_RESPONSE = 2,
+    // Header-only doorbells of shared memory ring: client submitted slots, worker completed slots
+    FRAME_RING_SUBMIT = 3,
+    FRAME_RING_COMPLETE = 4,
+    // Sample of resource usage of running task, sent before response of its request. Payload is index of task in
+    // request and libsbox::TelemetrySample, in JSON {"task": index, "sample": {...}}. Workers send these with job id
+    // and index of task in job
+    FRAME_TELEMETRY = 5,
+};
+
+struct FrameHeader {
+    uint64_t request_id;
+    uint32_t length;
+    uint32_t type;
+};
+
+static_assert(sizeof(Hello) == 12);
+static_assert(sizeof(FrameHeader) == 16);
+
+Hello make_hello(uint32_t flags);
+bool is_valid_hello(const Hello &hello);
+
+// Read exactly size bytes. Returns size on success, 0 if end-of-file occurs before first byte and -1 on error (errno
+// is set, ECONNRESET for end-of-file in the middle). Interrupted reads are not restarted
+ssize_t read_full(fd_t fd, void *buf, size_t size);
+
+// Write exactly size bytes to socket. Returns size on success and -1 on error. Interrupted writes are restarted, and
+// closed peer is reported as EPIPE instead of SIGPIPE
+ssize_t write_full(fd_t fd, const void *buf, size_t size);
+
+// Same as write_full, but also passes file descriptor with data (SCM_RIGHTS)
+ssize_t write_full_with_fd(fd_t fd, const void *buf, size_t size, fd_t passed_fd);
+
+// Same as read_full, but also receives file descriptor passed with data. received_fd is -1 if nothing is passed
+ssize_t read_full_with_fd(fd_t fd, void *buf, size_t size, fd_t &received_fd);
+
+// Read single message from SOCK_SEQPACKET socket, whatever its size. Returns size of message, 0 on end-of-file and -1
+// on error. Interrupted reads are not restarted
+ssize_t read_packet(fd_t fd, std::string &packet);
+
+// Write frame header and payload
+ssize_t write_frame(fd_t fd, uint64_t request_id, uint32_t type, const std::string &payload);
+
+// Append frame header and payload to buffer, which is sent later
+void append_frame(std::string &buffer, uint64_t request_id, uint32_t type, const std::string &payload);
+
+} // namespace protocol
+
+#endif //LIBSBOX_PROTOCOL_H
@@ -8,7 +8,7 @@
 
 #include <rapidjson/error/en.h>
 #include <rapidjson/stringbuffer.h>
-#include <rapidjson/prettywriter.h>
+#include <rapidjson/writer.h>
 
 SchemaValidator::SchemaValidator(const char *json_schema) {
     rapidjson::Document document;
@@ -38,9 +38,6 @@ SchemaValidator::SchemaValidator(const char *json_schema) {
 
 bool SchemaValidator::validate(const rapidjson::Document &document) {
     error_ = "";
-    rapidjson::StringBuffer string_buffer1;
-    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer1(string_buffer1);
-    document.Accept(writer1);
     schema_validator_->Reset();
     if (!document.Accept(*schema_validator_)) {
         rapidjson::StringBuffer string_buffer;
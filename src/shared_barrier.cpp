@@ -6,50 +6,99 @@
 #include "context_manager.h"
 #include "utils.h"
 
+#include <climits>
 #include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+namespace {
+// Futexes are not private, because barrier is shared between processes
+long futex(std::atomic<uint32_t> *address, int op, uint32_t value, const timespec *timeout) {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(address), op, value, timeout, nullptr, 0);
+}
+} // namespace
 
 SharedBarrier::SharedBarrier(uint32_t count) {
-    barrier_ = std::make_unique<SharedMemoryObject<pthread_barrier_t>>();
-    init(count);
-    owner_pid_ = getpid();
+    state_ = std::make_unique<SharedMemoryObject<State>>();
+    State *state = state_->get();
+    state->generation = 0;
+    reset(count);
 }
 
-SharedBarrier::~SharedBarrier() {
-    if (getpid() == owner_pid_) {
-        destroy();
+bool SharedBarrier::wait(uint32_t participant, int64_t timeout_ns) {
+    State *state = state_->get();
+    if (participant >= state->count) {
+        die(format("Barrier participant %u is out of range", participant));
     }
-}
 
-void SharedBarrier::wait() {
-    int err = pthread_barrier_wait(barrier_->get());
-    if (err != 0 && err != PTHREAD_BARRIER_SERIAL_THREAD) {
-        die(format("Failed to wait() on barrier: %m"));
+    if (state->aborted.load(std::memory_order_acquire) != 0) {
+        return false;
+    }
+    uint32_t generation = state->generation.load(std::memory_order_acquire);
+    state->arrived_mask[participant / WORD_BITS].fetch_or(1u << (participant % WORD_BITS), std::memory_order_relaxed);
+    if (state->arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == state->count) {
+        // Others can't arrive for next generation until it starts, so state is cleared safely
+        for (auto &word : state->arrived_mask) {
+            word.store(0, std::memory_order_relaxed);
+        }
+        state->arrived.store(0, std::memory_order_relaxed);
+        state->generation.fetch_add(1, std::memory_order_release);
+        if (futex(&state->generation, FUTEX_WAKE, INT_MAX, nullptr) < 0) {
+            die(format("Failed to wake barrier waiters: %m"));
+        }
+        return true;
     }
-}
 
-void SharedBarrier::reset(uint32_t count) {
-    destroy();
-    init(count);
+    int64_t deadline_ns = (timeout_ns == -1 ? -1 : get_monotonic_ns() + timeout_ns);
+    while (state->generation.load(std::memory_order_acquire) == generation) {
+        timespec timeout = {};
+        if (deadline_ns != -1) {
+            int64_t remaining_ns = deadline_ns - get_monotonic_ns();
+            if (remaining_ns <= 0) {
+                return false;
+            }
+            timeout.tv_sec = remaining_ns / 1000000000;
+            timeout.tv_nsec = remaining_ns % 1000000000;
+        }
+        // Returns at once if generation has already changed
+        if (futex(&state->generation, FUTEX_WAIT, generation, deadline_ns == -1 ? nullptr : &timeout) < 0 &&
+            errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT) {
+            die(format("Failed to wait() on barrier: %m"));
+        }
+    }
+    return state->aborted.load(std::memory_order_acquire) == 0;
 }
 
-void SharedBarrier::init(uint32_t count) {
-    pthread_barrierattr_t barrierattr;
-    if (pthread_barrierattr_init(&barrierattr) != 0) {
-        die(format("Failed to initialize barrierattr: %m"));
+void SharedBarrier::abort() {
+    State *state = state_->get();
+    state->aborted.store(1, std::memory_order_relaxed);
+    state->generation.fetch_add(1, std::memory_order_release);
+    if (futex(&state->generation, FUTEX_WAKE, INT_MAX, nullptr) < 0) {
+        die(format("Failed to wake barrier waiters: %m"));
     }
-    if (pthread_barrierattr_setpshared(&barrierattr, PTHREAD_PROCESS_SHARED) != 0) {
-        die(format("Failed to set PTHREAD_PROCESS_SHARED to barrierattr: %m"));
-    }
-    if (pthread_barrier_init(barrier_->get(), &barrierattr, count)) {
-        die(format("Failed to initialize barrier: %m"));
-    }
-    if (pthread_barrierattr_destroy(&barrierattr) != 0) {
-        die(format("Failed to destroy barrierattr: %m"));
+}
+
+std::vector<uint32_t> SharedBarrier::get_missing() {
+    State *state = state_->get();
+    std::vector<uint32_t> missing;
+    for (uint32_t i = 0; i < state->count; ++i) {
+        if ((state->arrived_mask[i / WORD_BITS].load(std::memory_order_relaxed) & (1u << (i % WORD_BITS))) == 0) {
+            missing.push_back(i);
+        }
     }
+    return missing;
 }
 
-void SharedBarrier::destroy() {
-    if (pthread_barrier_destroy(barrier_->get()) != 0) {
-        die(format("Failed to destroy barrier: %m"));
+void SharedBarrier::reset(uint32_t count) {
+    if (count == 0 || count > MAX_PARTICIPANTS) {
+        die(format("Barrier can't have %u participants", count));
+    }
+    // Generation may be broken by timeout or aborted, its arrivals are dropped
+    State *state = state_->get();
+    state->arrived = 0;
+    state->aborted = 0;
+    for (auto &word : state->arrived_mask) {
+        word = 0;
     }
+    state->count = count;
 }
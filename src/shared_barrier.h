@@ -7,22 +7,45 @@
 
 #include "shared_memory_object.h"
 
+#include <atomic>
 #include <memory>
-#include <pthread.h>
+#include <vector>
+#include <stdint.h>
 
-// Multiprocess barrier
+// Multiprocess barrier on futex in shared memory. Every participant has index in [0, count) and arrives once per
+// generation. Barrier is reusable right after all participants arrived, and count may be changed with reset() between
+// generations without any syscalls
 class SharedBarrier {
 public:
+    static const uint32_t MAX_PARTICIPANTS = 1024;
+
     explicit SharedBarrier(uint32_t count);
-    ~SharedBarrier();
-    void wait();
+    ~SharedBarrier() = default;
+
+    // Wait until all participants arrive. If timeout_ns is not -1 and it expires first, returns false and barrier
+    // stays broken: get_missing() tells who didn't arrive. Returns false also if generation is aborted
+    bool wait(uint32_t participant, int64_t timeout_ns = -1);
+    // Wake everyone waiting in current generation, they and participants arriving until reset() get false
+    void abort();
+    // Participants, which haven't arrived in current generation
+    std::vector<uint32_t> get_missing();
+    // Must be called when nobody is waiting. Also repairs barrier broken by timeout or abort()
     void reset(uint32_t count);
 private:
-    std::unique_ptr<SharedMemoryObject<pthread_barrier_t>> barrier_;
-    pid_t owner_pid_;
+    static const uint32_t WORD_BITS = 32;
 
-    void init(uint32_t count);
-    void destroy();
+    struct State {
+        // Waiters sleep on generation, it is incremented by last participant
+        std::atomic<uint32_t> generation;
+        std::atomic<uint32_t> arrived;
+        std::atomic<uint32_t> aborted;
+        uint32_t count;
+        std::atomic<uint32_t> arrived_mask[MAX_PARTICIPANTS / WORD_BITS];
+    };
+
+    std::unique_ptr<SharedMemoryObject<State>> state_;
 };
 
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
 #endif //LIBSBOX_SHARED_BARRIER_H
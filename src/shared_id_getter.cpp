@@ -6,31 +6,40 @@
 #include "context_manager.h"
 #include "utils.h"
 
-#include <mutex>
-
-SharedIdGetter::SharedIdGetter(uid_t start, uid_t count) {
-    ids_stack_ = std::make_unique<SharedMemoryArray<uid_t>>(count);
-    stack_head_ = std::make_unique<SharedMemoryObject<size_t>>();
-    for (size_t i = 0; i < count; ++i) {
-        (*ids_stack_)[i] = start + count - 1 - i; // Lower the ID is, closer to stack head it is
+SharedIdGetter::SharedIdGetter(uid_t start, uid_t count) : start_(start), count_(count) {
+    uid_t words = (count + WORD_BITS - 1) / WORD_BITS;
+    taken_ = std::make_unique<SharedMemoryArray<std::atomic<uint32_t>>>(words);
+    // Bits past the end of range are marked taken, so get() never returns them
+    if (count % WORD_BITS != 0) {
+        (*taken_)[words - 1] = ~((1u << (count % WORD_BITS)) - 1);
     }
-    (*stack_head_->get()) = count;
 }
 
 uid_t SharedIdGetter::get() {
-    std::unique_lock lock(mutex_);
-    if ((*stack_head_->get()) == 0) {
-        die(format("Failed to get ID: stack is empty"));
+    for (size_t i = 0; i < taken_->size(); ++i) {
+        std::atomic<uint32_t> &word = (*taken_)[i];
+        uint32_t value = word.load(std::memory_order_relaxed);
+        while (value != ~0u) {
+            uint32_t bit = static_cast<uint32_t>(__builtin_ctz(~value));
+            // On failure value is reloaded, and we retry with fresh free bit of the same word
+            if (word.compare_exchange_weak(value, value | (1u << bit), std::memory_order_acquire,
+                                           std::memory_order_relaxed)) {
+                return start_ + static_cast<uid_t>(i) * WORD_BITS + bit;
+            }
+        }
     }
-    (*stack_head_->get())--;
-    return (*ids_stack_)[*stack_head_->get()];
+    die("Failed to get ID: all IDs are taken");
+    return 0; // we should not get here
 }
 
 void SharedIdGetter::put(uid_t id) {
-    std::unique_lock lock(mutex_);
-    if (*stack_head_->get() == ids_stack_->size()) {
-        die(format("Failed to put ID (%d): stack is full", id));
+    if (id < start_ || id - start_ >= count_) {
+        die(format("Failed to put ID (%d): it is out of range", id));
+    }
+    uid_t index = id - start_;
+    uint32_t mask = 1u << (index % WORD_BITS);
+    uint32_t previous = (*taken_)[index / WORD_BITS].fetch_and(~mask, std::memory_order_release);
+    if ((previous & mask) == 0) {
+        die(format("Failed to put ID (%d): it is not taken", id));
     }
-    (*ids_stack_)[*stack_head_->get()] = id;
-    (*stack_head_->get())++;
 }
@@ -6,27 +6,33 @@
 #define LIBSBOX_SHARED_ID_GETTER_H
 
 #include "shared_memory_array.h"
-#include "shared_memory_object.h"
-#include "shared_mutex.h"
 
+#include <atomic>
 #include <memory>
+#include <stdint.h>
 
-// Multiprocess unique ID getter
+// Multiprocess unique ID getter. IDs are kept in bitmap in shared memory and taken with single compare-and-swap, so
+// there is no lock to contend on and process dying in the middle of get() or put() can't leave bitmap inconsistent
 class SharedIdGetter {
 public:
     // Initialize getter with IDs in segment [start, start + count - 1]
     SharedIdGetter(uid_t start, uid_t count);
     ~SharedIdGetter() = default;
 
-    // Get new unique ID, will fail if no free IDs left
+    // Get new unique ID, lowest free one is preferred. Will fail if no free IDs left
     uid_t get();
 
     // Put given ID back
     void put(uid_t id);
 private:
-    std::unique_ptr<SharedMemoryArray<uid_t>> ids_stack_;
-    std::unique_ptr<SharedMemoryObject<size_t>> stack_head_;
-    SharedMutex mutex_;
+    static const uid_t WORD_BITS = 32;
+
+    uid_t start_;
+    uid_t count_;
+    // Bit is set if ID is taken
+    std::unique_ptr<SharedMemoryArray<std::atomic<uint32_t>>> taken_;
 };
 
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
 #endif //LIBSBOX_SHARED_ID_GETTER_H
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "shared_ring.h"
+#include "context_manager.h"
+#include "utils.h"
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+SharedRing::SharedRing() {
+    fd_ = memfd_create("libsbox-ring", MFD_CLOEXEC);
+    if (fd_ < 0) {
+        die(format("Cannot create memfd for ring: %m"));
+    }
+    if (ftruncate(fd_, sizeof(shm_ring::Region)) != 0) {
+        die(format("Cannot resize ring memfd: %m"));
+    }
+
+    void *ptr = mmap(nullptr, sizeof(shm_ring::Region), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (ptr == MAP_FAILED) {
+        die(format("Cannot map ring memfd: %m"));
+    }
+    // memfd is zero-filled, so only ring header needs initialization
+    region_ = static_cast<shm_ring::Region *>(ptr);
+    shm_ring::init(region_);
+}
+
+SharedRing::~SharedRing() {
+    close_fd();
+    if (munmap(region_, sizeof(shm_ring::Region)) != 0) {
+        die(format("Cannot unmap ring: %m"));
+    }
+}
+
+shm_ring::Region *SharedRing::get() {
+    return region_;
+}
+
+fd_t SharedRing::get_fd() const {
+    return fd_;
+}
+
+void SharedRing::close_fd() {
+    if (fd_ >= 0) {
+        if (close(fd_) != 0) {
+            die(format("Cannot close ring memfd: %m"));
+        }
+        fd_ = -1;
+    }
+}
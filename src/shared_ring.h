@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_SHARED_RING_H
+#define LIBSBOX_SHARED_RING_H
+
+#include "shm_ring.h"
+
+// Ring region of one session, created in memfd so it can be passed to client
+class SharedRing {
+public:
+    SharedRing();
+    ~SharedRing();
+
+    SharedRing(const SharedRing &) = delete;
+    SharedRing &operator=(const SharedRing &) = delete;
+
+    shm_ring::Region *get();
+    fd_t get_fd() const;
+    // Mapping stays valid after memfd is closed
+    void close_fd();
+private:
+    shm_ring::Region *region_ = nullptr;
+    fd_t fd_ = -1;
+};
+
+#endif //LIBSBOX_SHARED_RING_H
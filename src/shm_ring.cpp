@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "shm_ring.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+
+void shm_ring::IndexRing::init() {
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(0, std::memory_order_relaxed);
+}
+
+bool shm_ring::IndexRing::push(uint32_t index) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) >= SLOT_COUNT) {
+        return false;
+    }
+    entries_[tail % SLOT_COUNT] = index;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+bool shm_ring::IndexRing::pop(uint32_t &index) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+        return false;
+    }
+    index = entries_[head % SLOT_COUNT];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+bool shm_ring::IndexRing::is_consistent() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire) <= SLOT_COUNT;
+}
+
+void shm_ring::init(Region *region) {
+    region->magic = MAGIC;
+    region->slot_count = SLOT_COUNT;
+    region->submit.init();
+    region->complete.init();
+}
+
+bool shm_ring::is_valid(const Region *region) {
+    return region->magic == MAGIC && region->slot_count == SLOT_COUNT;
+}
+
+namespace {
+bool put_string(shm_ring::Slot &slot, shm_ring::StringRef &ref, const std::string &str) {
+    if (str.size() > shm_ring::HEAP_SIZE - slot.heap_used) {
+        return false;
+    }
+    memcpy(slot.heap + slot.heap_used, str.data(), str.size());
+    ref.offset = slot.heap_used;
+    ref.size = static_cast<uint32_t>(str.size());
+    slot.heap_used += ref.size;
+    return true;
+}
+
+bool get_string(const shm_ring::Slot &slot, const shm_ring::StringRef &ref, std::string &str) {
+    // Copy reference first, so other side can't change it between check and use
+    shm_ring::StringRef copy = ref;
+    if (copy.offset > shm_ring::HEAP_SIZE || copy.size > shm_ring::HEAP_SIZE - copy.offset) {
+        return false;
+    }
+    str.assign(slot.heap + copy.offset, copy.size);
+    return true;
+}
+} // namespace
+
+bool shm_ring::write_request(Slot &slot, uint64_t request_id, int32_t priority,
+                             const std::vector<libsbox::Task *> &tasks) {
+    if (tasks.size() > MAX_TASKS) {
+        return false;
+    }
+
+    slot.request_id = request_id;
+    slot.priority = priority;
+    slot.task_count = static_cast<uint32_t>(tasks.size());
+    slot.status = 0;
+    slot.heap_used = 0;
+    int64_t capture_total = 0;
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        libsbox::Task *task = tasks[i];
+        TaskRecord &record = slot.tasks[i];
+        if (task->get_argv().size() > ARGC_MAX || task->get_env().size() > ENVC_MAX ||
+            task->get_binds().size() > BINDS_MAX) {
+            return false;
+        }
+        // Streams used in unusual way are left to daemon to reject
+        if (task->get_stdin().get_capture_limit() != -1 || task->get_stdout().is_inline() ||
+            task->get_stderr().is_inline()) {
+            return false;
+        }
+        capture_total += std::max(task->get_stdout().get_capture_limit(), int64_t{0}) +
+                         std::max(task->get_stderr().get_capture_limit(), int64_t{0});
+        if (capture_total > HEAP_SIZE) {
+            return false;
+        }
+
+        record.time_limit_ms = task->get_time_limit_ms();
+        record.wall_time_limit_ms = task->get_wall_time_limit_ms();
+        record.memory_limit_kb = task->get_memory_limit_kb();
+        record.fsize_limit_kb = task->get_fsize_limit_kb();
+        record.max_files = task->get_max_files();
+        record.max_threads = task->get_max_threads();
+        record.need_ipc = task->get_need_ipc();
+        record.use_standard_binds = task->get_use_standard_binds();
+        record.collect_timings = task->get_collect_timings();
+        record.collect_counters = task->get_collect_counters();
+        record.instruction_limit = task->get_instruction_limit();
+        record.telemetry_interval_ms = task->get_telemetry_interval_ms();
+
+        if (!put_string(slot, record.stdin_filename, task->get_stdin().get_filename()) ||
+            !put_string(slot, record.stdout_filename, task->get_stdout().get_filename()) ||
+            !put_string(slot, record.stderr_filename, task->get_stderr().get_filename())) {
+            return false;
+        }
+        record.stdin_inline = task->get_stdin().is_inline();
+        if (!put_string(slot, record.stdin_data, task->get_stdin().get_data())) {
+            return false;
+        }
+        record.stdout_capture_limit = task->get_stdout().get_capture_limit();
+        record.stderr_capture_limit = task->get_stderr().get_capture_limit();
+
+        record.argc = static_cast<uint32_t>(task->get_argv().size());
+        for (size_t j = 0; j < record.argc; ++j) {
+            if (!put_string(slot, record.argv[j], task->get_argv()[j])) {
+                return false;
+            }
+        }
+        record.envc = static_cast<uint32_t>(task->get_env().size());
+        for (size_t j = 0; j < record.envc; ++j) {
+            if (!put_string(slot, record.env[j], task->get_env()[j])) {
+                return false;
+            }
+        }
+        record.bindc = static_cast<uint32_t>(task->get_binds().size());
+        for (size_t j = 0; j < record.bindc; ++j) {
+            const libsbox::BindRule &bind = task->get_binds()[j];
+            if (!put_string(slot, record.bind_inside[j], bind.get_inside_path()) ||
+                !put_string(slot, record.bind_outside[j], bind.get_outside_path())) {
+                return false;
+            }
+            record.bind_flags[j] = bind.get_flags();
+        }
+    }
+    return true;
+}
+
+Error shm_ring::read_request(const Slot &slot, std::vector<libsbox::Task *> &tasks) {
+    uint32_t task_count = slot.task_count;
+    if (task_count > MAX_TASKS) {
+        return Error("Shared memory request is incorrect");
+    }
+
+    bool ok = true;
+    for (uint32_t i = 0; i < task_count && ok; ++i) {
+        const TaskRecord &record = slot.tasks[i];
+        auto *task = new libsbox::Task();
+        tasks.push_back(task);
+
+        task->set_time_limit_ms(record.time_limit_ms);
+        task->set_wall_time_limit_ms(record.wall_time_limit_ms);
+        task->set_memory_limit_kb(record.memory_limit_kb);
+        task->set_fsize_limit_kb(record.fsize_limit_kb);
+        task->set_max_files(record.max_files);
+        task->set_max_threads(record.max_threads);
+        task->set_need_ipc(record.need_ipc != 0);
+        task->set_use_standard_binds(record.use_standard_binds != 0);
+        task->set_collect_timings(record.collect_timings != 0);
+        task->set_collect_counters(record.collect_counters != 0);
+        task->set_instruction_limit(record.instruction_limit);
+        task->set_telemetry_interval_ms(record.telemetry_interval_ms);
+
+        std::string str;
+        ok = ok && get_string(slot, record.stdin_filename, str);
+        task->get_stdin().use_file(str);
+        ok = ok && get_string(slot, record.stdout_filename, str);
+        task->get_stdout().use_file(str);
+        ok = ok && get_string(slot, record.stderr_filename, str);
+        task->get_stderr().use_file(str);
+        if (record.stdin_inline != 0) {
+            ok = ok && get_string(slot, record.stdin_data, str);
+            task->get_stdin().use_data(str);
+        }
+        if (record.stdout_capture_limit != -1) {
+            task->get_stdout().capture(record.stdout_capture_limit);
+        }
+        if (record.stderr_capture_limit != -1) {
+            task->get_stderr().capture(record.stderr_capture_limit);
+        }
+
+        uint32_t argc = record.argc;
+        uint32_t envc = record.envc;
+        uint32_t bindc = record.bindc;
+        if (argc > ARGC_MAX || envc > ENVC_MAX || bindc > BINDS_MAX) {
+            ok = false;
+            break;
+        }
+
+        std::vector<std::string> argv(argc);
+        for (uint32_t j = 0; j < argc && ok; ++j) {
+            ok = get_string(slot, record.argv[j], argv[j]);
+        }
+        task->set_argv(argv);
+        for (uint32_t j = 0; j < envc && ok; ++j) {
+            ok = get_string(slot, record.env[j], str);
+            task->get_env().push_back(str);
+        }
+        for (uint32_t j = 0; j < bindc && ok; ++j) {
+            std::string outside;
+            ok = get_string(slot, record.bind_inside[j], str) && get_string(slot, record.bind_outside[j], outside);
+            task->get_binds().emplace_back(str, outside, record.bind_flags[j]);
+        }
+    }
+
+    if (!ok) {
+        for (auto task : tasks) {
+            delete task;
+        }
+        tasks.clear();
+        return Error("Shared memory request is incorrect");
+    }
+    return Error();
+}
+
+bool shm_ring::write_results(Slot &slot, const std::vector<libsbox::Task *> &tasks) {
+    // Request strings are not needed anymore, so heap is reused
+    slot.heap_used = 0;
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        const libsbox::Task *task = tasks[i];
+        TaskRecord &record = slot.tasks[i];
+        record.time_usage_ms = task->get_time_usage_ms();
+        record.time_usage_sys_ms = task->get_time_usage_sys_ms();
+        record.time_usage_user_ms = task->get_time_usage_user_ms();
+        record.wall_time_usage_ms = task->get_wall_time_usage_ms();
+        record.memory_usage_kb = task->get_memory_usage_kb();
+        record.time_limit_exceeded = task->is_time_limit_exceeded();
+        record.wall_time_limit_exceeded = task->is_wall_time_limit_exceeded();
+        record.exited = task->exited();
+        record.exit_code = task->get_exit_code();
+        record.signaled = task->signaled();
+        record.term_signal = task->get_term_signal();
+        record.oom_killed = task->is_oom_killed();
+        record.memory_limit_hit = task->is_memory_limit_hit();
+        record.oom_time_ms = task->get_oom_time_ms();
+        record.oom_memory_usage_kb = task->get_oom_memory_usage_kb();
+        record.instruction_limit_exceeded = task->is_instruction_limit_exceeded();
+        record.instructions = task->get_instructions();
+        record.cycles = task->get_cycles();
+        record.cache_misses = task->get_cache_misses();
+        record.context_switches = task->get_context_switches();
+        if (!put_string(slot, record.stdout_data, task->get_stdout().get_data()) ||
+            !put_string(slot, record.stderr_data, task->get_stderr().get_data())) {
+            return false;
+        }
+        record.stdout_truncated = task->get_stdout().is_truncated();
+        record.stderr_truncated = task->get_stderr().is_truncated();
+        for (uint32_t j = 0; j < STAGE_REPORTED_COUNT; ++j) {
+            auto it = task->get_timings_ns().find(STAGE_NAMES[j]);
+            record.timings_ns[j] = (it == task->get_timings_ns().end() ? -1 : it->second);
+        }
+    }
+    slot.status = 0;
+    return true;
+}
+
+void shm_ring::write_error(Slot &slot, const std::string &error) {
+    // Request strings are not needed anymore, so heap is reused
+    slot.heap_used = 0;
+    put_string(slot, slot.error, error.substr(0, HEAP_SIZE));
+    slot.status = 1;
+}
+
+Error shm_ring::read_results(const Slot &slot, const std::vector<libsbox::Task *> &tasks) {
+    if (slot.status != 0) {
+        std::string error;
+        if (!get_string(slot, slot.error, error)) {
+            return Error("Shared memory response is incorrect");
+        }
+        return Error(format("[remote] %s", error.c_str()));
+    }
+
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        libsbox::Task *task = tasks[i];
+        const TaskRecord &record = slot.tasks[i];
+        task->set_time_usage_ms(record.time_usage_ms);
+        task->set_time_usage_sys_ms(record.time_usage_sys_ms);
+        task->set_time_usage_user_ms(record.time_usage_user_ms);
+        task->set_wall_time_usage_ms(record.wall_time_usage_ms);
+        task->set_memory_usage_kb(record.memory_usage_kb);
+        task->set_time_limit_exceeded(record.time_limit_exceeded != 0);
+        task->set_wall_time_limit_exceeded(record.wall_time_limit_exceeded != 0);
+        task->set_exited(record.exited != 0);
+        task->set_exit_code(record.exit_code);
+        task->set_signaled(record.signaled != 0);
+        task->set_term_signal(record.term_signal);
+        task->set_oom_killed(record.oom_killed != 0);
+        task->set_memory_limit_hit(record.memory_limit_hit != 0);
+        task->set_oom_time_ms(record.oom_time_ms);
+        task->set_oom_memory_usage_kb(record.oom_memory_usage_kb);
+        task->set_instruction_limit_exceeded(record.instruction_limit_exceeded != 0);
+        task->set_instructions(record.instructions);
+        task->set_cycles(record.cycles);
+        task->set_cache_misses(record.cache_misses);
+        task->set_context_switches(record.context_switches);
+        if (task->get_stdout().get_capture_limit() != -1) {
+            std::string data;
+            if (!get_string(slot, record.stdout_data, data)) {
+                return Error("Shared memory response is incorrect");
+            }
+            task->get_stdout().set_data(data);
+            task->get_stdout().set_truncated(record.stdout_truncated != 0);
+        }
+        if (task->get_stderr().get_capture_limit() != -1) {
+            std::string data;
+            if (!get_string(slot, record.stderr_data, data)) {
+                return Error("Shared memory response is incorrect");
+            }
+            task->get_stderr().set_data(data);
+            task->get_stderr().set_truncated(record.stderr_truncated != 0);
+        }
+        if (task->get_collect_timings()) {
+            for (uint32_t j = 0; j < STAGE_REPORTED_COUNT; ++j) {
+                if (record.timings_ns[j] >= 0) {
+                    task->set_timing_ns(STAGE_NAMES[j], record.timings_ns[j]);
+                }
+            }
+        }
+    }
+    return Error();
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_SHM_RING_H
+#define LIBSBOX_SHM_RING_H
+
+#include "libsbox_internal.h"
+#include "stage.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Shared memory transport of session in SHARED_MEMORY mode. Daemon creates memfd with Region, passes it to client in
+// hello and both sides map it. Client writes request into one of its free slots and pushes slot index to submit ring,
+// daemon runs it, writes results into the same slot and pushes index to complete ring. Socket is only used as doorbell:
+// header-only frames tell other side to look at the ring. Region is mapped at different addresses, so records contain
+// offsets only, never pointers
+namespace shm_ring {
+
+static const uint32_t MAGIC = 0x52425853;
+static const uint32_t SLOT_COUNT = 16;
+static const uint32_t MAX_TASKS = 8;
+static const uint32_t HEAP_SIZE = 256 * 1024;
+
+// String stored in slot heap
+struct StringRef {
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct TaskRecord {
+    // parameters
+    int64_t time_limit_ms;
+    int64_t wall_time_limit_ms;
+    int64_t memory_limit_kb;
+    int64_t fsize_limit_kb;
+    int32_t max_files;
+    int32_t max_threads;
+    uint8_t need_ipc;
+    uint8_t use_standard_binds;
+    uint8_t collect_timings;
+    uint8_t collect_counters;
+    int64_t instruction_limit;
+    int64_t telemetry_interval_ms;
+
+    StringRef stdin_filename;
+    StringRef stdout_filename;
+    StringRef stderr_filename;
+    uint8_t stdin_inline;
+    StringRef stdin_data;
+    int64_t stdout_capture_limit;
+    int64_t stderr_capture_limit;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t bindc;
+    StringRef argv[ARGC_MAX];
+    StringRef env[ENVC_MAX];
+    StringRef bind_inside[BINDS_MAX];
+    StringRef bind_outside[BINDS_MAX];
+    int32_t bind_flags[BINDS_MAX];
+
+    // results
+    int64_t time_usage_ms;
+    int64_t time_usage_sys_ms;
+    int64_t time_usage_user_ms;
+    int64_t wall_time_usage_ms;
+    int64_t memory_usage_kb;
+    uint8_t time_limit_exceeded;
+    uint8_t wall_time_limit_exceeded;
+    uint8_t exited;
+    uint8_t signaled;
+    uint8_t oom_killed;
+    uint8_t memory_limit_hit;
+    uint8_t instruction_limit_exceeded;
+    int32_t exit_code;
+    int32_t term_signal;
+    int64_t instructions;
+    int64_t cycles;
+    int64_t cache_misses;
+    int64_t context_switches;
+    int64_t oom_time_ms;
+    int64_t oom_memory_usage_kb;
+    // Captured output, request strings are dropped when results are written, so it has whole heap
+    StringRef stdout_data;
+    StringRef stderr_data;
+    uint8_t stdout_truncated;
+    uint8_t stderr_truncated;
+    // Indexed by Stage, -1 if stage is not timed
+    int64_t timings_ns[STAGE_REPORTED_COUNT];
+};
+
+struct Slot {
+    uint64_t request_id;
+    int32_t priority;
+    uint32_t task_count;
+    // 0 if results are written into tasks, otherwise error is set
+    uint32_t status;
+    StringRef error;
+    uint32_t heap_used;
+    TaskRecord tasks[MAX_TASKS];
+    char heap[HEAP_SIZE];
+};
+
+// Single-producer single-consumer queue of slot indices
+class IndexRing {
+public:
+    void init();
+
+    // Called by producer. Fails if ring is full
+    bool push(uint32_t index);
+    // Called by consumer. Fails if ring is empty
+    bool pop(uint32_t &index);
+    // Other side may be broken, so consumer checks that indices make sense before trusting them
+    bool is_consistent() const;
+private:
+    alignas(64) std::atomic<uint32_t> head_;
+    alignas(64) std::atomic<uint32_t> tail_;
+    uint32_t entries_[SLOT_COUNT];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+struct Region {
+    uint32_t magic;
+    uint32_t slot_count;
+    // client -> daemon
+    IndexRing submit;
+    // daemon -> client
+    IndexRing complete;
+    Slot slots[SLOT_COUNT];
+};
+
+// Initialize freshly mapped region
+void init(Region *region);
+bool is_valid(const Region *region);
+
+// Write request into slot. Fails if tasks or their captured output don't fit, then request must be sent through socket
+bool write_request(Slot &slot, uint64_t request_id, int32_t priority, const std::vector<libsbox::Task *> &tasks);
+// Read request written by client. Slot contents are not trusted
+Error read_request(const Slot &slot, std::vector<libsbox::Task *> &tasks);
+
+// Fails if captured output doesn't fit into slot
+bool write_results(Slot &slot, const std::vector<libsbox::Task *> &tasks);
+void write_error(Slot &slot, const std::string &error);
+Error read_results(const Slot &slot, const std::vector<libsbox::Task *> &tasks);
+
+} // namespace shm_ring
+
+#endif //LIBSBOX_SHM_RING_H
@@ -8,7 +8,6 @@
 #include "logger.h"
 
 #include <cstring>
-#include <sys/time.h>
 #include <map>
 #include <functional>
 
@@ -19,7 +18,6 @@ public:
     static const SignalAction DEFAULT;
     static const SignalAction ABORT;
     static const SignalAction TERMINATE;
-    static const SignalAction TIMER;
 
     void apply_to(int signum, bool restart = false) const {
         if (restart) {
@@ -47,19 +45,13 @@ void abort_handler(int signum) {
 }
 
 void terminate_handler(int) {
-    timer_interrupt = false;
     ContextManager::get().terminate();
 }
 
-void timer_handler(int) {
-    timer_interrupt = true;
-}
-
 const SignalAction SignalAction::IGNORE(SIG_IGN);
 const SignalAction SignalAction::DEFAULT(SIG_DFL);
 const SignalAction SignalAction::ABORT(abort_handler);
 const SignalAction SignalAction::TERMINATE(terminate_handler);
-const SignalAction SignalAction::TIMER(timer_handler);
 
 const std::map<int, std::reference_wrapper<const SignalAction>> signal_actions = {
     {SIGUSR1, std::ref(SignalAction::IGNORE)},
@@ -74,13 +66,11 @@ const std::map<int, std::reference_wrapper<const SignalAction>> signal_actions =
     {SIGFPE, std::ref(SignalAction::ABORT)},
     {SIGINT, std::ref(SignalAction::ABORT)},
     {SIGTERM, std::ref(SignalAction::TERMINATE)},
-    {SIGALRM, std::ref(SignalAction::TIMER)},
+    {SIGALRM, std::ref(SignalAction::IGNORE)},
     {SIGCHLD, std::ref(SignalAction::DEFAULT)}
 };
 } // namespace
 
-bool timer_interrupt = false;
-
 void prepare_signals() {
     for (const auto &signal_action : signal_actions) {
         signal_action.second.get().apply_to(signal_action.first);
@@ -115,21 +105,3 @@ void reset_sigchld() {
         die(format("Failed to set SIGCHLD sigaction to SIG_DFL: %m"));
     }
 }
-
-void enable_timer_interrupts() {
-    signal_actions.at(SIGALRM).get().apply_to(SIGALRM, false);
-}
-
-void start_timer(uint32_t interval) {
-    struct itimerval timer = {};
-    memset(&timer, 0, sizeof(timer));
-    timer.it_interval.tv_usec = interval * 1000;
-    timer.it_value.tv_usec = interval * 1000;
-    setitimer(ITIMER_REAL, &timer, nullptr);
-}
-
-void stop_timer() {
-    struct itimerval timer = {};
-    memset(&timer, 0, sizeof(timer));
-    setitimer(ITIMER_REAL, &timer, nullptr);
-}
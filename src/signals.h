@@ -21,13 +21,4 @@ void set_sigchld_action(void (*)(int, siginfo_t *, void *));
 
 void reset_sigchld();
 
-void enable_timer_interrupts();
-
-// Start timer which will send SIGALRM every interval_ms milliseconds
-void start_timer(uint32_t interval_ms);
-void stop_timer();
-
-// Can be checked after signal handler returns, if true, SIGALRM was received
-extern bool timer_interrupt;
-
 #endif //LIBSBOX_SIGNALS_H
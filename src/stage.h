@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_STAGE_H
+#define LIBSBOX_STAGE_H
+
+#include <stdint.h>
+
+// Stages of request processing, which are timed separately (see timeline in libsboxd.cpp)
+enum Stage : uint32_t {
+    // dispatcher
+    STAGE_PARSE,
+    // dispatcher, from request is queued until it is sent to worker
+    STAGE_QUEUE,
+    // worker
+    STAGE_PREPARE_CONTAINERS,
+    STAGE_WRITE_TASKS,
+    STAGE_START_SYNC,
+    // container
+    STAGE_BIND_MOUNTS,
+    // setting limits of box cgroup, which exists since container start
+    STAGE_CGROUP_CREATE,
+    STAGE_SPAWN,
+    // slave, from run start until execve()
+    STAGE_EXEC,
+    // container
+    STAGE_WAIT,
+    STAGE_UMOUNT,
+    // worker
+    STAGE_COLLECT_RESULTS,
+    // stages below happen after results are sent, so they are present in stats only
+    // dispatcher
+    STAGE_SERIALIZE,
+    STAGE_CLEANUP_ROOT,
+    // reset of box cgroup for next run, it waits for root cleanup to free files of box
+    STAGE_CGROUP_DESTROY,
+    STAGE_COUNT
+};
+
+// Stages up to this one are reported in per-task timings
+static const uint32_t STAGE_REPORTED_COUNT = STAGE_COLLECT_RESULTS + 1;
+
+static const char *const STAGE_NAMES[STAGE_COUNT] = {
+    "parse",
+    "queue",
+    "prepare_containers",
+    "write_tasks",
+    "start_sync",
+    "bind_mounts",
+    "cgroup_create",
+    "spawn",
+    "exec",
+    "wait",
+    "umount",
+    "collect_results",
+    "serialize",
+    "cleanup_root",
+    "cgroup_destroy",
+};
+
+#endif //LIBSBOX_STAGE_H
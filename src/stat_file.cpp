@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "stat_file.h"
+#include "context_manager.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+// Parse non-negative decimal number at pos and move pos past it. Returns false if there is no number
+bool parse_int(const char *&pos, int64_t &value) {
+    if (*pos < '0' || *pos > '9') return false;
+    value = 0;
+    while (*pos >= '0' && *pos <= '9') {
+        value = value * 10 + (*pos - '0');
+        ++pos;
+    }
+    return true;
+}
+} // namespace
+
+StatFile::StatFile(fs::path path, bool writable) : path_(std::move(path)), writable_(writable) {}
+
+StatFile::~StatFile() {
+    close();
+}
+
+void StatFile::open() {
+    if (writable_) {
+        fd_ = ::open(path_.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd_ >= 0) return;
+        // Older kernels may provide file only for reading
+        if (errno != EACCES) {
+            die(format("Cannot open file '%s': %m", path_.c_str()));
+        }
+        writable_ = false;
+    }
+    fd_ = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        die(format("Cannot open file '%s' for reading: %m", path_.c_str()));
+    }
+}
+
+size_t StatFile::read(char *buffer) {
+    if (fd_ == -1) open();
+
+    // Stat files are regenerated on every read from offset 0, so single pread() returns consistent snapshot
+    ssize_t cnt = pread(fd_, buffer, BUFFER_SIZE - 1, 0);
+    if (cnt < 0) {
+        die(format("Cannot read from file '%s': %m", path_.c_str()));
+    }
+    buffer[cnt] = 0;
+    return static_cast<size_t>(cnt);
+}
+
+int64_t StatFile::read_value() {
+    char buffer[BUFFER_SIZE];
+    read(buffer);
+    const char *pos = buffer;
+    int64_t value = 0;
+    if (!parse_int(pos, value)) {
+        die(format("Cannot parse '%s'", path_.c_str()));
+    }
+    return value;
+}
+
+void StatFile::read_keys(const char *const keys[], int64_t values[], size_t count) {
+    char buffer[BUFFER_SIZE];
+    size_t length = read(buffer);
+
+    // Keys are few, so found ones are tracked with bitmask
+    uint64_t found = 0;
+    uint64_t all = (count >= 64 ? ~uint64_t{0} : (uint64_t{1} << count) - 1);
+    const char *pos = buffer;
+    const char *end = buffer + length;
+    while (pos < end && found != all) {
+        const char *name_end = strchr(pos, ' ');
+        if (name_end == nullptr) break;
+        auto name_length = static_cast<size_t>(name_end - pos);
+        const char *value_pos = name_end + 1;
+        for (size_t i = 0; i < count; ++i) {
+            if (strncmp(keys[i], pos, name_length) == 0 && keys[i][name_length] == 0) {
+                if (!parse_int(value_pos, values[i])) {
+                    die(format("Cannot parse %s field in %s", keys[i], path_.c_str()));
+                }
+                found |= (uint64_t{1} << i);
+                break;
+            }
+        }
+        const char *line_end = strchr(value_pos, '\n');
+        if (line_end == nullptr) break;
+        pos = line_end + 1;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (!(found & (uint64_t{1} << i))) {
+            die(format("Can't find %s field in %s", keys[i], path_.c_str()));
+        }
+    }
+}
+
+int64_t StatFile::count_lines() {
+    if (fd_ == -1) open();
+
+    char buffer[BUFFER_SIZE];
+    int64_t lines = 0;
+    off_t offset = 0;
+    while (true) {
+        ssize_t cnt = pread(fd_, buffer, BUFFER_SIZE, offset);
+        if (cnt < 0) {
+            die(format("Cannot read from file '%s': %m", path_.c_str()));
+        }
+        if (cnt == 0) break;
+        lines += std::count(buffer, buffer + cnt, '\n');
+        offset += cnt;
+    }
+    return lines;
+}
+
+bool StatFile::write(const std::string &data) {
+    if (fd_ == -1) open();
+    if (!writable_) return false;
+    ssize_t cnt = pwrite(fd_, data.c_str(), data.size(), 0);
+    if (cnt < 0 && errno == EINVAL) {
+        writable_ = false;
+        return false;
+    }
+    if (cnt < 0 || static_cast<size_t>(cnt) != data.size()) {
+        die(format("Cannot write to file '%s': %m", path_.c_str()));
+    }
+    return true;
+}
+
+void StatFile::close() {
+    if (fd_ == -1) return;
+    if (::close(fd_) != 0) {
+        die(format("Cannot close file '%s': %m", path_.c_str()));
+    }
+    fd_ = -1;
+}
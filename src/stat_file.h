@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_STAT_FILE_H
+#define LIBSBOX_STAT_FILE_H
+
+#include "libsbox_internal.h"
+
+#include <filesystem>
+#include <string>
+
+namespace fs = std::filesystem;
+
+// Counter file (e.g. of cgroup), which is opened on first read and then read with pread() into stack buffer without
+// any allocations. Use it for files read many times, read_file() is fine for everything else
+class StatFile {
+public:
+    // Writable file is opened for reading and writing, if kernel allows it
+    explicit StatFile(fs::path path, bool writable = false);
+    ~StatFile();
+
+    StatFile(const StatFile &) = delete;
+    StatFile &operator=(const StatFile &) = delete;
+
+    // Read file consisting of single integer
+    int64_t read_value();
+    // Read flat keyed file ("key value" lines) and store values of given keys, dies if some of them is missing.
+    // At most 64 keys are supported
+    void read_keys(const char *const keys[], int64_t values[], size_t count);
+    // Count lines of file of any size (e.g. list of pids)
+    int64_t count_lines();
+    // Write data through the same descriptor. Returns false if file turned out to be read-only
+    bool write(const std::string &data);
+    void close();
+private:
+    static const size_t BUFFER_SIZE = 4096;
+
+    fs::path path_;
+    bool writable_;
+    fd_t fd_ = -1;
+
+    void open();
+    // Read whole file into buffer and terminate it with zero, returns length of data
+    size_t read(char *buffer);
+};
+
+#endif //LIBSBOX_STAT_FILE_H
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "stats.h"
+#include "shared_memory.h"
+#include "context_manager.h"
+#include "utils.h"
+
+#include <sys/mman.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+void LatencyHistogram::record(int64_t ns) {
+    if (ns < 0) {
+        ns = 0;
+    }
+    buckets_[get_bucket(static_cast<uint64_t>(ns))].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+
+    int64_t max_ns = max_ns_.load(std::memory_order_relaxed);
+    while (ns > max_ns && !max_ns_.compare_exchange_weak(max_ns, ns, std::memory_order_relaxed)) {}
+}
+
+uint64_t LatencyHistogram::get_count() const {
+    return count_.load(std::memory_order_relaxed);
+}
+
+int64_t LatencyHistogram::get_percentile_ns(double quantile) const {
+    uint64_t count = get_count();
+    if (count == 0) {
+        return 0;
+    }
+
+    auto target = static_cast<uint64_t>(quantile * static_cast<double>(count));
+    if (target == 0) {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < BUCKETS; ++i) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            return std::min(static_cast<int64_t>(get_bucket_upper_bound(i)), get_max_ns());
+        }
+    }
+    return get_max_ns();
+}
+
+int64_t LatencyHistogram::get_max_ns() const {
+    return max_ns_.load(std::memory_order_relaxed);
+}
+
+uint32_t LatencyHistogram::get_bucket(uint64_t ns) {
+    if (ns < SUB_BUCKETS) {
+        return static_cast<uint32_t>(ns);
+    }
+    // Position of highest bit and two bits after it
+    auto msb = static_cast<uint32_t>(63 - __builtin_clzll(ns));
+    auto sub = static_cast<uint32_t>((ns >> (msb - 2)) & (SUB_BUCKETS - 1));
+    return (msb - 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::get_bucket_upper_bound(uint32_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    uint32_t msb = bucket / SUB_BUCKETS + 1;
+    uint64_t sub = bucket % SUB_BUCKETS;
+    return ((SUB_BUCKETS + sub + 1) << (msb - 2)) - 1;
+}
+
+Stats::Data *Stats::data_ = nullptr;
+
+void Stats::init() {
+    void *ptr = allocate_shared_memory(sizeof(Data));
+    if (ptr == MAP_FAILED) {
+        die(format("Cannot allocate %zu bytes of shared memory for stats: %m", sizeof(Data)));
+    }
+    // Anonymous mapping is zero-filled, which is valid initial state of all counters
+    data_ = static_cast<Data *>(ptr);
+}
+
+void Stats::record(Stage stage, int64_t ns) {
+    if (data_ != nullptr) {
+        data_->stages[stage].record(ns);
+    }
+}
+
+void Stats::record_pool(bool hit) {
+    if (data_ != nullptr) {
+        (hit ? data_->pool_hits : data_->pool_misses).fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+const LatencyHistogram &Stats::get(Stage stage) {
+    return data_->stages[stage];
+}
+
+std::string Stats::to_json() {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("stages");
+    writer.StartArray();
+    for (uint32_t i = 0; i < STAGE_COUNT; ++i) {
+        const LatencyHistogram &histogram = get(static_cast<Stage>(i));
+        writer.StartObject();
+        writer.Key("stage");
+        writer.String(STAGE_NAMES[i]);
+        writer.Key("count");
+        writer.Uint64(histogram.get_count());
+        writer.Key("p50_ns");
+        writer.Int64(histogram.get_percentile_ns(0.5));
+        writer.Key("p99_ns");
+        writer.Int64(histogram.get_percentile_ns(0.99));
+        writer.Key("p999_ns");
+        writer.Int64(histogram.get_percentile_ns(0.999));
+        writer.Key("max_ns");
+        writer.Int64(histogram.get_max_ns());
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.Key("pool");
+    writer.StartObject();
+    writer.Key("hits");
+    writer.Uint64(data_->pool_hits.load(std::memory_order_relaxed));
+    writer.Key("misses");
+    writer.Uint64(data_->pool_misses.load(std::memory_order_relaxed));
+    writer.EndObject();
+    writer.EndObject();
+    return buffer.GetString();
+}
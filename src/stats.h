@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_STATS_H
+#define LIBSBOX_STATS_H
+
+#include "stage.h"
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+// Latency histogram with logarithmic buckets (4 buckets per power of two, so error is within 25%). Lives in shared
+// memory and is updated with atomics, so every worker, container and slave can record into it without locks
+class LatencyHistogram {
+public:
+    void record(int64_t ns);
+
+    uint64_t get_count() const;
+    // Upper bound of bucket containing given quantile
+    int64_t get_percentile_ns(double quantile) const;
+    int64_t get_max_ns() const;
+private:
+    static const uint32_t SUB_BUCKETS = 4;
+    static const uint32_t BUCKETS = 64 * SUB_BUCKETS;
+
+    std::atomic<uint64_t> buckets_[BUCKETS];
+    std::atomic<uint64_t> count_;
+    std::atomic<int64_t> max_ns_;
+
+    static uint32_t get_bucket(uint64_t ns);
+    static uint64_t get_bucket_upper_bound(uint32_t bucket);
+};
+
+// Per-stage latency histograms and container pool counters of the whole daemon
+class Stats {
+public:
+    // Must be called by daemon before spawning workers
+    static void init();
+
+    static void record(Stage stage, int64_t ns);
+    // Task got idle container from pool (hit) or container was started for it (miss)
+    static void record_pool(bool hit);
+    static const LatencyHistogram &get(Stage stage);
+
+    // Response to stats query
+    static std::string to_json();
+private:
+    struct Data {
+        LatencyHistogram stages[STAGE_COUNT];
+        std::atomic<uint64_t> pool_hits;
+        std::atomic<uint64_t> pool_misses;
+    };
+
+    static Data *data_;
+};
+
+#endif //LIBSBOX_STATS_H
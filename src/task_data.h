@@ -11,12 +11,20 @@
 #include "libsbox_internal.h"
 #include "context_manager.h"
 #include "utils.h"
+#include "stage.h"
 
 #include <limits.h>
 
 struct IOStream {
     fd_t fd = -1;
     PlainString<PATH_MAX> filename;
+    // fd is write end of pipe, container drains its read end into memfd until capture limit is reached
+    bool captured = false;
+    fd_t capture_fd = -1;
+    fd_t capture_buffer_fd = -1;
+    int64_t capture_limit = -1;
+    // Bytes program has written, including dropped ones
+    int64_t captured_bytes = 0;
 };
 
 struct BindData {
@@ -44,8 +52,12 @@ struct TaskData {
     memory_kb_t fsize_limit_kb = -1;
     int32_t max_files = 16;
     int32_t max_threads = 1;
-    bool need_ipc = false;
-    bool use_standard_binds = true;
+    bool collect_counters = false;
+    int64_t instruction_limit = -1;
+    // Samples of running task are sent to daemon as FRAME_TELEMETRY of job every telemetry_interval_ms
+    time_ms_t telemetry_interval_ms = -1;
+    uint64_t job_id = 0;
+    uint32_t task_index = 0;
 
     IOStream stdin_desc, stdout_desc, stderr_desc;
     PlainStringVector<ARGC_MAX, ARGV_MAX> argv;
@@ -68,8 +80,23 @@ struct TaskData {
     int term_signal = -1;
     bool oom_killed = false;
     bool memory_limit_hit = false;
+    time_ms_t oom_time_ms = -1;
+    memory_kb_t oom_memory_usage_kb = -1;
+    bool instruction_limit_exceeded = false;
+    int64_t instructions = -1;
+    int64_t cycles = -1;
+    int64_t cache_misses = -1;
+    int64_t context_switches = -1;
 
     volatile bool error = false;
+
+    // Time of container and slave stages, -1 if stage was not reached
+    int64_t stage_ns[STAGE_COUNT];
+
+    // control
+    bool stop = false;
+    // Index of container in worker's run start barrier, its slave has next index
+    uint32_t run_start_participant = 0;
 };
 
 #endif //LIBSBOX_TASK_DATA_H
@@ -12,6 +12,12 @@
 #include <string>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
 
 std::string vformat(const char *fmt, va_list args) {
     std::vector<char> result(strlen(fmt) * 2);
@@ -46,7 +52,7 @@ std::string format(const char *fmt, ...) {
 }
 
 void write_file(const fs::path &path, const std::string &data) {
-    fd_t fd = open(path.c_str(), O_WRONLY);
+    fd_t fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
     if (fd < 0) {
         die(format("Cannot open file '%s' for writing: %m", path.c_str()));
     }
@@ -65,7 +71,7 @@ char read_buf[READ_BUF_SIZE];
 }
 
 std::string read_file(const fs::path &path) {
-    fd_t fd = open(path.c_str(), O_RDONLY);
+    fd_t fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
     if (fd < 0) {
         die(format("Cannot open file '%s' for reading: %m", path.c_str()));
     }
@@ -86,3 +92,17 @@ std::string read_file(const fs::path &path) {
     }
     return res;
 }
+
+int64_t get_monotonic_ns() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+int open_pidfd(pid_t pid) {
+    int fd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+    if (fd < 0) {
+        die(format("pidfd_open() failed: %m"));
+    }
+    return fd;
+}
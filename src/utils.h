@@ -7,6 +7,7 @@
 
 #include <string>
 #include <filesystem>
+#include <sys/types.h>
 
 namespace fs = std::filesystem;
 
@@ -23,4 +24,10 @@ void write_file(const fs::path &path, const std::string &data);
 // Read whole file specified by path with error checks
 std::string read_file(const fs::path &path);
 
+// Current CLOCK_MONOTONIC time in nanoseconds
+int64_t get_monotonic_ns();
+
+// Obtain file descriptor referring to process, which becomes readable when process exits
+int open_pidfd(pid_t pid);
+
 #endif //LIBSBOX_UTILS_H_
@@ -4,35 +4,57 @@
 
 #include "worker.h"
 #include "signals.h"
-#include "schema_validator.h"
+#include "config.h"
+#include "protocol.h"
+#include "binary_codec.h"
+#include "stats.h"
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <poll.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
-#include <rapidjson/document.h>
-#include <rapidjson/error/en.h>
-#include <rapidjson/stringbuffer.h>
-#include <rapidjson/writer.h>
+#include <cassert>
+#include <cstring>
 
 #include "logger.h"
-#include "generated/request_schema.h"
 
 Worker *Worker::worker_ = nullptr;
 
-Worker::Worker(fd_t server_socket_fd, SharedIdGetter *id_getter)
-    : server_socket_fd_(server_socket_fd), id_getter_(id_getter) {}
+Worker::Worker(SharedIdGetter *id_getter, cpuset::BoxSet box_set)
+    : id_getter_(id_getter), box_set_(std::move(box_set)) {}
 
 Worker &Worker::get() {
     return *worker_;
 }
 
 pid_t Worker::start() {
+    fd_t channel[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, channel) != 0) {
+        return -1;
+    }
+    // Single message must fit into socket buffer. Memory is allocated only for queued messages, so it is cheap
+    int buffer_size = static_cast<int>(protocol::MAX_FRAME_SIZE + sizeof(protocol::FrameHeader));
+    for (fd_t fd : channel) {
+        if (setsockopt(fd, SOL_SOCKET, SO_SNDBUFFORCE, &buffer_size, sizeof(buffer_size)) != 0) {
+            return -1;
+        }
+    }
+
     pid_ = fork();
+    if (pid_ < 0) {
+        return -1;
+    }
     if (pid_ != 0) {
+        close(channel[1]);
+        channel_fd_ = channel[0];
         return pid_;
     }
 
+    close(channel[0]);
+    channel_fd_ = channel[1];
     serve();
 }
 
@@ -49,6 +71,10 @@ pid_t Worker::get_pid() const {
     return pid_;
 }
 
+fd_t Worker::get_channel_fd() const {
+    return channel_fd_;
+}
+
 void Worker::serve() {
     worker_ = this;
     ContextManager::set(this, "worker");
@@ -67,198 +93,233 @@ void Worker::serve() {
         raise(SIGKILL);
     }
 
-    request_validator_ = std::make_unique<SchemaValidator>(request_schema_data);
-    if (!request_validator_->get_error().empty()) {
-        die(request_validator_->get_error());
-    }
-
     // We need check containers' exit codes asynchronously to avoid deadlocks
     set_sigchld_action(sigchld_action);
 
+    container_pool_ = std::make_unique<ContainerPool>(
+        id_getter_,
+        Config::get().get_pool_prewarm(),
+        Config::get().get_pool_max_idle()
+    );
+    while (container_pool_->refill_step()) {}
+
     while (!terminated_) {
-        // If worker is terminated we want accept() to be interrupted
+        // If worker is terminated we want waiting for next job to be interrupted
         set_standard_handler_restart(SIGTERM, false);
-
-        // Accept connection on socket
-        socket_fd_ = accept(server_socket_fd_, nullptr, nullptr);
-        if (socket_fd_ < 0) {
-            if (terminated_) {
-                break;
-            }
-            die(format("Failed to accept connection: %m"));
-        }
-
-        // If worker is terminated we want to complete current request, so we don't want to interrupt anything
+        std::string packet;
+        ssize_t cnt = protocol::read_packet(channel_fd_, packet);
+        // If worker is terminated we want to complete current job, so we don't want to interrupt anything
         set_standard_handler_restart(SIGTERM, true);
-
-        // Read from socket until end-of-file or null-byte
-        std::string request;
-        while (true) {
-            char buf[1024];
-            int bytes_read = recv(socket_fd_, buf, sizeof(buf) - 1, 0);
-            if (bytes_read < 0) {
-                die(format("Failed to receive data: %m"));
-            }
-            if (bytes_read == 0) {
-                break;
-            }
-
-            buf[bytes_read] = 0;
-            request += buf;
-
-            if (strlen(buf) < static_cast<size_t>(bytes_read)) {
-                // null-byte occurs in buf
-                break;
-            }
+        if (cnt < 0 && errno == EINTR) {
+            continue;
+        }
+        if (cnt < 0) {
+            die(format("Failed to receive job: %m"));
+        }
+        if (cnt == 0) {
+            // Daemon is gone
+            break;
         }
 
-        std::string response = process(request);
-
-        int cnt = write(socket_fd_, response.c_str(), response.size());
-        if (cnt < 0 || static_cast<size_t>(cnt) != response.size()) {
-            die(format("Cannot send response: %m"));
+        protocol::FrameHeader header{};
+        if (packet.size() < sizeof(header)) {
+            die("Job is incorrect");
+        }
+        memcpy(&header, packet.data(), sizeof(header));
+        if (header.type != protocol::FRAME_REQUEST || header.length != packet.size() - sizeof(header)) {
+            die("Job is incorrect");
         }
 
-        if (close(socket_fd_) != 0) {
-            die(format("Cannot close socket: %m"));
+        job_id_ = header.request_id;
+        std::string response = process(packet.substr(sizeof(header)));
+        if (protocol::write_frame(channel_fd_, header.request_id, protocol::FRAME_RESPONSE, response) < 0) {
+            die(format("Failed to send job results: %m"));
         }
+
+        // Prepare containers for next job while waiting for it, but don't delay job, which has already arrived
+        while (!terminated_ && !is_job_waiting() && container_pool_->refill_step()) {}
     }
 
     _exit(0);
 }
 
+bool Worker::is_job_waiting() {
+    struct pollfd poll_fd = {channel_fd_, POLLIN, 0};
+    int cnt = poll(&poll_fd, 1, 0);
+    if (cnt < 0 && errno != EINTR) {
+        die(format("Cannot poll channel: %m"));
+    }
+    return cnt > 0;
+}
+
 std::string Worker::process(const std::string &request) {
-    auto error = parse_and_validate_json_request(request);
-    if (error) {
-        rapidjson::StringBuffer string_buffer;
-        rapidjson::Writer<rapidjson::StringBuffer> writer(string_buffer);
-        writer.StartObject();
-        writer.Key("error");
-        writer.String(error.get().c_str());
-        writer.EndObject();
-        return string_buffer.GetString();
+    auto error = parse_request(request);
+    if (!error) {
+        error = run_request();
+        if (!error) {
+            return serialize_results();
+        }
+        delete_tasks();
     }
 
+    BinaryWriter writer;
+    writer.write_uint32(1);
+    writer.write_string(error.get());
+    return writer.get();
+}
+
+Error Worker::run_request() {
+    int64_t start_ns = get_monotonic_ns();
     prepare_containers();
+    record_stage(STAGE_PREPARE_CONTAINERS, start_ns);
+
     // To start execution we must wait for worker + all containers + all slaves
     run_start_barrier_.reset(containers_.size() * 2 + 1);
-    write_tasks();
-    run_tasks();
-    close_pipes();
 
-    return collect_results();
-}
+    start_ns = get_monotonic_ns();
+    write_tasks();
+    record_stage(STAGE_WRITE_TASKS, start_ns);
 
-Error Worker::parse_and_validate_json_request(const std::string &request) {
-    rapidjson::Document document;
-    document.Parse(request.c_str());
+    start_ns = get_monotonic_ns();
+    auto error = run_tasks();
+    record_stage(STAGE_START_SYNC, start_ns);
 
-    if (document.HasParseError()) {
-        return Error(format(
-            "Request JSON incorrect: %s (at %zi)",
-            GetParseError_En(document.GetParseError()),
-            document.GetErrorOffset()
-        ));
+    close_pipes();
+    if (error) {
+        release_aborted();
+    } else {
+        collect_results();
     }
+    close_buffers();
+    return error;
+}
 
-    if (!request_validator_->validate(document)) {
-        return Error(request_validator_->get_error());
+void Worker::record_stage(Stage stage, int64_t start_ns) {
+    int64_t ns = get_monotonic_ns() - start_ns;
+    Stats::record(stage, ns);
+    for (auto task : tasks_) {
+        if (task->get_collect_timings()) {
+            task->set_timing_ns(STAGE_NAMES[stage], ns);
+        }
     }
+}
 
+Error Worker::parse_request(const std::string &request) {
     assert(tasks_.empty());
 
-    for (const auto &json_task : document["tasks"].GetArray()) {
+    BinaryReader reader(request.data(), request.size());
+    for (uint32_t i = reader.read_uint32(); i > 0 && !reader.failed(); --i) {
         libsbox::Task *task = new libsbox::Task();
-        task->deserialize_request(json_task);
+        task->deserialize_request(reader);
         tasks_.push_back(task);
     }
 
+    if (reader.failed() || !reader.at_end()) {
+        delete_tasks();
+        return Error("Binary request is incorrect");
+    }
+    // Worker, containers and slaves must fit into run start barrier
+    if (tasks_.size() * 2 + 1 > SharedBarrier::MAX_PARTICIPANTS) {
+        delete_tasks();
+        return Error(format("At most %u tasks connected with pipes may run together",
+                            (SharedBarrier::MAX_PARTICIPANTS - 1) / 2));
+    }
+
     return Error();
 }
 
 void Worker::prepare_containers() {
-    size_t next_permanent_container = 0;
     for (auto task : tasks_) {
-        bool permanent_container_allowed = true;
-        if (task->get_need_ipc() || !task->get_use_standard_binds()) {
-            permanent_container_allowed = false;
-        }
-
-        Container *created_container = nullptr;
-        if (permanent_container_allowed) {
-            if (next_permanent_container == permanent_containers_.size()) {
-                created_container = new Container(id_getter_->get(), true);
-                permanent_containers_.emplace_back(created_container);
-            }
-            containers_.push_back(permanent_containers_[next_permanent_container].get());
-            next_permanent_container++;
-        } else {
-            created_container = new Container(id_getter_->get(), false);
-            temporary_containers_.emplace_back(created_container);
-            containers_.push_back(created_container);
-        }
-
-        if (created_container != nullptr) {
-            if (created_container->start() < 0) {
-                die(format("Cannot start() container: %m"));
-            }
-        }
+        ContainerProfile profile;
+        profile.need_ipc = task->get_need_ipc();
+        profile.use_standard_binds = task->get_use_standard_binds();
+        containers_.push_back(container_pool_->acquire(profile));
     }
 }
 
 void Worker::write_tasks() {
     for (size_t i = 0; i < tasks_.size(); ++i) {
-        containers_[i]->set_task(tasks_[i]);
+        containers_[i]->set_task(tasks_[i], job_id_, static_cast<uint32_t>(i), static_cast<uint32_t>(1 + 2 * i));
     }
 }
 
-void Worker::run_tasks() {
+Error Worker::run_tasks() {
     // Containers are wait()ing for tasks on their barriers
     for (auto *container : containers_) {
-        container->get_barrier()->wait();
+        container->get_barrier()->wait(0);
     }
     // Wait for run start
-    run_start_barrier_.wait();
+    if (!run_start_barrier_.wait(0, get_barrier_timeout_ns())) {
+        std::string missing;
+        for (uint32_t participant : run_start_barrier_.get_missing()) {
+            // Container of task i is participant 2i+1, its slave is 2i+2
+            missing += format(" %s of task %u", participant % 2 == 1 ? "container" : "slave", (participant - 1) / 2);
+        }
+        // Boxes, which have come, kill their slaves at once, late ones do it when they come
+        run_start_barrier_.abort();
+        return Error(format("Run start timed out, missing:%s", missing.c_str()));
+    }
+    return Error();
+}
+
+void Worker::release_aborted() {
+    for (auto *container : containers_) {
+        if (container->get_barrier()->wait(0, get_barrier_timeout_ns())) {
+            container_pool_->release(container);
+            continue;
+        }
+        // Container is stuck for good
+        discarded_pid_ = container->get_pid();
+        container_pool_->discard(container);
+        discarded_pid_ = -1;
+    }
+    containers_.clear();
 }
 
-std::string Worker::collect_results() {
+int64_t Worker::get_barrier_timeout_ns() {
+    int64_t timeout_ms = Config::get().get_barrier_timeout_ms();
+    return timeout_ms == -1 ? -1 : timeout_ms * 1000000;
+}
+
+void Worker::collect_results() {
+    for (size_t i = 0; i < tasks_.size(); ++i) {
+        containers_[i]->get_barrier()->wait(0);
+    }
+
+    // Waiting above is the run itself, so only copying of results is timed
+    int64_t start_ns = get_monotonic_ns();
     for (size_t i = 0; i < tasks_.size(); ++i) {
-        containers_[i]->get_barrier()->wait();
         containers_[i]->put_results(tasks_[i]);
     }
 
-    rapidjson::StringBuffer buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    for (auto *container : containers_) {
+        container_pool_->release(container);
+    }
+    containers_.clear();
+    record_stage(STAGE_COLLECT_RESULTS, start_ns);
+}
 
-    writer.StartObject();
-    writer.Key("tasks");
-    writer.StartArray();
+std::string Worker::serialize_results() {
+    BinaryWriter writer;
+    writer.write_uint32(0);
+    writer.write_uint32(static_cast<uint32_t>(tasks_.size()));
     for (auto task : tasks_) {
         task->serialize_response(writer);
-        delete task;
     }
-    writer.EndArray();
-    writer.EndObject();
-    tasks_.clear();
 
-    std::string result = buffer.GetString();
+    delete_tasks();
+    return writer.get();
+}
 
-    for (auto &container : temporary_containers_) {
-        id_getter_->put(container->get_id());
-        int status;
-        pid_t pid = waitpid(container->get_pid(), &status, 0);
-        if (pid < 0) {
-            die(format("Cannot wait() for temporary container: %m"));
-        }
-        // We don't need to check status here, it was checked in sigaction
+void Worker::delete_tasks() {
+    for (auto task : tasks_) {
+        delete task;
     }
-    temporary_containers_.clear();
-    containers_.clear();
-
-    return result;
+    tasks_.clear();
 }
 
 void Worker::sigchld_action(int, siginfo_t *siginfo, void *) {
+    if (siginfo->si_pid == worker_->discarded_pid_) return;
     if (siginfo->si_code != CLD_EXITED || siginfo->si_status != 0) {
         if (siginfo->si_code == CLD_EXITED) {
             die(format("Container exited with exit code %d", siginfo->si_status));
@@ -292,6 +353,61 @@ void Worker::close_pipes() {
     pipes_.clear();
 }
 
+fd_t Worker::create_input_buffer(const std::string &data) {
+    fd_t fd = memfd_create("libsbox-input", MFD_CLOEXEC);
+    if (fd < 0) {
+        die(format("Cannot create memfd: %m"));
+    }
+    buffers_.push_back(fd);
+
+    // Offset stays at zero, so slave reads input from the beginning
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t cnt = pwrite(fd, data.data() + written, data.size() - written, static_cast<off_t>(written));
+        if (cnt < 0) {
+            die(format("Cannot write to memfd: %m"));
+        }
+        written += static_cast<size_t>(cnt);
+    }
+    return fd;
+}
+
+fd_t Worker::create_capture_buffer() {
+    fd_t fd = memfd_create("libsbox-capture", MFD_CLOEXEC);
+    if (fd < 0) {
+        die(format("Cannot create memfd: %m"));
+    }
+    buffers_.push_back(fd);
+    return fd;
+}
+
+std::pair<fd_t, fd_t> Worker::create_capture_pipe() {
+    fd_t fd[2];
+    if (pipe2(fd, O_CLOEXEC) != 0) {
+        die(format("Cannot create pipe: %m"));
+    }
+    buffers_.push_back(fd[0]);
+    buffers_.push_back(fd[1]);
+    // Write end becomes stdout of program, so it stays blocking
+    if (fcntl(fd[0], F_SETFL, O_NONBLOCK) != 0) {
+        die(format("Cannot make pipe non-blocking: %m"));
+    }
+    return {fd[0], fd[1]};
+}
+
+void Worker::close_buffers() {
+    for (fd_t fd : buffers_) {
+        if (close(fd) != 0) {
+            die(format("Cannot close buffer: %m"));
+        }
+    }
+    buffers_.clear();
+}
+
 SharedBarrier *Worker::get_run_start_barrier() {
     return &run_start_barrier_;
 }
+
+const cpuset::BoxSet &Worker::get_box_set() const {
+    return box_set_;
+}
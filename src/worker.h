@@ -9,16 +9,20 @@
 #include "shared_id_getter.h"
 #include "shared_barrier.h"
 #include "container.h"
-#include "schema_validator.h"
+#include "container_pool.h"
+#include "stage.h"
+#include "cpuset.h"
 
 #include <sys/signal.h>
 #include <map>
 
 class Worker final : public ContextManager {
 public:
-    Worker(fd_t server_socket_fd, SharedIdGetter *id_getter);
+    // Containers of worker run on cpus and node of box set, or anywhere if its cpus are empty
+    Worker(SharedIdGetter *id_getter, cpuset::BoxSet box_set);
 
     static Worker &get();
+    // Spawn worker process connected to daemon with channel
     pid_t start();
 
     [[noreturn]]
@@ -26,36 +30,61 @@ public:
     void terminate() override;
 
     pid_t get_pid() const;
+    // Daemon's end of channel. Daemon sends FRAME_REQUEST with binary request (without priority) and worker answers
+    // with FRAME_RESPONSE carrying binary response, request id is the id of job assigned by daemon. While job runs,
+    // its containers send FRAME_TELEMETRY through the same channel
+    fd_t get_channel_fd() const;
 
     std::pair<fd_t, fd_t> get_pipe(const std::string &pipe_name);
+    // memfds of inline input and captured output and pipes of captured output, they are closed when job completes
+    fd_t create_input_buffer(const std::string &data);
+    fd_t create_capture_buffer();
+    // Read end is non-blocking, so container can drain it without knowing whether program has written anything
+    std::pair<fd_t, fd_t> create_capture_pipe();
+    // Barrier of worker (participant 0), containers and slaves of current request, see Container::set_task()
     SharedBarrier *get_run_start_barrier();
+    const cpuset::BoxSet &get_box_set() const;
 private:
     static Worker *worker_;
-    fd_t server_socket_fd_;
-    fd_t socket_fd_ = -1;
+    fd_t channel_fd_ = -1;
     SharedIdGetter *id_getter_;
+    cpuset::BoxSet box_set_;
     SharedBarrier run_start_barrier_{1};
     pid_t pid_{-1};
     std::vector<libsbox::Task *> tasks_;
+    // Id of job being processed
+    uint64_t job_id_ = 0;
 
     volatile bool terminated_ = false;
+    // Container being killed by worker, its death is expected
+    volatile pid_t discarded_pid_ = -1;
 
-    std::vector<std::unique_ptr<Container>> permanent_containers_;
-    std::vector<std::unique_ptr<Container>> temporary_containers_;
+    std::unique_ptr<ContainerPool> container_pool_;
     std::vector<Container *> containers_;
-    std::unique_ptr<SchemaValidator> request_validator_;
 
     std::map<std::string, std::pair<fd_t, fd_t>> pipes_;
     void close_pipes();
+    std::vector<fd_t> buffers_;
+    void close_buffers();
 
     [[noreturn]]
     void serve();
+    bool is_job_waiting();
     std::string process(const std::string &request);
-    Error parse_and_validate_json_request(const std::string &request);
+    Error parse_request(const std::string &request);
     void prepare_containers();
     void write_tasks();
-    void run_tasks();
-    std::string collect_results();
+    // Returns error listing boxes, which haven't come to run start in time, then run is aborted
+    Error run_tasks();
+    void collect_results();
+    // Return containers of aborted run to pool, they report without results after killing their slaves
+    void release_aborted();
+    Error run_request();
+    static int64_t get_barrier_timeout_ns();
+    std::string serialize_results();
+    void delete_tasks();
+    // Record stage which started at start_ns and ends now, in stats and in timings of tasks which asked for them
+    void record_stage(Stage stage, int64_t start_ns);
 
     static void sigchld_action(int, siginfo_t *siginfo, void *);
 };
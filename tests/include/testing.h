@@ -43,6 +43,29 @@ public:
         }
     }
 
+    // Session mode named by test argument: "json", "binary" or "shm"
+    inline static libsbox::Session::Mode parse_mode(const std::string &mode) {
+        static const std::map<std::string, libsbox::Session::Mode> modes = {
+            {"json", libsbox::Session::Mode::JSON},
+            {"binary", libsbox::Session::Mode::BINARY},
+            {"shm", libsbox::Session::Mode::SHARED_MEMORY},
+        };
+        auto it = modes.find(mode);
+        if (it == modes.end()) {
+            std::cerr << "Unknown session mode: " << mode << std::endl;
+            exit(1);
+        }
+        return it->second;
+    }
+
+    inline static void safe_connect(libsbox::Session &session, const std::string &mode) {
+        auto error = session.connect("/etc/libsboxd/socket", parse_mode(mode));
+        if (error) {
+            std::cerr << "Failed to connect: " << error.get() << std::endl;
+            exit(1);
+        }
+    }
+
     inline static fs::path resolve_path(const fs::path &path) {
         std::error_code error;
         auto res = fs::absolute(path, error);
@@ -107,6 +130,8 @@ public:
         stream << "term_signal: " << get_term_signal() << std::endl;
         stream << "oom_killed?: " << is_oom_killed() << std::endl;
         stream << "memory_limit_hit?: " << is_memory_limit_hit() << std::endl;
+        stream << "oom_time_ms: " << get_oom_time_ms() << std::endl;
+        stream << "oom_memory_usage_kb: " << get_oom_memory_usage_kb() << std::endl;
     }
 
     void assert_exited(int code = -1) {
@@ -118,6 +143,7 @@ public:
         assert(get_term_signal() == -1);
         assert(!is_oom_killed());
         assert(!is_memory_limit_hit());
+        assert(get_oom_time_ms() == -1);
     }
 
     void assert_killed(int signal = -1) {
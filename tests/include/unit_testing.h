@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#ifndef LIBSBOX_UNIT_TESTING_H
+#define LIBSBOX_UNIT_TESTING_H
+
+#include "testing.h"
+#include "context_manager.h"
+
+#include <sys/wait.h>
+
+// Tests of daemon internals are built from daemon sources, which report critical errors through context manager
+class UnitTesting final : public ContextManager {
+public:
+    [[noreturn]]
+    void _die(const std::string &error) override {
+        std::cerr << get_name() << ": " << error << std::endl;
+        _exit(1);
+    }
+
+    void terminate() override {}
+
+    // Must be called before daemon code is used, forked processes inherit context
+    inline static void init() {
+        static UnitTesting context;
+        ContextManager::set(&context, "test");
+    }
+
+    // Wait for given child processes, returns false if some of them failed
+    inline static bool wait_all(const std::vector<pid_t> &pids) {
+        bool ok = true;
+        for (pid_t pid : pids) {
+            int status;
+            if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                ok = false;
+            }
+        }
+        return ok;
+    }
+};
+
+#endif //LIBSBOX_UNIT_TESTING_H
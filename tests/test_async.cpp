@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "testing.h"
+
+#include <memory>
+#include <sys/epoll.h>
+
+static int invoker_main(const std::vector<std::string> &args) {
+    // Sessions don't occupy workers, requests of all sessions share daemon's queue
+    int num_sessions = stoi(args[0]);
+    int runs_per_session = stoi(args[1]);
+    // In shared memory mode requests that don't get free ring slot go through socket
+    auto mode = Testing::parse_mode(args[2]);
+
+    std::vector<std::unique_ptr<libsbox::Session>> sessions;
+    std::vector<std::unique_ptr<GenericTarget>> targets;
+    int completed = 0;
+
+    int epoll_fd = epoll_create1(0);
+    assert(epoll_fd >= 0);
+
+    for (int i = 0; i < num_sessions; ++i) {
+        sessions.push_back(std::make_unique<libsbox::Session>());
+        auto error = sessions.back()->connect("/etc/libsboxd/socket", mode);
+        if (error) {
+            std::cerr << "Failed to connect: " << error.get() << std::endl;
+            return 1;
+        }
+
+        // All requests are queued at once, each session executes them one after another
+        for (int j = 0; j < runs_per_session; ++j) {
+            int exit_code = (i * runs_per_session + j) % 256;
+            targets.push_back(std::make_unique<GenericTarget>(
+                GenericTarget::from_current_executable("target", std::to_string(exit_code))
+            ));
+            GenericTarget *target = targets.back().get();
+            error = sessions.back()->submit({target}, [target, exit_code, &completed](const Error &run_error) {
+                if (run_error) {
+                    std::cerr << "Failed to run tasks: " << run_error.get() << std::endl;
+                    exit(1);
+                }
+                target->assert_exited(exit_code);
+                ++completed;
+            });
+            assert(!error);
+        }
+
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT;
+        event.data.u32 = static_cast<uint32_t>(i);
+        assert(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sessions.back()->get_fd(), &event) == 0);
+    }
+
+    // Single thread drives all sessions
+    while (completed < num_sessions * runs_per_session) {
+        epoll_event events[16];
+        int cnt = epoll_wait(epoll_fd, events, 16, -1);
+        assert(cnt >= 0 || errno == EINTR);
+        for (int i = 0; i < cnt; ++i) {
+            auto &session = sessions[events[i].data.u32];
+            auto error = session->process_events();
+            if (error) {
+                std::cerr << "Failed to process events: " << error.get() << std::endl;
+                return 1;
+            }
+
+            epoll_event event{};
+            event.events = EPOLLIN | (session->wants_write() ? static_cast<uint32_t>(EPOLLOUT) : 0);
+            event.data.u32 = events[i].data.u32;
+            assert(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, session->get_fd(), &event) == 0);
+        }
+    }
+
+    // Future-based submission on already connected session
+    GenericTarget target = GenericTarget::from_current_executable("target", "42");
+    auto future = sessions[0]->submit({&target});
+    while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        auto error = sessions[0]->wait_one();
+        assert(!error);
+    }
+    assert(!future.get());
+    target.assert_exited(42);
+
+    // Callback may run requests on its own session, while response of other request is already received
+    libsbox::Session &session = *sessions[0];
+    GenericTarget first = GenericTarget::from_current_executable("target", "1");
+    GenericTarget second = GenericTarget::from_current_executable("target", "2");
+    GenericTarget nested = GenericTarget::from_current_executable("target", "3");
+    auto error = session.submit({&first}, [&session, &first, &nested](const Error &run_error) {
+        assert(!run_error);
+        first.assert_exited(1);
+        auto nested_error = session.run_together({&nested});
+        assert(!nested_error);
+        nested.assert_exited(3);
+    });
+    assert(!error);
+    error = session.submit({&second}, [&second](const Error &run_error) {
+        assert(!run_error);
+        second.assert_exited(2);
+    });
+    assert(!error);
+    while (session.get_pending_count() != 0) {
+        error = session.wait_one();
+        assert(!error);
+    }
+
+    close(epoll_fd);
+    return 0;
+}
+
+static int target_main(const std::vector<std::string> &args) {
+    return stoi(args[0]);
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("invoker", invoker_main);
+    Testing::add_handler("target", target_main);
+    Testing::start(argc, argv);
+}
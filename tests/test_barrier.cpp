@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "unit_testing.h"
+#include "shared_barrier.h"
+#include "shared_memory_array.h"
+
+#include <atomic>
+
+static const int64_t SHORT_TIMEOUT_NS = 50000000;
+
+// Nobody may pass barrier of generation before everyone has counted arrival to it
+static int pass_generations(SharedBarrier &barrier, SharedMemoryArray<std::atomic<uint32_t>> &arrivals,
+                            uint32_t participant, uint32_t count) {
+    for (size_t generation = 0; generation < arrivals.size(); ++generation) {
+        arrivals[generation]++;
+        if (!barrier.wait(participant)) {
+            std::cerr << "Participant " << participant << " failed wait in generation " << generation << std::endl;
+            return 1;
+        }
+        if (arrivals[generation] != count) {
+            std::cerr << "Participant " << participant << " passed generation " << generation << " with "
+                      << arrivals[generation] << " arrivals" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static bool check_reuse(SharedBarrier &barrier, uint32_t count, size_t generations) {
+    SharedMemoryArray<std::atomic<uint32_t>> arrivals(generations);
+    barrier.reset(count);
+    std::vector<pid_t> pids;
+    for (uint32_t participant = 1; participant < count; ++participant) {
+        pid_t pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            _exit(pass_generations(barrier, arrivals, participant, count));
+        }
+        pids.push_back(pid);
+    }
+    bool ok = (pass_generations(barrier, arrivals, 0, count) == 0);
+    return UnitTesting::wait_all(pids) && ok;
+}
+
+static bool check_timeout(SharedBarrier &barrier) {
+    barrier.reset(3);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        _exit(barrier.wait(1) ? 1 : 0);
+    }
+    // Participant 1 comes, participant 2 never does
+    while (barrier.get_missing().size() > 2) {
+        usleep(1000);
+    }
+    bool timed_out = !barrier.wait(0, SHORT_TIMEOUT_NS);
+    std::vector<uint32_t> missing = barrier.get_missing();
+    if (!timed_out || missing != std::vector<uint32_t>{2}) {
+        std::cerr << "Timeout is not reported with missing participant" << std::endl;
+        return false;
+    }
+    // Participant 1 is released by abort, and those coming later don't wait at all
+    barrier.abort();
+    if (!UnitTesting::wait_all({pid}) || barrier.wait(2)) {
+        std::cerr << "Aborted barrier let participant through" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static int invoker_main(const std::vector<std::string> &args) {
+    UnitTesting::init();
+    uint32_t count = static_cast<uint32_t>(stoi(args[0]));
+    size_t generations = static_cast<size_t>(stoi(args[1]));
+
+    SharedBarrier barrier(count);
+    if (!check_reuse(barrier, count, generations)) {
+        return 1;
+    }
+    // Barrier broken by timeout and abort is usable again after reset
+    if (!check_timeout(barrier) || !check_reuse(barrier, count, generations)) {
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("invoker", invoker_main);
+    Testing::start(argc, argv);
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "testing.h"
+
+static int invoker_main(const std::vector<std::string> &args) {
+    int repeat = stoi(args[1]);
+    int64_t limit = stoi(args[2]);
+
+    libsbox::Session session;
+    Testing::safe_connect(session, args[0]);
+
+    // Zero byte must survive every encoding
+    std::string input("line\0of input\n", 14);
+    GenericTarget target = GenericTarget::from_current_executable("target", args[1]);
+    target.get_stdin().use_data(input);
+    target.get_stdout().capture(limit);
+    target.get_stderr().capture(limit);
+    auto error = session.run_together({&target});
+    if (error) {
+        std::cerr << "Failed to run: " << error.get() << std::endl;
+        return 1;
+    }
+    target.print_stats(std::cerr);
+    target.assert_exited(0);
+
+    std::string expected_output;
+    for (int i = 0; i < repeat; ++i) {
+        expected_output += input;
+    }
+    std::string expected_error = std::to_string(input.size()) + "\n";
+    std::cerr << "stdout: " << target.get_stdout().get_data().size() << " bytes, truncated? "
+              << target.get_stdout().is_truncated() << std::endl;
+    assert(target.get_stdout().get_data() == expected_output.substr(0, static_cast<size_t>(limit)));
+    assert(target.get_stdout().is_truncated() == (static_cast<int64_t>(expected_output.size()) > limit));
+    assert(target.get_stderr().get_data() == expected_error.substr(0, static_cast<size_t>(limit)));
+    assert(target.get_stderr().is_truncated() == (static_cast<int64_t>(expected_error.size()) > limit));
+
+    // Invalid use of streams is rejected by daemon
+    GenericTarget invalid = GenericTarget::from_current_executable("target", "1");
+    invalid.get_stdin().capture(limit);
+    assert(session.run_together({&invalid}));
+    return 0;
+}
+
+static int target_main(const std::vector<std::string> &args) {
+    std::string input((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+    std::cerr << input.size() << std::endl;
+    // Output goes out in chunks of stdio buffer, so one of them crosses capture limit
+    for (int i = stoi(args[0]); i > 0; --i) {
+        std::cout << input;
+    }
+    std::cout.flush();
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("invoker", invoker_main);
+    Testing::add_handler("target", target_main);
+    Testing::start(argc, argv);
+}
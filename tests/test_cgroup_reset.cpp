@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "testing.h"
+
+#include <cstdio>
+#include <cstring>
+#include <time.h>
+
+static const int BUSY_TIME_MS = 300;
+static const size_t BUSY_MEMORY_BYTES = 64 * 1024 * 1024;
+// Idle run takes much less than busy one, so counters left from busy run are noticed
+static const int64_t IDLE_TIME_LIMIT_MS = BUSY_TIME_MS / 3;
+static const int64_t IDLE_MEMORY_LIMIT_KB = BUSY_MEMORY_BYTES / 1024 / 2;
+
+static void run_idle() {
+    GenericTarget idle = GenericTarget::from_current_executable("idle");
+    Testing::safe_run({&idle});
+    idle.print_stats(std::cerr);
+    idle.assert_exited(0);
+    assert(idle.get_time_usage_ms() < IDLE_TIME_LIMIT_MS);
+    assert(idle.get_memory_usage_kb() < IDLE_MEMORY_LIMIT_KB);
+}
+
+// Idle runs follow busy ones and ones leaving large file in /tmp. Pool gives the same box back to sequential runs, so
+// its cgroup is reused
+static int invoker_main(const std::vector<std::string> &args) {
+    int runs = stoi(args[0]);
+    for (int i = 0; i < runs; ++i) {
+        GenericTarget busy = GenericTarget::from_current_executable("busy");
+        Testing::safe_run({&busy});
+        busy.assert_exited(0);
+        run_idle();
+
+        // Pages of file stay charged to cgroup of box until file is removed
+        GenericTarget writer = GenericTarget::from_current_executable("writer");
+        Testing::safe_run({&writer});
+        writer.assert_exited(0);
+        run_idle();
+    }
+    return 0;
+}
+
+static int busy_main(const std::vector<std::string> &) {
+    char *memory = static_cast<char *>(malloc(BUSY_MEMORY_BYTES));
+    if (memory == nullptr) {
+        return 1;
+    }
+    memset(memory, 1, BUSY_MEMORY_BYTES);
+    asm volatile ("" : : "r"(memory) : "memory");
+    free(memory);
+    while (static_cast<double>(clock()) / CLOCKS_PER_SEC < static_cast<double>(BUSY_TIME_MS) / 1000) {
+        asm volatile ("" : : : "memory");
+    }
+    return 0;
+}
+
+static int writer_main(const std::vector<std::string> &) {
+    FILE *file = fopen("/tmp/data", "w");
+    if (file == nullptr) {
+        return 1;
+    }
+    std::vector<char> block(1024 * 1024, 1);
+    for (size_t written = 0; written < BUSY_MEMORY_BYTES; written += block.size()) {
+        if (fwrite(block.data(), 1, block.size(), file) != block.size()) {
+            return 1;
+        }
+    }
+    return fclose(file) == 0 ? 0 : 1;
+}
+
+static int idle_main(const std::vector<std::string> &) {
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("invoker", invoker_main);
+    Testing::add_handler("busy", busy_main);
+    Testing::add_handler("writer", writer_main);
+    Testing::add_handler("idle", idle_main);
+    Testing::start(argc, argv);
+}
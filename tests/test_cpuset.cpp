@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "testing.h"
+
+#include <fstream>
+#include <sched.h>
+#include <set>
+#include <sstream>
+#include <rapidjson/document.h>
+
+static int invoker_main(const std::vector<std::string> &args) {
+    std::ifstream in("/etc/libsboxd/conf.json");
+    std::stringstream config;
+    config << in.rdbuf();
+    rapidjson::Document document;
+    document.Parse(config.str().c_str());
+    assert(!document.HasParseError());
+    std::string policy = document.HasMember("cpuset") ? document["cpuset"].GetString() : "none";
+    std::string housekeeping = "0";
+    if (document.HasMember("housekeeping_cpus")) {
+        housekeeping = document["housekeeping_cpus"].GetString();
+    }
+
+    // Every run of box must see the same cpus, no matter which box it gets
+    int runs = stoi(args[0]);
+    for (int i = 0; i < runs; ++i) {
+        GenericTarget target = GenericTarget::from_current_executable("target", policy, housekeeping);
+        auto error = libsbox::run_together({&target});
+        if (error) {
+            std::cerr << "Failed to run tasks: " << error.get() << std::endl;
+            return 1;
+        }
+        target.assert_exited(0);
+    }
+    return 0;
+}
+
+static std::set<int> parse_list(const std::string &list) {
+    std::set<int> cpus;
+    std::stringstream sstream(list);
+    std::string range;
+    while (std::getline(sstream, range, ',')) {
+        size_t dash = range.find('-');
+        int first = stoi(range.substr(0, dash));
+        int last = (dash == std::string::npos ? first : stoi(range.substr(dash + 1)));
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.insert(cpu);
+        }
+    }
+    return cpus;
+}
+
+static int target_main(const std::vector<std::string> &args) {
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    assert(sched_getaffinity(0, sizeof(mask), &mask) == 0);
+    if (args[0] == "none") {
+        return 0;
+    }
+
+    // Box must not run on housekeeping cpus
+    for (int cpu : parse_list(args[1])) {
+        assert(!CPU_ISSET(static_cast<size_t>(cpu), &mask));
+    }
+    if (args[0] == "cpu") {
+        assert(CPU_COUNT(&mask) == 1);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("invoker", invoker_main);
+    Testing::add_handler("target", target_main);
+    Testing::start(argc, argv);
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "unit_testing.h"
+#include "shared_id_getter.h"
+
+#include <atomic>
+#include <sched.h>
+#include <set>
+
+static const uid_t FIRST_ID = 5678;
+// Not multiple of bitmap word, so IDs past the end of range are covered too
+static const uid_t ID_COUNT = 100;
+
+// Every process holds its share of IDs at once and gives them back, so all IDs are taken and returned concurrently.
+// Owner of every ID is recorded, ID given to two processes at once is caught by compare-and-swap
+static int hold_ids(SharedIdGetter &getter, SharedMemoryArray<std::atomic<pid_t>> &owners, uid_t held, int rounds) {
+    std::vector<uid_t> ids;
+    for (int round = 0; round < rounds; ++round) {
+        for (uid_t i = 0; i < held; ++i) {
+            uid_t id = getter.get();
+            if (id < FIRST_ID || id >= FIRST_ID + ID_COUNT) {
+                std::cerr << "ID " << id << " is out of range" << std::endl;
+                return 1;
+            }
+            pid_t expected = 0;
+            if (!owners[id - FIRST_ID].compare_exchange_strong(expected, getpid())) {
+                std::cerr << "ID " << id << " is given to " << getpid() << " while " << expected << " holds it"
+                          << std::endl;
+                return 1;
+            }
+            ids.push_back(id);
+        }
+        sched_yield();
+        for (uid_t id : ids) {
+            owners[id - FIRST_ID] = 0;
+            getter.put(id);
+        }
+        ids.clear();
+    }
+    return 0;
+}
+
+static int invoker_main(const std::vector<std::string> &args) {
+    UnitTesting::init();
+    uid_t processes = static_cast<uid_t>(stoi(args[0]));
+    int rounds = stoi(args[1]);
+    SharedIdGetter getter(FIRST_ID, ID_COUNT);
+    SharedMemoryArray<std::atomic<pid_t>> owners(ID_COUNT);
+
+    std::vector<pid_t> pids;
+    for (uid_t i = 0; i < processes; ++i) {
+        pid_t pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            _exit(hold_ids(getter, owners, ID_COUNT / processes, rounds));
+        }
+        pids.push_back(pid);
+    }
+    if (!UnitTesting::wait_all(pids)) {
+        return 1;
+    }
+
+    // Everything is returned, so whole range is available again, lowest IDs first
+    std::set<uid_t> ids;
+    for (uid_t i = 0; i < ID_COUNT; ++i) {
+        uid_t id = getter.get();
+        if (id != FIRST_ID + i) {
+            std::cerr << "Got ID " << id << " instead of " << FIRST_ID + i << std::endl;
+            return 1;
+        }
+        ids.insert(id);
+    }
+    for (uid_t id : ids) {
+        getter.put(id);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("invoker", invoker_main);
+    Testing::start(argc, argv);
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "testing.h"
+
+#include <csignal>
+
+static int invoker_main(const std::vector<std::string> &args) {
+    int64_t instruction_limit = stoll(args[0]);
+    GenericTarget target = GenericTarget::from_current_executable("target");
+    target.set_collect_counters(true);
+    target.set_instruction_limit(instruction_limit);
+    target.set_wall_time_limit_ms(10000);
+    Testing::safe_run({&target});
+    target.print_stats(std::cerr);
+    std::cerr << "instructions: " << target.get_instructions() << std::endl;
+    std::cerr << "cycles: " << target.get_cycles() << std::endl;
+    std::cerr << "cache_misses: " << target.get_cache_misses() << std::endl;
+    std::cerr << "context_switches: " << target.get_context_switches() << std::endl;
+    if (target.get_instructions() == -1) {
+        std::cerr << "Hardware counters are not supported" << std::endl;
+        return 1;
+    }
+
+    assert(target.is_instruction_limit_exceeded());
+    assert(!target.is_wall_time_limit_exceeded());
+    target.assert_killed(SIGKILL);
+    assert(target.get_instructions() > instruction_limit);
+    assert(target.get_cycles() > 0);
+    return 0;
+}
+
+static int target_main(const std::vector<std::string> &) {
+    while (true) {
+        asm volatile ("" : : : "memory");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("invoker", invoker_main);
+    Testing::add_handler("target", target_main);
+    Testing::start(argc, argv);
+}
@@ -14,6 +14,12 @@ static int invoker_main(const std::vector<std::string> &args) {
     assert(!target.is_time_limit_exceeded());
     assert(!target.is_wall_time_limit_exceeded());
     assert(target.is_memory_limit_hit() || target.is_oom_killed());
+    // Box is killed as soon as it runs out of memory
+    if (target.get_oom_time_ms() != -1) {
+        assert(target.is_oom_killed());
+        assert(target.get_oom_time_ms() <= target.get_wall_time_usage_ms());
+        assert(target.get_oom_memory_usage_kb() > 0);
+    }
     return 0;
 }
 
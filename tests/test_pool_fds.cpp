@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "testing.h"
+
+#include <fstream>
+#include <sstream>
+
+// More tasks than pool keeps idle, so every round makes worker start containers and then retire excess ones
+static const int TASKS_PER_ROUND = 12;
+
+// Workers are the only children of daemon. Containers share descriptor table with their worker
+static size_t count_worker_fds() {
+    pid_t daemon_pid = -1;
+    std::ifstream("/run/libsboxd.pid") >> daemon_pid;
+    assert(daemon_pid > 0);
+    std::string daemon_dir = "/proc/" + std::to_string(daemon_pid);
+    std::ifstream children(daemon_dir + "/task/" + std::to_string(daemon_pid) + "/children");
+    size_t count = 0;
+    pid_t worker_pid;
+    while (children >> worker_pid) {
+        std::error_code error;
+        for (fs::directory_iterator it("/proc/" + std::to_string(worker_pid) + "/fd", error), end; it != end;
+             it.increment(error)) {
+            count++;
+        }
+        if (error) {
+            std::cerr << "Cannot list fds of worker " << worker_pid << ": " << error.message() << std::endl;
+            exit(1);
+        }
+    }
+    return count;
+}
+
+// Worker refills its pool after sending response, so count is taken when it stops changing
+static size_t get_settled_fd_count() {
+    size_t count = count_worker_fds();
+    for (int stable = 0; stable < 10;) {
+        usleep(50000);
+        size_t next = count_worker_fds();
+        stable = (next == count ? stable + 1 : 0);
+        count = next;
+    }
+    return count;
+}
+
+static void run_round() {
+    for (bool need_ipc : {false, true}) {
+        std::vector<GenericTarget> targets;
+        for (int i = 0; i < TASKS_PER_ROUND; ++i) {
+            targets.push_back(GenericTarget::from_current_executable("target"));
+            targets.back().set_need_ipc(need_ipc);
+        }
+        std::vector<libsbox::Task *> tasks;
+        for (auto &target : targets) {
+            tasks.push_back(&target);
+        }
+        Testing::safe_run(tasks);
+        for (auto &target : targets) {
+            target.assert_exited(0);
+        }
+    }
+}
+
+static int invoker_main(const std::vector<std::string> &args) {
+    // First round brings pool to its steady state
+    run_round();
+    size_t baseline = get_settled_fd_count();
+
+    int rounds = stoi(args[0]);
+    for (int i = 0; i < rounds; ++i) {
+        run_round();
+    }
+    size_t count = get_settled_fd_count();
+    std::cerr << "worker fds: " << baseline << " before, " << count << " after " << rounds << " rounds" << std::endl;
+    assert(count <= baseline);
+    return 0;
+}
+
+static int target_main(const std::vector<std::string> &) {
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("invoker", invoker_main);
+    Testing::add_handler("target", target_main);
+    Testing::start(argc, argv);
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "testing.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <sys/stat.h>
+#include <rapidjson/document.h>
+
+static int get_num_boxes() {
+    std::ifstream in("/etc/libsboxd/conf.json");
+    std::stringstream config;
+    config << in.rdbuf();
+    rapidjson::Document document;
+    document.Parse(config.str().c_str());
+    assert(!document.HasParseError() && document.HasMember("num_boxes") && document["num_boxes"].IsInt());
+    return document["num_boxes"].GetInt();
+}
+
+// Number of requests daemon has parsed and queued so far
+static uint64_t get_parsed_count() {
+    std::vector<libsbox::StageLatency> stages;
+    auto error = libsbox::get_stats(stages);
+    if (error) {
+        std::cerr << "Failed to get stats: " << error.get() << std::endl;
+        exit(1);
+    }
+    for (const auto &stage : stages) {
+        if (stage.stage == "parse") {
+            return stage.count;
+        }
+    }
+    std::cerr << "No parse stage in stats" << std::endl;
+    exit(1);
+}
+
+static int invoker_main(const std::vector<std::string> &args) {
+    libsbox::Session session;
+    Testing::safe_connect(session, args[0]);
+
+    // Every box is held by blocker, which runs until its gate (fifo) is closed, so requests below wait in queue
+    char gate_dir_template[] = "/tmp/test_priority_XXXXXX";
+    if (mkdtemp(gate_dir_template) == nullptr || chmod(gate_dir_template, 0755) != 0) {
+        std::cerr << "Failed to create gate dir" << std::endl;
+        return 1;
+    }
+    fs::path gate_dir = gate_dir_template;
+
+    std::vector<std::string> completed;
+    std::vector<std::unique_ptr<GenericTarget>> blockers;
+    int num_boxes = get_num_boxes();
+    for (int i = 0; i < num_boxes; ++i) {
+        std::string gate = "gate_" + std::to_string(i);
+        // Blocker opens gate with uid of box
+        if (mkfifo((gate_dir / gate).c_str(), 0666) != 0 || chmod((gate_dir / gate).c_str(), 0666) != 0) {
+            std::cerr << "Failed to create gate" << std::endl;
+            return 1;
+        }
+        blockers.push_back(std::make_unique<GenericTarget>(
+            GenericTarget::from_current_executable("blocker", "gates/" + gate)));
+        blockers.back()->get_binds().emplace_back("gates", gate_dir);
+        auto error = session.submit({blockers.back().get()}, [&completed](const Error &request_error) {
+            assert(!request_error);
+            completed.emplace_back("blocker");
+        });
+        assert(!error);
+    }
+    // Opening write end waits until blocker opens read end, so after that every box is busy
+    std::vector<int> gates;
+    for (int i = 0; i < num_boxes; ++i) {
+        int fd = open((gate_dir / ("gate_" + std::to_string(i))).c_str(), O_WRONLY | O_CLOEXEC);
+        assert(fd >= 0);
+        gates.push_back(fd);
+    }
+
+    uint64_t parsed_count = get_parsed_count();
+    GenericTarget low = GenericTarget::from_current_executable("target");
+    auto error = session.submit({&low}, [&completed](const Error &request_error) {
+        assert(!request_error);
+        completed.emplace_back("low");
+    });
+    assert(!error);
+    GenericTarget high = GenericTarget::from_current_executable("target");
+    session.set_priority(10);
+    error = session.submit({&high}, [&completed](const Error &request_error) {
+        assert(!request_error);
+        completed.emplace_back("high");
+    });
+    assert(!error);
+    // Both requests must be in queue before any box is freed
+    while (get_parsed_count() < parsed_count + 2) {
+        usleep(1000);
+    }
+
+    // Single freed box must get request with higher priority, although it was submitted later. Low one can't run
+    // until next box is freed, and that happens only after high one completes
+    close(gates[0]);
+    while (std::find(completed.begin(), completed.end(), "high") == completed.end()) {
+        error = session.wait_one();
+        if (error) {
+            std::cerr << "Failed to wait: " << error.get() << std::endl;
+            return 1;
+        }
+    }
+    for (size_t i = 1; i < gates.size(); ++i) {
+        close(gates[i]);
+    }
+    while (session.get_pending_count() != 0) {
+        error = session.wait_one();
+        if (error) {
+            std::cerr << "Failed to wait: " << error.get() << std::endl;
+            return 1;
+        }
+    }
+    fs::remove_all(gate_dir);
+
+    for (const auto &name : completed) {
+        std::cerr << name << " ";
+    }
+    std::cerr << std::endl;
+    auto high_it = std::find(completed.begin(), completed.end(), "high");
+    auto low_it = std::find(completed.begin(), completed.end(), "low");
+    assert(low_it != completed.end() && high_it < low_it);
+    for (auto &blocker : blockers) {
+        blocker->assert_exited(0);
+    }
+    low.assert_exited(0);
+    high.assert_exited(0);
+    return 0;
+}
+
+static int blocker_main(const std::vector<std::string> &args) {
+    int fd = open(args[0].c_str(), O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+    char buffer[16];
+    while (read(fd, buffer, sizeof(buffer)) > 0) {}
+    return 0;
+}
+
+static int target_main(const std::vector<std::string> &) {
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("invoker", invoker_main);
+    Testing::add_handler("blocker", blocker_main);
+    Testing::add_handler("target", target_main);
+    Testing::start(argc, argv);
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "testing.h"
+
+#include <fcntl.h>
+
+static const char MARKER[] = "/tmp/test_root_reset_marker";
+
+// Every run writes marker and checks that marker of previous run is gone. Pool gives the same box back to sequential
+// runs, so with root image configured this covers upper layer of overlay root being dropped
+static int invoker_main(const std::vector<std::string> &args) {
+    int runs = stoi(args[0]);
+    for (int i = 0; i < runs; ++i) {
+        GenericTarget target = GenericTarget::from_current_executable("target");
+        Testing::safe_run({&target});
+        if (!target.exited() || target.get_exit_code() != 0) {
+            target.print_stats(std::cerr);
+            std::cerr << "Run " << i << " failed" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Exit code 1 means that file of previous run is seen
+static int target_main(const std::vector<std::string> &) {
+    if (access(MARKER, F_OK) == 0) {
+        return 1;
+    }
+    int fd = open(MARKER, O_CREAT | O_WRONLY, 0644);
+    if (fd < 0 || close(fd) != 0) {
+        return 2;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("invoker", invoker_main);
+    Testing::add_handler("target", target_main);
+    Testing::start(argc, argv);
+}
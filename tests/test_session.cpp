@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "testing.h"
+
+static int invoker_main(const std::vector<std::string> &args) {
+    int runs = stoi(args[0]);
+    libsbox::Session::Mode mode = Testing::parse_mode(args[1]);
+
+    libsbox::Session session;
+    auto error = session.connect("/etc/libsboxd/socket", mode);
+    if (error) {
+        std::cerr << "Failed to connect: " << error.get() << std::endl;
+        return 1;
+    }
+    assert(session.get_mode() == mode);
+
+    for (int i = 0; i < runs; ++i) {
+        GenericTarget target = GenericTarget::from_current_executable("target", std::to_string(i % 256));
+        error = session.run_together({&target});
+        if (error) {
+            std::cerr << "Failed to run tasks: " << error.get() << std::endl;
+            return 1;
+        }
+        target.assert_exited(i % 256);
+    }
+
+    assert(session.is_connected());
+    return 0;
+}
+
+static int target_main(const std::vector<std::string> &args) {
+    return stoi(args[0]);
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("invoker", invoker_main);
+    Testing::add_handler("target", target_main);
+    Testing::start(argc, argv);
+}
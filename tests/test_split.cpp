@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "testing.h"
+
+#include <memory>
+
+static int invoker_main(const std::vector<std::string> &args) {
+    // Independent tasks of one request run in different boxes, tasks connected with pipe run together
+    int num_independent = stoi(args[0]);
+    libsbox::Session session;
+    Testing::safe_connect(session, args[1]);
+
+    std::vector<std::unique_ptr<GenericTarget>> targets;
+    std::vector<libsbox::Task *> tasks;
+    libsbox::Pipe pipe;
+    for (int i = 0; i < num_independent; ++i) {
+        // Piped pair is put in the middle, so results of all jobs are merged back in request order
+        if (i == num_independent / 2) {
+            targets.push_back(std::make_unique<GenericTarget>(GenericTarget::from_current_executable("writer")));
+            targets.back()->get_stdout().use_pipe(pipe);
+            tasks.push_back(targets.back().get());
+            targets.push_back(std::make_unique<GenericTarget>(GenericTarget::from_current_executable("reader")));
+            targets.back()->get_stdin().use_pipe(pipe);
+            tasks.push_back(targets.back().get());
+        }
+        targets.push_back(std::make_unique<GenericTarget>(
+            GenericTarget::from_current_executable("target", std::to_string(i + 1))
+        ));
+        tasks.push_back(targets.back().get());
+    }
+
+    auto error = session.run_together(tasks);
+    if (error) {
+        std::cerr << "Failed to run tasks: " << error.get() << std::endl;
+        return 1;
+    }
+
+    int next_exit_code = 1;
+    for (size_t i = 0; i < targets.size(); ++i) {
+        if (static_cast<int>(i) == num_independent / 2) {
+            targets[i]->assert_exited(0);
+            // Reader exits with byte it got from writer
+            targets[i + 1]->assert_exited(42);
+            ++i;
+            continue;
+        }
+        targets[i]->assert_exited(next_exit_code++);
+    }
+    return 0;
+}
+
+static int target_main(const std::vector<std::string> &args) {
+    usleep(20000);
+    return stoi(args[0]);
+}
+
+static int writer_main(const std::vector<std::string> &) {
+    char c = 42;
+    return write(STDOUT_FILENO, &c, 1) == 1 ? 0 : 1;
+}
+
+static int reader_main(const std::vector<std::string> &) {
+    char c;
+    return read(STDIN_FILENO, &c, 1) == 1 ? c : 1;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("invoker", invoker_main);
+    Testing::add_handler("target", target_main);
+    Testing::add_handler("writer", writer_main);
+    Testing::add_handler("reader", reader_main);
+    Testing::start(argc, argv);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "testing.h"
+
+#include <time.h>
+
+static int invoker_main(const std::vector<std::string> &args) {
+    int interval_ms = stoi(args[1]);
+
+    libsbox::Session session;
+    Testing::safe_connect(session, args[0]);
+
+    GenericTarget target = GenericTarget::from_current_executable("target", "500");
+    target.set_time_limit_ms(2000);
+    target.set_telemetry_interval_ms(interval_ms);
+    std::vector<libsbox::TelemetrySample> samples;
+    target.set_telemetry_callback([&samples](const libsbox::TelemetrySample &sample) {
+        samples.push_back(sample);
+    });
+
+    // Task without telemetry interval never gets samples
+    GenericTarget quiet = GenericTarget::from_current_executable("target", "100");
+    std::vector<libsbox::TelemetrySample> quiet_samples;
+    quiet.set_telemetry_callback([&quiet_samples](const libsbox::TelemetrySample &sample) {
+        quiet_samples.push_back(sample);
+    });
+
+    auto error = session.run_together({&target, &quiet});
+    if (error) {
+        std::cerr << "Failed to run: " << error.get() << std::endl;
+        return 1;
+    }
+    target.print_stats(std::cerr);
+    target.assert_exited(0);
+    quiet.assert_exited(0);
+    assert(quiet_samples.empty());
+
+    std::cerr << "samples: " << samples.size() << std::endl;
+    // Samples may be dropped under load, but most of them must come
+    assert(static_cast<int64_t>(samples.size()) >= target.get_wall_time_usage_ms() / interval_ms / 2);
+    bool seen_alive = false;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const auto &sample = samples[i];
+        std::cerr << sample.wall_time_ms << "ms: time " << sample.time_usage_ms << "ms, memory "
+                  << sample.memory_usage_kb << "kb, pids " << sample.pids << ", stdout " << sample.stdout_bytes
+                  << std::endl;
+        assert(sample.wall_time_ms <= target.get_wall_time_usage_ms());
+        assert(sample.time_usage_ms <= target.get_time_usage_ms());
+        assert(sample.memory_usage_kb >= 0 && sample.pids >= 0);
+        // stdout is disabled
+        assert(sample.stdout_bytes == -1);
+        if (i > 0) {
+            assert(sample.wall_time_ms >= samples[i - 1].wall_time_ms + interval_ms);
+            assert(sample.time_usage_ms >= samples[i - 1].time_usage_ms);
+        }
+        seen_alive = seen_alive || sample.pids > 0;
+    }
+    assert(seen_alive);
+    return 0;
+}
+
+static int target_main(const std::vector<std::string> &args) {
+    double target_time_usage = static_cast<double>(stoi(args[0])) / 1000;
+    while (static_cast<double>(clock()) / CLOCKS_PER_SEC < target_time_usage) {
+        asm volatile ("" : : : "memory");
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("invoker", invoker_main);
+    Testing::add_handler("target", target_main);
+    Testing::start(argc, argv);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "testing.h"
+
+static int invoker_main(const std::vector<std::string> &args) {
+    libsbox::Session session;
+    Testing::safe_connect(session, args[0]);
+
+    GenericTarget target = GenericTarget::from_current_executable("target");
+    target.set_collect_timings(true);
+    auto error = session.run_together({&target});
+    if (error) {
+        std::cerr << "Failed to run tasks: " << error.get() << std::endl;
+        return 1;
+    }
+    target.assert_exited(0);
+
+    for (const auto &timing : target.get_timings_ns()) {
+        std::cerr << timing.first << ": " << timing.second << "ns" << std::endl;
+    }
+    for (const char *stage : {"parse", "queue", "prepare_containers", "write_tasks", "start_sync", "bind_mounts",
+                              "cgroup_create", "spawn", "exec", "wait", "umount", "collect_results"}) {
+        assert(target.get_timings_ns().count(stage) == 1);
+        assert(target.get_timings_ns().at(stage) >= 0);
+    }
+
+    std::vector<libsbox::StageLatency> stages;
+    libsbox::PoolStats pool{};
+    error = libsbox::get_stats(stages, pool);
+    if (error) {
+        std::cerr << "Failed to get stats: " << error.get() << std::endl;
+        return 1;
+    }
+    assert(!stages.empty());
+    for (const auto &stage : stages) {
+        std::cerr << stage.stage << ": count " << stage.count << ", p50 " << stage.p50_ns << "ns, p99 "
+                  << stage.p99_ns << "ns, p999 " << stage.p999_ns << "ns" << std::endl;
+        // Our own request went through every stage reported in timings
+        assert(stage.count > 0 || !target.get_timings_ns().count(stage.stage));
+        assert(stage.p50_ns <= stage.p99_ns && stage.p99_ns <= stage.p999_ns && stage.p999_ns <= stage.max_ns);
+    }
+    // Our own task took container from pool or started one
+    std::cerr << "pool: " << pool.hits << " hits, " << pool.misses << " misses" << std::endl;
+    assert(pool.hits + pool.misses > 0);
+    return 0;
+}
+
+static int target_main(const std::vector<std::string> &) {
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("invoker", invoker_main);
+    Testing::add_handler("target", target_main);
+    Testing::start(argc, argv);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2019 Andrei Odintsov <forestryks1@gmail.com>
+ */
+
+#include "testing.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+static const int FILL_DIRS = 16;
+static const int FILES_PER_DIR = 4;
+static const size_t FILE_BYTES = 1024 * 1024;
+// Space taken by box before anything is written is much smaller
+static const uint64_t CLEAN_BYTES = 16 * 1024 * 1024;
+static const int CLEAN_WAIT_MS = 5000;
+
+// Every run waits until space taken by previous run is freed, then fills /tmp again. Box root is tmpfs, so trash
+// left by previous runs is counted in space taken
+static int invoker_main(const std::vector<std::string> &args) {
+    int runs = stoi(args[0]);
+    for (int i = 0; i < runs; ++i) {
+        GenericTarget target = GenericTarget::from_current_executable("target");
+        Testing::safe_run({&target});
+        if (!target.exited() || target.get_exit_code() != 0) {
+            target.print_stats(std::cerr);
+            std::cerr << "Run " << i << " failed" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint64_t get_used_bytes() {
+    struct statvfs stat = {};
+    if (statvfs("/tmp", &stat) != 0) {
+        return UINT64_MAX;
+    }
+    return (stat.f_blocks - stat.f_bfree) * stat.f_frsize;
+}
+
+// Exit code 1 means that trash of previous run is not removed in time
+static int target_main(const std::vector<std::string> &) {
+    int waited_ms = 0;
+    while (get_used_bytes() > CLEAN_BYTES) {
+        if (waited_ms == CLEAN_WAIT_MS) {
+            return 1;
+        }
+        usleep(1000);
+        waited_ms++;
+    }
+
+    std::string data(FILE_BYTES, 'x');
+    for (int i = 0; i < FILL_DIRS; ++i) {
+        std::string dir = "/tmp/fill_" + std::to_string(i);
+        if (mkdir(dir.c_str(), 0755) != 0) {
+            return 2;
+        }
+        for (int j = 0; j < FILES_PER_DIR; ++j) {
+            std::string file = dir + "/" + std::to_string(j);
+            int fd = open(file.c_str(), O_CREAT | O_WRONLY, 0644);
+            if (fd < 0 || write(fd, data.data(), data.size()) != static_cast<ssize_t>(data.size()) || close(fd) != 0) {
+                return 2;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Testing::add_handler("invoker", invoker_main);
+    Testing::add_handler("target", target_main);
+    Testing::start(argc, argv);
+}
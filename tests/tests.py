@@ -50,3 +50,54 @@ for memory_limit in (16 * 1024, 256 * 1024, 512 * 1024, 1024 * 1024):
     tests.append(Test(["./test_memory_usage", "invoker", str(memory_limit), str(4096)]))
     tests.append(Test(["./test_memory_usage", "invoker", str(memory_limit), str(2048)], optional=True))
     tests.append(Test(["./test_memory_usage", "invoker", str(memory_limit), str(1024)], optional=True))
+
+for runs in (1, 10, 100):
+    for codec in ("json", "binary", "shm"):
+        tests.append(Test(["./test_session", "invoker", str(runs), codec]))
+
+for num_sessions, runs_per_session in ((1, 1), (1, 10), (1, 50), (4, 10), (16, 5)):
+    for mode in ("binary", "shm"):
+        tests.append(Test(["./test_async", "invoker", str(num_sessions), str(runs_per_session), mode]))
+
+for mode in ("json", "binary", "shm"):
+    tests.append(Test(["./test_timings", "invoker", mode]))
+
+for mode in ("json", "binary", "shm"):
+    tests.append(Test(["./test_priority", "invoker", mode]))
+
+for num_independent in (1, 4, 16):
+    for mode in ("binary", "shm"):
+        tests.append(Test(["./test_split", "invoker", str(num_independent), mode]))
+
+for runs in (1, 10):
+    tests.append(Test(["./test_cpuset", "invoker", str(runs)]))
+
+# Virtual machines often have no hardware counters
+for instruction_limit in (10 ** 6, 10 ** 8, 10 ** 9):
+    tests.append(Test(["./test_instruction_limit", "invoker", str(instruction_limit)], optional=True))
+
+for interval_ms in (20, 100):
+    for mode in ("json", "binary", "shm"):
+        tests.append(Test(["./test_telemetry", "invoker", mode, str(interval_ms)]))
+
+for repeat, limit in ((1, 1024), (100, 1024), (100000, 1024 * 1024), (1, 0)):
+    for mode in ("json", "binary", "shm"):
+        tests.append(Test(["./test_capture", "invoker", mode, str(repeat), str(limit)]))
+
+for rounds in (1, 10):
+    tests.append(Test(["./test_pool_fds", "invoker", str(rounds)]))
+
+for processes, rounds in ((1, 1000), (4, 1000), (20, 1000)):
+    tests.append(Test(["./test_id_getter", "invoker", str(processes), str(rounds)]))
+
+for count, generations in ((2, 1000), (9, 1000), (65, 100)):
+    tests.append(Test(["./test_barrier", "invoker", str(count), str(generations)]))
+
+for runs in (2, 20):
+    tests.append(Test(["./test_root_reset", "invoker", str(runs)]))
+
+for runs in (2, 20):
+    tests.append(Test(["./test_trash", "invoker", str(runs)]))
+
+for runs in (1, 5):
+    tests.append(Test(["./test_cgroup_reset", "invoker", str(runs)]))